@@ -0,0 +1,162 @@
+//Synthetic X client for the end-to-end benchmarks driven by bench/run.sh. Draws with the core
+//protocol only, so that the compositor receives the damage of an ordinary client. Runs until
+//terminated.
+#include <xcb/xcb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef unsigned int uint;
+
+enum SCENARIO{
+	SCENARIO_ANIMATION, //full-screen window redrawn every frame
+	SCENARIO_PARTIAL, //small square moving over a full-screen window
+	SCENARIO_SCROLL, //terminal-like scrolling, one line of text per frame
+	SCENARIO_WINDOWS, //many small windows, all redrawn every frame
+	SCENARIO_COUNT
+};
+static const char *pscenarioNames[] = {"animation","partial","scroll","windows"};
+
+enum{
+	LINE_HEIGHT = 16,
+	SQUARE_SIZE = 64,
+	SMALL_WINDOW_WIDTH = 160,
+	SMALL_WINDOW_HEIGHT = 120
+};
+
+static xcb_connection_t *pcon;
+static xcb_screen_t *pscr;
+
+//The clients are started together with the window manager, wait until it has taken over the root.
+static int WaitForWM(){
+	xcb_intern_atom_reply_t *patomReply = xcb_intern_atom_reply(pcon,xcb_intern_atom(pcon,0,strlen("_NET_SUPPORTING_WM_CHECK"),"_NET_SUPPORTING_WM_CHECK"),0);
+	if(!patomReply)
+		return 0;
+	xcb_atom_t atom = patomReply->atom;
+	free(patomReply);
+
+	for(uint i = 0; i < 100; ++i){
+		xcb_get_property_reply_t *ppropertyReply = xcb_get_property_reply(pcon,xcb_get_property(pcon,0,pscr->root,atom,XCB_ATOM_WINDOW,0,1),0);
+		if(ppropertyReply){
+			int found = xcb_get_property_value_length(ppropertyReply) > 0;
+			free(ppropertyReply);
+			if(found)
+				return 1;
+		}
+		struct timespec interval = {0,100000000}; //100ms
+		nanosleep(&interval,0);
+	}
+	return 0;
+}
+
+static xcb_window_t CreateWindow(uint w, uint h){
+	xcb_window_t window = xcb_generate_id(pcon);
+	uint32_t values[] = {pscr->black_pixel,XCB_EVENT_MASK_EXPOSURE};
+	xcb_create_window(pcon,XCB_COPY_FROM_PARENT,window,pscr->root,0,0,w,h,0,XCB_WINDOW_CLASS_INPUT_OUTPUT,pscr->root_visual,XCB_CW_BACK_PIXEL|XCB_CW_EVENT_MASK,values);
+	xcb_map_window(pcon,window);
+	return window;
+}
+
+static void Fill(xcb_gcontext_t gc, xcb_window_t window, uint32_t color, int16_t x, int16_t y, uint w, uint h){
+	xcb_change_gc(pcon,gc,XCB_GC_FOREGROUND,&color);
+	xcb_rectangle_t rect = {x,y,(uint16_t)w,(uint16_t)h};
+	xcb_poly_fill_rectangle(pcon,window,gc,1,&rect);
+}
+
+int main(int argc, char **argv){
+	if(argc < 2){
+		fprintf(stderr,"Usage: %s animation|partial|scroll|windows [frames per second] [window count]\n",argv[0]);
+		return 1;
+	}
+	uint scenario;
+	for(scenario = 0; scenario < SCENARIO_COUNT; ++scenario)
+		if(strcmp(argv[1],pscenarioNames[scenario]) == 0)
+			break;
+	if(scenario == SCENARIO_COUNT){
+		fprintf(stderr,"Unknown scenario %s.\n",argv[1]);
+		return 1;
+	}
+	uint rate = argc > 2?(uint)atoi(argv[2]):60;
+	uint windowCount = argc > 3?(uint)atoi(argv[3]):64;
+	if(rate == 0 || windowCount == 0){
+		fprintf(stderr,"The rate and the window count must be positive.\n");
+		return 1;
+	}
+
+	pcon = xcb_connect(0,0);
+	if(xcb_connection_has_error(pcon)){
+		fprintf(stderr,"Failed to connect to the X server.\n");
+		return 1;
+	}
+	pscr = xcb_setup_roots_iterator(xcb_get_setup(pcon)).data;
+	if(!WaitForWM()){
+		fprintf(stderr,"No window manager.\n");
+		xcb_disconnect(pcon);
+		return 1;
+	}
+
+	uint w = pscr->width_in_pixels, h = pscr->height_in_pixels;
+	if(scenario != SCENARIO_WINDOWS)
+		windowCount = 1;
+	xcb_window_t *pwindows = malloc(windowCount*sizeof(xcb_window_t));
+	for(uint i = 0; i < windowCount; ++i)
+		pwindows[i] = scenario == SCENARIO_WINDOWS?CreateWindow(SMALL_WINDOW_WIDTH,SMALL_WINDOW_HEIGHT):CreateWindow(w,h);
+
+	xcb_gcontext_t gc = xcb_generate_id(pcon);
+	uint32_t gcValues[] = {pscr->white_pixel,0};
+	xcb_create_gc(pcon,gc,pwindows[0],XCB_GC_FOREGROUND|XCB_GC_GRAPHICS_EXPOSURES,gcValues);
+	xcb_flush(pcon);
+
+	struct timespec frameTime;
+	clock_gettime(CLOCK_MONOTONIC,&frameTime);
+	long interval = 1000000000l/rate;
+
+	for(uint frame = 0;; ++frame){
+		//The window manager may have resized the windows, the draws are clipped to them
+		uint32_t color = (frame*0x030507)&0xffffff;
+		switch(scenario){
+		case SCENARIO_ANIMATION:
+			Fill(gc,pwindows[0],color,0,0,w,h);
+			Fill(gc,pwindows[0],~color&0xffffff,(int16_t)(frame*8%w),0,SQUARE_SIZE,h);
+			break;
+		case SCENARIO_PARTIAL:{
+			uint columns = w/SQUARE_SIZE, rows = h/SQUARE_SIZE;
+			uint cell = frame%(columns*rows);
+			Fill(gc,pwindows[0],color,(int16_t)(cell%columns*SQUARE_SIZE),(int16_t)(cell/columns*SQUARE_SIZE),SQUARE_SIZE,SQUARE_SIZE);
+			}
+			break;
+		case SCENARIO_SCROLL:{
+			char line[256];
+			int16_t y = (int16_t)(h-LINE_HEIGHT);
+			int length = snprintf(line,sizeof(line),"%08u  the quick brown fox jumps over the lazy dog  %08x",frame,color);
+			xcb_copy_area(pcon,pwindows[0],pwindows[0],gc,0,LINE_HEIGHT,0,0,w,h-LINE_HEIGHT);
+			Fill(gc,pwindows[0],pscr->black_pixel,0,y,w,LINE_HEIGHT);
+			uint32_t foreground = pscr->white_pixel;
+			xcb_change_gc(pcon,gc,XCB_GC_FOREGROUND,&foreground);
+			xcb_image_text_8(pcon,(uint8_t)length,pwindows[0],gc,4,(int16_t)(h-4),line);
+			}
+			break;
+		case SCENARIO_WINDOWS:
+			for(uint i = 0; i < windowCount; ++i)
+				Fill(gc,pwindows[i],(color+i*0x102030)&0xffffff,0,0,SMALL_WINDOW_WIDTH,SMALL_WINDOW_HEIGHT);
+			break;
+		}
+
+		//Round trip to keep the requests from queuing up if the server falls behind
+		free(xcb_get_input_focus_reply(pcon,xcb_get_input_focus(pcon),0));
+		for(xcb_generic_event_t *pevent = xcb_poll_for_event(pcon); pevent; pevent = xcb_poll_for_event(pcon))
+			free(pevent);
+		if(xcb_connection_has_error(pcon))
+			break;
+
+		frameTime.tv_nsec += interval;
+		for(; frameTime.tv_nsec >= 1000000000l; frameTime.tv_nsec -= 1000000000l)
+			++frameTime.tv_sec;
+		clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&frameTime,0);
+	}
+
+	free(pwindows);
+	xcb_disconnect(pcon);
+	return 0;
+}
@@ -0,0 +1,105 @@
+#!/bin/sh
+#End-to-end benchmark: starts Xvfb and chamfer on lavapipe, runs a client scenario for the given
+#time, and leaves the --stats-json summary of the window manager in the output directory.
+#
+#  run.sh <chamfer> <client> <scenario> <seconds> <config> <shader path> <output directory> [rate] [windows]
+#
+#Exits with 77 (skipped) if Xvfb or the lavapipe driver is not available. VK_ICD_FILENAMES is
+#respected if already set, to benchmark another driver.
+
+if [ $# -lt 7 ]; then
+	echo "usage: $0 <chamfer> <client> <scenario> <seconds> <config> <shader path> <output directory> [rate] [windows]" >&2
+	exit 1
+fi
+chamfer=$1
+client=$2
+scenario=$3
+seconds=$4
+config=$5
+shaders=$6
+outdir=$7
+shift 7
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+	echo "Xvfb not found, skipping." >&2
+	exit 77
+fi
+if [ -z "$VK_ICD_FILENAMES" ]; then
+	for icd in /usr/share/vulkan/icd.d/lvp_icd*.json /etc/vulkan/icd.d/lvp_icd*.json; do
+		if [ -f "$icd" ]; then
+			VK_ICD_FILENAMES=$icd
+			break
+		fi
+	done
+	if [ -z "$VK_ICD_FILENAMES" ]; then
+		echo "lavapipe not found, skipping." >&2
+		exit 77
+	fi
+fi
+export VK_ICD_FILENAMES
+
+mkdir -p "$outdir" || exit 1
+tmp=$(mktemp -d) || exit 1
+xvfb=
+wm=
+app=
+cleanup(){
+	[ -n "$app" ] && kill "$app" 2>/dev/null
+	[ -n "$wm" ] && kill -KILL "$wm" 2>/dev/null
+	[ -n "$xvfb" ] && kill "$xvfb" 2>/dev/null
+	rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+#-displayfd picks a free display and writes its number once the server accepts connections
+Xvfb -displayfd 3 -screen 0 1920x1080x24 -nolisten tcp 3>"$tmp/display" 2>"$tmp/xvfb.log" &
+xvfb=$!
+for i in $(seq 50); do
+	[ -s "$tmp/display" ] && break
+	sleep 0.1
+done
+if [ ! -s "$tmp/display" ]; then
+	echo "Xvfb failed to start:" >&2
+	cat "$tmp/xvfb.log" >&2
+	exit 1
+fi
+DISPLAY=:$(cat "$tmp/display")
+export DISPLAY
+
+json=$outdir/$scenario.json
+rm -f "$json"
+"$chamfer" --config="$config" --shader-path="$shaders" --stats-json="$json" &
+wm=$!
+
+#the client waits for the window manager to take over the root window
+"$client" "$scenario" "$@" &
+app=$!
+sleep "$seconds"
+if ! kill -0 "$app" 2>/dev/null; then
+	echo "The $scenario client exited early." >&2
+	exit 1
+fi
+
+#SIGTERM ends the window manager's main loop and writes the summary. The client is stopped
+#afterwards, so that its teardown is not part of the measurement.
+kill -TERM "$wm"
+for i in $(seq 100); do
+	kill -0 "$wm" 2>/dev/null || break
+	sleep 0.1
+done
+if kill -0 "$wm" 2>/dev/null; then
+	echo "chamfer did not exit." >&2
+	exit 1
+fi
+wait "$wm"
+status=$?
+wm=
+kill "$app"
+wait "$app" 2>/dev/null
+app=
+if [ $status -ne 0 ] || [ ! -s "$json" ]; then
+	echo "chamfer exited with $status without writing $json." >&2
+	exit 1
+fi
+cat "$json"
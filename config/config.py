@@ -71,6 +71,8 @@ class Key(Enum):
 	MONITOR_BRIGHTNESS_UP = auto()
 	MONITOR_BRIGHTNESS_DOWN = auto()
 
+	DEBUG_MODE = auto()
+
 def GetFocusTiled():
 	root = chamfer.GetRoot();
 	focusHead = root.GetFocus();
@@ -251,6 +253,7 @@ class Backend(chamfer.Backend):
 			binder.BindKey(ord('w'),chamfer.MOD_MASK_SHIFT,Key.LIFT_CONTAINER.value);
 			binder.BindKey(ord('e'),chamfer.MOD_MASK_SHIFT,Key.LAYOUT.value);
 			binder.BindKey(latin1.XK_onehalf,chamfer.MOD_MASK_SHIFT,Key.SPLIT_V.value);
+			binder.BindKey(ord('d'),chamfer.MOD_MASK_SHIFT,Key.DEBUG_MODE.value);
 	
 	def OnCreateContainer(self):
 		print("OnCreateContainer()");
@@ -487,6 +490,11 @@ class Backend(chamfer.Backend):
 			psutil.Popen(["xbacklight","-dec","20"]);
 			pass;
 
+		elif keyId == Key.DEBUG_MODE.value:
+			#cycle through the overdraw and shading cost heatmaps
+			self.debugMode = (getattr(self,"debugMode",0)+1)%3;
+			chamfer.SetDebugMode(self.debugMode);
+
 	def OnKeyRelease(self, keyId):
 		print("key release: {}".format(keyId));
 	
@@ -4,9 +4,18 @@
 #define FLAGS_ADJACENT_RIGHT 0x4
 #define FLAGS_ADJACENT_UP 0x8
 #define FLAGS_ADJACENT_DOWN 0x16
+#define FLAGS_DEBUG_OVERDRAW 0x100 //CompositorInterface::DEBUG_MODE_OVERDRAW
+#define FLAGS_DEBUG_SHADING_COST 0x200 //CompositorInterface::DEBUG_MODE_SHADING_COST
+
+//Debug modes: the output is replaced by an additive step along a black-red-yellow-white ramp, saturating
+//at 16 steps. The steps count the shaded layers, or the SDF evaluations and texture fetches of each layer.
+float4 DebugHeat(uint flags, float cost){
+	return float4((flags & FLAGS_DEBUG_OVERDRAW?1.0f:cost)*float3(0.25f,0.125f,0.0625f),0.0f);
+}
 
 //https://developer.nvidia.com/vulkan-shader-resource-binding
 //https://www.khronos.org/assets/uploads/developers/library/2018-gdc-webgl-and-gltf/2-Vulkan-HLSL-There-and-Back-Again_Mar18.pdf
+#if !defined(CHAMFER_INSTANCED)
 [[vk::push_constant]] cbuffer cb{
 	float2 xy0;
 	float2 xy1;
@@ -14,5 +23,7 @@
 	float2 border;
 	uint flags;
 	float time;
+	uint maskOrigin; //frame mask tile in the atlas (x|y<<16), FRAME_MASK_NONE if not available
 };
+#endif
 
@@ -52,6 +52,8 @@ float4 main(float4 posh : SV_Position, float2 texc : TEXCOORD0, uint geomId : ID
 	float2 r = posh.xy-p;
 	float4 c = content.Load(float3(r,0)); //p already has the 0.5f offset
 
+	if(flags & (FLAGS_DEBUG_OVERDRAW|FLAGS_DEBUG_SHADING_COST))
+		return DebugHeat(flags,1.0f);
 	return c;
 }
 
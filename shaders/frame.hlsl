@@ -13,6 +13,7 @@ float2 main(uint x : SV_VertexID) : POSITION0{
 #elif defined(SHADER_STAGE_GS)
 
 #include "chamfer.hlsl"
+#include "frame_common.hlsl"
 
 const float2 vertexPositions[4] = {
 	float2(0.0f,0.0f),
@@ -45,24 +46,28 @@ void main(point float2 posh[1], inout TriangleStream<GS_OUTPUT> stream){
 	borderWidth *= 2.0f; //stretch to double to allow room for the effects
 
 	//window shadow
-	[unroll]
-	for(uint i = 0; i < 4; ++i){
-		output.posh = float4(vertices[i]+(2.0*vertexPositions[i]-1.0f)*4.0f*borderWidth,0,1);
-		output.texc = vertexPositions[i];
-		output.geomId = 0;
-		stream.Append(output);
+	if(shadowEnabled){
+		[unroll]
+		for(uint i = 0; i < 4; ++i){
+			output.posh = float4(vertices[i]+(2.0*vertexPositions[i]-1.0f)*4.0f*borderWidth,0,1);
+			output.texc = vertexPositions[i];
+			output.geomId = 0;
+			stream.Append(output);
+		}
+		stream.RestartStrip();
 	}
-	stream.RestartStrip();
 
 	//window border
-	[unroll]
-	for(uint i = 0; i < 4; ++i){
-		output.posh = float4(vertices[i]+(2.0*vertexPositions[i]-1.0f)*borderWidth,0,1);
-		output.texc = vertexPositions[i];
-		output.geomId = 1;
-		stream.Append(output);
+	if(borderEnabled){
+		[unroll]
+		for(uint i = 0; i < 4; ++i){
+			output.posh = float4(vertices[i]+(2.0*vertexPositions[i]-1.0f)*borderWidth,0,1);
+			output.texc = vertexPositions[i];
+			output.geomId = 1;
+			stream.Append(output);
+		}
+		stream.RestartStrip();
 	}
-	stream.RestartStrip();
 
 	//window contents
 	[unroll]
@@ -82,65 +87,34 @@ void main(point float2 posh[1], inout TriangleStream<GS_OUTPUT> stream){
 
 [[vk::binding(0)]] Texture2D<float4> content;
 //[[vk::binding(1)]] SamplerState sm;
+[[vk::binding(1)]] Texture2D<float4> frameMask; //g: border, a: shadow
 
-//TODO: create chamfer with ndc coords and sdf transformation
-float4 main(float4 posh : SV_Position, float2 texc : TEXCOORD0, uint geomId : ID0) : SV_Target{
-	float2 aspect = float2(1.0f,screen.x/screen.y);
-	float2 borderWidth = border*aspect; //this results in borders half the gap size
-
-	float2 p = screen*(0.5f*xy0+0.5f);
-
-	float2 p1 = screen*(0.25f*(xy0+xy1)+0.5f);
-	float2 m = screen*(0.5f*xy1+0.5f);
-	float2 d1 = m-p; //d1: extent of the window
-	float2 constScaling = screen.x/(d1.x+2.0f*screen.x*borderWidth.x);
-
-	float4 c = float4(0.0f,0.0f,0.0f,1.0f);
-	if(geomId == 0){
-		float2 q = abs(posh.xy-p1);
-		if(length(max(q-(0.5f*d1-40.0f),0.0f))-40.0f < 0.0f){
-			discard; //remove background to allow for transparency effects
-			return c;
-		}
-		float d = (length(max(abs((posh.xy-p1)/(1.0f+0.015f*constScaling.x))-(0.5f*d1-50.0f),0.0f))-75.0f)*1.015f;//-min(max(q.x,q.y),0.0f)*(1.0f+0.015f*constScaling.x);
+float4 LoadFrameMaskTexel(uint2 t){
+	return frameMask.Load(int3(t,0));
+}
 
-		return float4(0.0f,0.0f,0.0f,0.9f*saturate(-d/30.0f));
+float4 LoadContent(float2 r, uint textureIndex){
+	//float4 c = content.Sample(sm,texc);
+	return content.Load(float3(r,0));
+}
 
-	}else
-	if(geomId == 1){
-		if(length(max(abs(posh.xy-p1)-(0.5f*d1-50.0f),0.0f))-75.0f > 0.0f){
-			discard;
-			return c;
-		}
-		if(length(max(abs(posh.xy-p1)-(0.5f*d1-40.0f-2.0f),0.0f))-40.0f < 0.0f){
-			discard; //remove background to allow for transparency effects
-			return c;
-		}
-		if(flags & FLAGS_FOCUS)
-			//dashed line around focus
-			if((any(posh > p1-0.5f*d1 && posh < p1+0.5f*d1 && fmod(floor(posh/50.0f),3.0f) < 0.5f) &&
-				any(posh < p1-0.5f*d1-0.25f*screen*borderWidth || posh > p1+0.5f*d1+0.25f*screen*borderWidth)))
-				c.xyz = float3(1.0f,0.6f,0.33f);
-
-	}else{
-		if(length(max(abs(posh.xy-p1)-(0.5f*d1-40.0f),0.0f))-40.0f > 0.0f){
-			return c;
-			discard;
-		}
-	
-		//float4 c = content.Sample(sm,texc);
-		float2 r = posh.xy-p;
-		c = content.Load(float3(r,0)); //p already has the 0.5f offset
-		//^^returns black when out of bounds (border)
-
-		//float2 period = float2(1.8f*0.5f*d1.x-70.0f*constScaling.x,400.0f);
-		//float2 q = fmod(posh.xy-p1,period)-0.5f*period;
-		//if(length(max(abs(q)-float2(10.0f/(0.5f*d1.x),100.0f),0.0f))-40.0f > 0.0f)
-			//c.w = 1.0f;
-	}
+#include "frame_common.hlsl"
 
+float4 main(float4 posh : SV_Position, float2 texc : TEXCOORD0, uint geomId : ID0) : SV_Target{
+	Frame frame;
+	frame.xy0 = xy0;
+	frame.xy1 = xy1;
+	frame.border = border;
+	frame.flags = flags;
+	frame.variant = 0;
+	frame.maskOrigin = maskOrigin;
+	frame.textureIndex = 0;
+
+	float cost = 0.0f;
+	float4 c = Shade(posh,geomId,frame,cost);
+	if(flags & (FLAGS_DEBUG_OVERDRAW|FLAGS_DEBUG_SHADING_COST))
+		return DebugHeat(flags,cost);
 	return c;
 }
 
 #endif
-
@@ -0,0 +1,138 @@
+//Shared by frame.hlsl and frame_instanced.hlsl: the feature toggles, the frame mask lookup and the
+//distance functions of the shadow, border and contents. Included after chamfer.hlsl and the push
+//constants (screen). The fragment stage expects the including shader to define
+//	float4 LoadFrameMaskTexel(uint2 t): texel of the mask atlas,
+//	float4 LoadContent(float2 r, uint textureIndex): texel of the window contents.
+
+//Feature toggles, specialized to false by the compositor for the windows that don't need them.
+//The constant ids are Pipeline::VARIANT_CONSTANT_ID plus the bit of the Pipeline::VARIANT.
+[[vk::constant_id(1000)]] const bool shadowEnabled = true;
+[[vk::constant_id(1001)]] const bool borderEnabled = true;
+[[vk::constant_id(1002)]] const bool roundedCornersEnabled = true;
+[[vk::constant_id(1003)]] const bool focusIndicatorEnabled = true;
+
+//Pipeline::VARIANT, passed per window by the instanced path, which draws all the variants at once
+#define VARIANT_NO_SHADOW 0x1
+#define VARIANT_NO_BORDER 0x2
+#define VARIANT_NO_ROUNDED_CORNERS 0x4
+#define VARIANT_NO_FOCUS_INDICATOR 0x8
+
+bool ShadowEnabled(uint variant){
+	return shadowEnabled && !(variant & VARIANT_NO_SHADOW);
+}
+
+bool BorderEnabled(uint variant){
+	return borderEnabled && !(variant & VARIANT_NO_BORDER);
+}
+
+bool RoundedCornersEnabled(uint variant){
+	return roundedCornersEnabled && !(variant & VARIANT_NO_ROUNDED_CORNERS);
+}
+
+bool FocusIndicatorEnabled(uint variant){
+	return focusIndicatorEnabled && !(variant & VARIANT_NO_FOCUS_INDICATOR);
+}
+
+#if defined(SHADER_STAGE_PS)
+
+#define FRAME_MASK_CELL_SIZE 256 //CompositorInterface::FRAME_MASK_CELL_SIZE
+#define FRAME_MASK_INSET 50 //CompositorInterface::FRAME_MASK_INSET
+#define FRAME_MASK_NONE 0xffffffff
+
+struct Frame{
+	float2 xy0;
+	float2 xy1;
+	float2 border;
+	uint flags;
+	uint variant; //0 if drawn individually, the spec constants select the features instead
+	uint maskOrigin; //frame mask tile in the atlas (x|y<<16), FRAME_MASK_NONE if not available
+	uint textureIndex; //passed to LoadContent()
+};
+
+float4 LoadFrameMask(float2 posh, float2 p1, float2 d1, uint maskOrigin){
+	//fold into the corner tile, the innermost texels extend over the edges and the interior
+	float2 r = clamp(abs(posh-p1)-0.5f*d1+FRAME_MASK_INSET,0.0f,FRAME_MASK_CELL_SIZE-1.0f);
+	return LoadFrameMaskTexel(uint2(maskOrigin&0xffff,maskOrigin>>16)+uint2(r));
+}
+
+//Discarded fragments are kept in the debug modes, as the distance functions evaluated for them
+//cost as much as for the ones drawn. main() then shows the cost instead of the color.
+#define DISCARD {if(frame.flags & (FLAGS_DEBUG_OVERDRAW|FLAGS_DEBUG_SHADING_COST)) return c; discard; return c;}
+
+//TODO: create chamfer with ndc coords and sdf transformation
+float4 Shade(float4 posh, uint geomId, Frame frame, inout float cost){
+	float2 aspect = float2(1.0f,screen.x/screen.y);
+	float2 borderWidth = frame.border*aspect; //this results in borders half the gap size
+
+	float2 p = screen*(0.5f*frame.xy0+0.5f);
+
+	float2 p1 = screen*(0.25f*(frame.xy0+frame.xy1)+0.5f);
+	float2 m = screen*(0.5f*frame.xy1+0.5f);
+	float2 d1 = m-p; //d1: extent of the window
+	float2 constScaling = screen.x/(d1.x+2.0f*screen.x*borderWidth.x);
+
+	float4 c = float4(0.0f,0.0f,0.0f,1.0f);
+	if(geomId == 0){
+		if(frame.maskOrigin != FRAME_MASK_NONE){
+			cost = 1.0f;
+			float a = LoadFrameMask(posh.xy,p1,d1,frame.maskOrigin).w;
+			if(a <= 0.0f){
+				DISCARD;
+			}
+			return float4(0.0f,0.0f,0.0f,a);
+		}
+		cost = 2.0f;
+		float2 q = abs(posh.xy-p1);
+		if(length(max(q-(0.5f*d1-40.0f),0.0f))-40.0f < 0.0f){
+			DISCARD; //remove background to allow for transparency effects
+		}
+		float d = (length(max(abs((posh.xy-p1)/(1.0f+0.015f*constScaling.x))-(0.5f*d1-50.0f),0.0f))-75.0f)*1.015f;//-min(max(q.x,q.y),0.0f)*(1.0f+0.015f*constScaling.x);
+
+		return float4(0.0f,0.0f,0.0f,0.9f*saturate(-d/30.0f));
+
+	}else
+	if(geomId == 1){
+		if(frame.maskOrigin != FRAME_MASK_NONE){
+			cost = 1.0f;
+			if(LoadFrameMask(posh.xy,p1,d1,frame.maskOrigin).y < 0.5f){
+				DISCARD;
+			}
+		}else{
+			cost = 2.0f;
+			if(length(max(abs(posh.xy-p1)-(0.5f*d1-50.0f),0.0f))-75.0f > 0.0f){
+				DISCARD;
+			}
+			if(length(max(abs(posh.xy-p1)-(0.5f*d1-40.0f-2.0f),0.0f))-40.0f < 0.0f){
+				DISCARD; //remove background to allow for transparency effects
+			}
+		}
+		if(FocusIndicatorEnabled(frame.variant) && (frame.flags & FLAGS_FOCUS)){
+			cost += 1.0f;
+			//dashed line around focus
+			if((any(posh > p1-0.5f*d1 && posh < p1+0.5f*d1 && fmod(floor(posh/50.0f),3.0f) < 0.5f) &&
+				any(posh < p1-0.5f*d1-0.25f*screen*borderWidth || posh > p1+0.5f*d1+0.25f*screen*borderWidth)))
+				c.xyz = float3(1.0f,0.6f,0.33f);
+		}
+
+	}else{
+		bool roundedCorners = RoundedCornersEnabled(frame.variant);
+		cost = roundedCorners?2.0f:1.0f;
+		if(roundedCorners && length(max(abs(posh.xy-p1)-(0.5f*d1-40.0f),0.0f))-40.0f > 0.0f){
+			return c;
+			discard;
+		}
+
+		float2 r = posh.xy-p;
+		c = LoadContent(r,frame.textureIndex); //p already has the 0.5f offset
+		//^^returns black when out of bounds (border)
+
+		//float2 period = float2(1.8f*0.5f*d1.x-70.0f*constScaling.x,400.0f);
+		//float2 q = fmod(posh.xy-p1,period)-0.5f*period;
+		//if(length(max(abs(q)-float2(10.0f/(0.5f*d1.x),100.0f),0.0f))-40.0f > 0.0f)
+			//c.w = 1.0f;
+	}
+
+	return c;
+}
+
+#endif
@@ -0,0 +1,123 @@
+
+//Instanced version of frame.hlsl. Per-window data is read from a storage buffer, and each
+//instance expands into the shadow, border and content quads in the vertex shader. The shading is
+//shared with frame.hlsl (frame_common.hlsl), the variant of each window is passed per instance.
+
+#define CHAMFER_INSTANCED
+#include "chamfer.hlsl"
+
+#define TEXTURE_COUNT 4096 //CompositorInterface::TEXTURE_TABLE_SIZE
+
+[[vk::push_constant]] cbuffer cb{
+	float2 screen;
+	uint instanceOffset; //first instance of the draw in the instance buffer
+	uint frameMaskIndex; //mask atlas in the texture table
+};
+
+struct VS_OUTPUT{
+	float4 posh : SV_Position;
+	float2 texc : TEXCOORD;
+	nointerpolation uint geomId : ID;
+	nointerpolation float4 frameVec : FRAME;
+	nointerpolation float2 border : BORDER;
+	nointerpolation uint flags : FLAGS;
+	nointerpolation uint variant : VARIANT;
+	nointerpolation uint maskOrigin : MASK;
+	nointerpolation uint textureIndex : TEXTURE;
+};
+
+#if defined(SHADER_STAGE_VS)
+
+#include "frame_common.hlsl"
+
+struct Instance{
+	float4 frameVec; //xy0, xy1
+	float2 border;
+	uint flags;
+	float time;
+	uint textureIndex;
+	uint maskOrigin;
+	uint variant;
+};
+
+[[vk::binding(0,0)]] StructuredBuffer<Instance> instances;
+
+static const float2 vertexPositions[4] = {
+	float2(0.0f,0.0f),
+	float2(1.0f,0.0f),
+	float2(0.0f,1.0f),
+	float2(1.0f,1.0f)
+};
+
+static const uint quadIndices[6] = {0,1,2,2,1,3};
+
+//18 vertices per instance: shadow, border and contents
+VS_OUTPUT main(uint x : SV_VertexID, uint instanceId : SV_InstanceID){
+	Instance instance = instances[instanceOffset+instanceId];
+
+	float2 vertices[4] = {
+		instance.frameVec.xy,
+		float2(instance.frameVec.z,instance.frameVec.y),
+		float2(instance.frameVec.x,instance.frameVec.w),
+		instance.frameVec.zw
+	};
+
+	float2 aspect = float2(1.0f,screen.x/screen.y);
+	float2 borderWidth = instance.border*aspect; //this results in borders half the gap size
+
+	borderWidth *= 2.0f; //stretch to double to allow room for the effects
+
+	uint geomId = x/6;
+	uint i = quadIndices[x%6];
+	float2 scale[3] = {4.0f*borderWidth,borderWidth,float2(0.0f,0.0f)};
+
+	VS_OUTPUT output;
+	output.posh = float4(vertices[i]+(2.0*vertexPositions[i]-1.0f)*scale[geomId],0,1);
+	//the quads of the disabled features are collapsed, no fragments are generated for them
+	if((geomId == 0 && !ShadowEnabled(instance.variant)) || (geomId == 1 && !BorderEnabled(instance.variant)))
+		output.posh = float4(0.0f,0.0f,0.0f,1.0f);
+	output.texc = vertexPositions[i];
+	output.geomId = geomId;
+	output.frameVec = instance.frameVec;
+	output.border = instance.border;
+	output.flags = instance.flags;
+	output.variant = instance.variant;
+	output.maskOrigin = instance.maskOrigin;
+	output.textureIndex = instance.textureIndex;
+
+	return output;
+}
+
+#elif defined(SHADER_STAGE_PS)
+
+[[vk::binding(0,1)]] Texture2D<float4> textureTable[TEXTURE_COUNT];
+
+float4 LoadFrameMaskTexel(uint2 t){
+	return textureTable[frameMaskIndex].Load(int3(t,0));
+}
+
+float4 LoadContent(float2 r, uint textureIndex){
+	return textureTable[NonUniformResourceIndex(textureIndex)].Load(float3(r,0));
+}
+
+#include "frame_common.hlsl"
+
+float4 main(VS_OUTPUT input) : SV_Target{
+	Frame frame;
+	frame.xy0 = input.frameVec.xy;
+	frame.xy1 = input.frameVec.zw;
+	frame.border = input.border;
+	frame.flags = input.flags;
+	frame.variant = input.variant;
+	frame.maskOrigin = input.maskOrigin;
+	frame.textureIndex = input.textureIndex;
+
+	float cost = 0.0f;
+	float4 c = Shade(input.posh,input.geomId,frame,cost);
+	if(input.flags & (FLAGS_DEBUG_OVERDRAW|FLAGS_DEBUG_SHADING_COST))
+		return DebugHeat(input.flags,cost);
+	return c;
+}
+
+#endif
+
@@ -10,21 +10,27 @@
 
 namespace Compositor{
 
-Texture::Texture(uint _w, uint _h, VkFormat format, const CompositorInterface *_pcomp) : pcomp(_pcomp), imageLayout(VK_IMAGE_LAYOUT_UNDEFINED), w(_w), h(_h){
+Texture::Texture(uint _w, uint _h, VkFormat format, const CompositorInterface *_pcomp) : pcomp(_pcomp), imageLayout(VK_IMAGE_LAYOUT_UNDEFINED), queueFamilyIndex(~0u), textureIndex(~0u), uploadByteCount(0), w(_w), h(_h){
 	//
 	auto m = std::find_if(formatSizeMap.begin(),formatSizeMap.end(),[&](auto &r)->bool{
 		return r.first == format;
 	});
 	formatIndex = m-formatSizeMap.begin();
 
-	DebugPrintf(stdout,"*** creating texture: %u, (%ux%u)\n",(*m).second,w,h);
+	DebugLog("Creating texture: %u, (%ux%u)\n",(*m).second,w,h);
 
 	//staging buffer
 	VkBufferCreateInfo bufferCreateInfo = {};
 	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferCreateInfo.size = (*m).second*w*h;
 	bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	//host written staging data is read by both the transfer (first upload) and the graphics queue
+	uint queueFamilyIndex1[] = {pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_GRAPHICS],pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_TRANSFER]};
+	if(pcomp->asyncTransfer){
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferCreateInfo.queueFamilyIndexCount = 2;
+		bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndex1;
+	}else bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	if(vkCreateBuffer(pcomp->logicalDev,&bufferCreateInfo,0,&stagingBuffer) != VK_SUCCESS)
 		throw Exception("Failed to create a staging buffer.");
 	
@@ -122,16 +128,21 @@ void Texture::Unmap(const VkCommandBuffer *pcommandBuffer, const VkRect2D *prect
 	imageSubresourceRange.levelCount = 1;
 	imageSubresourceRange.layerCount = 1;
 
-	//create in host stage (map), use in transfer stage
+	//create in host stage (map), use in transfer stage. If the image has been sampled on the graphics
+	//queue, the frames in flight may still be reading it (the mask atlas, or a window drawn in the
+	//previous frame), and the layout transition has to wait for their fragment shaders.
+	bool sampled = imageLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && !RequiresOwnershipTransfer();
 	VkImageMemoryBarrier imageMemoryBarrier = {};
 	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	imageMemoryBarrier.image = image;
 	imageMemoryBarrier.subresourceRange = imageSubresourceRange;
-	imageMemoryBarrier.srcAccessMask = 0;
+	imageMemoryBarrier.srcAccessMask = sampled?VK_ACCESS_SHADER_READ_BIT:0;
 	imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 	imageMemoryBarrier.oldLayout = imageLayout;//VK_IMAGE_LAYOUT_UNDEFINED;
 	imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	vkCmdPipelineBarrier(*pcommandBuffer,VK_PIPELINE_STAGE_HOST_BIT,VK_PIPELINE_STAGE_TRANSFER_BIT,0,
+	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	vkCmdPipelineBarrier(*pcommandBuffer,sampled?VK_PIPELINE_STAGE_HOST_BIT|VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT:VK_PIPELINE_STAGE_HOST_BIT,VK_PIPELINE_STAGE_TRANSFER_BIT,0,
 		0,0,0,0,1,&imageMemoryBarrier);
 
 	//transfer "stage"
@@ -148,6 +159,7 @@ void Texture::Unmap(const VkCommandBuffer *pcommandBuffer, const VkRect2D *prect
 		bufferImageCopyBuffer[i].bufferOffset = (w*prects[i].offset.y+prects[i].offset.x)*formatSizeMap[formatIndex].second;//w/4*4; //(w*y+x)*format
 		bufferImageCopyBuffer[i].bufferRowLength = w;
 		bufferImageCopyBuffer[i].bufferImageHeight = h;
+		uploadByteCount += prects[i].extent.width*prects[i].extent.height*formatSizeMap[formatIndex].second;
 	}
 	vkCmdCopyBufferToImage(*pcommandBuffer,stagingBuffer,image,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,rectCount,bufferImageCopyBuffer.data());
 	/*VkBufferImageCopy bufferImageCopy = {};
@@ -164,18 +176,57 @@ void Texture::Unmap(const VkCommandBuffer *pcommandBuffer, const VkRect2D *prect
 	bufferImageCopy.bufferImageHeight = h;
 	vkCmdCopyBufferToImage(*pcommandBuffer,stagingBuffer,image,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,1,&bufferImageCopy);*/
 
-	//create in transfer stage, use in fragment shader stage
-	imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	if(RequiresOwnershipTransfer()){
+		//release to the graphics queue, the matching acquire is done with AcquireOwnership()
+		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageMemoryBarrier.dstAccessMask = 0;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageMemoryBarrier.srcQueueFamilyIndex = pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_TRANSFER];
+		imageMemoryBarrier.dstQueueFamilyIndex = pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_GRAPHICS];
+		vkCmdPipelineBarrier(*pcommandBuffer,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,0,
+			0,0,0,0,1,&imageMemoryBarrier);
+
+	}else{
+		//create in transfer stage, use in fragment shader stage
+		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkCmdPipelineBarrier(*pcommandBuffer,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,0,
+			0,0,0,0,1,&imageMemoryBarrier);
+	}
+	
+	imageLayout = imageMemoryBarrier.newLayout;
+	queueFamilyIndex = pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_GRAPHICS];
+}
+
+bool Texture::RequiresOwnershipTransfer() const{
+	//Only the first upload goes through the transfer queue. Once the graphics queue has sampled the image,
+	//the partial updates have to be ordered after the rendering anyway and are recorded on the graphics queue.
+	return pcomp->asyncTransfer && queueFamilyIndex == ~0u;
+}
+
+void Texture::AcquireOwnership(const VkCommandBuffer *pcommandBuffer){
+	VkImageMemoryBarrier imageMemoryBarrier = {};
+	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageMemoryBarrier.image = image;
+	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+	imageMemoryBarrier.subresourceRange.levelCount = 1;
+	imageMemoryBarrier.subresourceRange.layerCount = 1;
+	imageMemoryBarrier.srcAccessMask = 0;
 	imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 	imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	vkCmdPipelineBarrier(*pcommandBuffer,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,0,
+	imageMemoryBarrier.srcQueueFamilyIndex = pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_TRANSFER];
+	imageMemoryBarrier.dstQueueFamilyIndex = pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_GRAPHICS];
+	//chained with the upload semaphore wait at the fragment shader stage
+	vkCmdPipelineBarrier(*pcommandBuffer,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,0,
 		0,0,0,0,1,&imageMemoryBarrier);
-	
-	imageLayout = imageMemoryBarrier.newLayout;
 }
 
-ShaderModule::ShaderModule(const char *_pname, const Blob *pblob, const CompositorInterface *_pcomp) : pcomp(_pcomp), pname(mstrdup(_pname)){
+ShaderModule::ShaderModule(const char *_pname, const Blob *pblob, CompositorInterface *_pcomp) : pcomp(_pcomp), pname(mstrdup(_pname)){
 	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
 	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t *>(pblob->GetBufferPointer());
@@ -196,7 +247,20 @@ ShaderModule::ShaderModule(const char *_pname, const Blob *pblob, const Composit
 
 	pdescSetLayouts = new VkDescriptorSetLayout[setCount];
 	for(uint i = 0; i < setCount; ++i){
+		//the bindless texture table is shared by all shaders that declare it
+		if(pcomp->descriptorIndexing && preflectDescSets[i]->binding_count == 1 && strcmp(preflectDescSets[i]->bindings[0]->name,"textureTable") == 0){
+			pdescSetLayouts[i] = pcomp->textureTableLayout;
+
+			Binding &b = bindings.emplace_back();
+			b.pname = mstrdup(preflectDescSets[i]->bindings[0]->name);
+			b.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			b.setIndex = i;
+			b.binding = preflectDescSets[i]->bindings[0]->binding;
+			continue;
+		}
+
 		VkDescriptorSetLayoutBinding *pbindings = new VkDescriptorSetLayoutBinding[preflectDescSets[i]->binding_count];
+		VkDescriptorBindingFlags *pbindingFlags = new VkDescriptorBindingFlags[preflectDescSets[i]->binding_count];
 		for(uint j = 0; j < preflectDescSets[i]->binding_count; ++j){
 			pbindings[j] = (VkDescriptorSetLayoutBinding){};
 			pbindings[j].binding = preflectDescSets[i]->bindings[j]->binding;
@@ -206,6 +270,8 @@ ShaderModule::ShaderModule(const char *_pname, const Blob *pblob, const Composit
 				pbindings[j].descriptorCount *= preflectDescSets[i]->bindings[j]->array.dims[k];
 			pbindings[j].stageFlags = (VkShaderStageFlagBits)reflectShaderModule.shader_stage;
 			pbindings[j].pImmutableSamplers = &pcomp->pointSampler;
+			//descriptor arrays (instanced path) are not required to be fully written
+			pbindingFlags[j] = pbindings[j].descriptorCount > 1 && pcomp->descriptorIndexing?VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT:0;
 
 			Binding &b = bindings.emplace_back();
 			b.pname = mstrdup(preflectDescSets[i]->bindings[j]->name);
@@ -214,36 +280,129 @@ ShaderModule::ShaderModule(const char *_pname, const Blob *pblob, const Composit
 			b.binding = pbindings[j].binding;
 		}
 
+		VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo = {};
+		bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		bindingFlagsCreateInfo.bindingCount = preflectDescSets[i]->binding_count;
+		bindingFlagsCreateInfo.pBindingFlags = pbindingFlags;
+
 		VkDescriptorSetLayoutCreateInfo descSetLayoutCreateInfo = {};
 		descSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descSetLayoutCreateInfo.pNext = pcomp->descriptorIndexing?&bindingFlagsCreateInfo:0;
 		descSetLayoutCreateInfo.bindingCount = preflectDescSets[i]->binding_count;
 		descSetLayoutCreateInfo.pBindings = pbindings;
 		if(vkCreateDescriptorSetLayout(pcomp->logicalDev,&descSetLayoutCreateInfo,0,&pdescSetLayouts[i]) != VK_SUCCESS)
 			throw Exception("Failed to create a descriptor set layout.");
 
 		delete []pbindings;
+		delete []pbindingFlags;
 	}
 
 	delete []preflectDescSets;
+
+	//the push constant member holding the time, if declared
+	uint pushConstantId = ~0u, timeMember = ~0u;
+	if(reflectShaderModule.push_constant_block_count > 0){
+		const SpvReflectBlockVariable &block = reflectShaderModule.push_constant_blocks[0];
+		pushConstantId = block.spirv_id;
+		for(uint i = 0; i < block.member_count; ++i)
+			if(block.members[i].name && strcmp(block.members[i].name,"time") == 0)
+				timeMember = i;
+	}
 	spvReflectDestroyShaderModule(&reflectShaderModule);
+
+	frameMaskBinding = std::any_of(bindings.begin(),bindings.end(),[&](auto &r)->bool{
+		return strcmp(r.pname,"frameMask") == 0;
+	});
+
+	//Find the declared variant constants (OpDecorate <id> SpecId <n>), the ones with ids outside the
+	//reserved range belong to the shader itself. The bundled reflection library doesn't enumerate
+	//these, so the instruction stream is scanned directly.
+	//The time is read if an access chain (OpAccessChain, OpInBoundsAccessChain) into the push
+	//constants indexes its member. The constants are declared before the functions that use them.
+	specConstantMask = 0;
+	readsTime = false;
+	std::vector<uint> timeMemberIds;
+	const uint32_t *pcode = shaderModuleCreateInfo.pCode;
+	for(size_t i = 5, n = shaderModuleCreateInfo.codeSize/sizeof(uint32_t); i < n;){
+		uint wordCount = pcode[i]>>16;
+		if(wordCount == 0 || i+wordCount > n)
+			break;
+		uint op = pcode[i]&0xffff;
+		if(op == 71 && wordCount >= 4 && pcode[i+2] == 1 && pcode[i+3]-Pipeline::VARIANT_CONSTANT_ID < 32)
+			specConstantMask |= 1u<<(pcode[i+3]-Pipeline::VARIANT_CONSTANT_ID);
+		else
+		if(op == 43 && wordCount == 4 && pcode[i+3] == timeMember)
+			timeMemberIds.push_back(pcode[i+2]);
+		else
+		if((op == 65 || op == 66) && wordCount >= 5 && pcode[i+3] == pushConstantId &&
+			std::find(timeMemberIds.begin(),timeMemberIds.end(),pcode[i+4]) != timeMemberIds.end())
+			readsTime = true;
+		i += wordCount;
+	}
 }
 
 ShaderModule::~ShaderModule(){
 	mstrfree(pname);
 	for(Binding &b : bindings)
 		mstrfree(b.pname);
+	CompositorInterface::ReleaseEntry releaseEntry;
+	releaseEntry.type = CompositorInterface::ReleaseEntry::TYPE_DESC_SET_LAYOUT;
 	for(uint i = 0; i < setCount; ++i)
-		vkDestroyDescriptorSetLayout(pcomp->logicalDev,pdescSetLayouts[i],0);
+		if(pdescSetLayouts[i] != pcomp->textureTableLayout){
+			releaseEntry.descSetLayout = pdescSetLayouts[i];
+			pcomp->ReleaseObject(releaseEntry);
+		}
 	delete []pdescSetLayouts;
-	vkDestroyShaderModule(pcomp->logicalDev,shaderModule,0);
+	releaseEntry.type = CompositorInterface::ReleaseEntry::TYPE_SHADER_MODULE;
+	releaseEntry.shaderModule = shaderModule;
+	pcomp->ReleaseObject(releaseEntry);
 }
 
 const std::vector<std::pair<VkFormat, uint>> Texture::formatSizeMap = {
 	{VK_FORMAT_R8G8B8A8_UNORM,4}
 };
 
-Pipeline::Pipeline(ShaderModule *_pvertexShader, ShaderModule *_pgeometryShader, ShaderModule *_pfragmentShader, const CompositorInterface *_pcomp) : pshaderModule{_pvertexShader,_pgeometryShader,_pfragmentShader}, pcomp(_pcomp){
-	//
+Pipeline::Pipeline(ShaderModule *_pvertexShader, ShaderModule *_pgeometryShader, ShaderModule *_pfragmentShader, uint _stateKey, CompositorInterface *_pcomp) : pshaderModule{_pvertexShader,_pgeometryShader,_pfragmentShader}, stateKey(_stateKey), pcomp(_pcomp), pipeline(0), state(STATE_UNCOMPILED), compileTime(0.0f){
+	readsTime = std::any_of(pshaderModule,pshaderModule+SHADER_MODULE_COUNT,[&](auto *p)->bool{
+		return p && p->readsTime;
+	});
+
+	pushConstantStages = 0;
+	for(uint i = 0, stageBit[] = {VK_SHADER_STAGE_VERTEX_BIT,VK_SHADER_STAGE_GEOMETRY_BIT,VK_SHADER_STAGE_FRAGMENT_BIT}; i < SHADER_MODULE_COUNT; ++i){
+		//the push constants are made available to the stage that generates the geometry and the fragment shader
+		if(pshaderModule[i] && (i != SHADER_MODULE_VERTEX || !pshaderModule[SHADER_MODULE_GEOMETRY]))
+			pushConstantStages |= stageBit[i];
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = pushConstantStages;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = 44;
+
+	uint setCount = 0;
+	for(uint i = 0; i < SHADER_MODULE_COUNT; setCount += pshaderModule[i]?pshaderModule[i]->setCount:0, ++i);
+	VkDescriptorSetLayout *pcombinedSets = new VkDescriptorSetLayout[setCount];
+
+	for(uint i = 0, descPointer = 0; i < SHADER_MODULE_COUNT; ++i){
+		if(!pshaderModule[i])
+			continue;
+		std::copy(pshaderModule[i]->pdescSetLayouts,pshaderModule[i]->pdescSetLayouts+pshaderModule[i]->setCount,pcombinedSets+descPointer);
+		descPointer += pshaderModule[i]->setCount;
+	}
+
+	VkPipelineLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.setLayoutCount = setCount;
+	layoutCreateInfo.pSetLayouts = pcombinedSets;
+	layoutCreateInfo.pushConstantRangeCount = 1;
+	layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	if(vkCreatePipelineLayout(pcomp->logicalDev,&layoutCreateInfo,0,&pipelineLayout) != VK_SUCCESS)
+		throw Exception("Failed to crate a pipeline layout.");
+	
+	delete []pcombinedSets;
+}
+
+void Pipeline::Compile(){
 	VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo = {};
 	vertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertexInputStateCreateInfo.vertexBindingDescriptionCount = 0;
@@ -251,20 +410,50 @@ Pipeline::Pipeline(ShaderModule *_pvertexShader, ShaderModule *_pgeometryShader,
 	vertexInputStateCreateInfo.vertexAttributeDescriptionCount = 0;
 	vertexInputStateCreateInfo.pVertexAttributeDescriptions = 0;
 
+	//Without a geometry shader the vertex shader is expected to output triangle lists (instanced path).
+	//Otherwise every window is a single point expanded by the geometry shader.
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCreateInfo = {};
 	inputAssemblyStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	//inputAssemblyStateCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssemblyStateCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+	inputAssemblyStateCreateInfo.topology = pshaderModule[SHADER_MODULE_GEOMETRY]?VK_PRIMITIVE_TOPOLOGY_POINT_LIST:VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssemblyStateCreateInfo.primitiveRestartEnable = VK_FALSE;
 
-	VkPipelineShaderStageCreateInfo shaderStageCreateInfo[3];
+	//Variant bits specialize the corresponding boolean constants to false. Constants that aren't part
+	//of the state key keep the defaults declared in the shader.
+	VkSpecializationMapEntry specMapEntries[SHADER_MODULE_COUNT][32];
+	VkSpecializationInfo specInfo[SHADER_MODULE_COUNT];
+	VkBool32 specData[32];
+	for(uint i = 0; i < 32; ++i)
+		specData[i] = VK_FALSE;
+
+	VkPipelineShaderStageCreateInfo shaderStageCreateInfo[SHADER_MODULE_COUNT];
+	uint stageCount = 0;
 
 	for(uint i = 0, stageBit[] = {VK_SHADER_STAGE_VERTEX_BIT,VK_SHADER_STAGE_GEOMETRY_BIT,VK_SHADER_STAGE_FRAGMENT_BIT}; i < SHADER_MODULE_COUNT; ++i){
-		shaderStageCreateInfo[i] = (VkPipelineShaderStageCreateInfo){};
-		shaderStageCreateInfo[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		shaderStageCreateInfo[i].stage = (VkShaderStageFlagBits)stageBit[i];
-		shaderStageCreateInfo[i].module = pshaderModule[i]->shaderModule;
-		shaderStageCreateInfo[i].pName = "main";
+		if(!pshaderModule[i])
+			continue;
+		shaderStageCreateInfo[stageCount] = (VkPipelineShaderStageCreateInfo){};
+		shaderStageCreateInfo[stageCount].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStageCreateInfo[stageCount].stage = (VkShaderStageFlagBits)stageBit[i];
+		shaderStageCreateInfo[stageCount].module = pshaderModule[i]->shaderModule;
+		shaderStageCreateInfo[stageCount].pName = "main";
+
+		uint specMask = stateKey & pshaderModule[i]->specConstantMask;
+		if(specMask != 0){
+			specInfo[i] = (VkSpecializationInfo){};
+			specInfo[i].pMapEntries = specMapEntries[i];
+			specInfo[i].dataSize = sizeof(specData);
+			specInfo[i].pData = specData;
+			for(uint j = 0; j < 32; ++j){
+				if(!(specMask & (1u<<j)))
+					continue;
+				VkSpecializationMapEntry &mapEntry = specMapEntries[i][specInfo[i].mapEntryCount++];
+				mapEntry.constantID = VARIANT_CONSTANT_ID+j;
+				mapEntry.offset = j*sizeof(VkBool32);
+				mapEntry.size = sizeof(VkBool32);
+			}
+			shaderStageCreateInfo[stageCount].pSpecializationInfo = &specInfo[i];
+		}
+		++stageCount;
 	}
 
 	VkViewport viewport = {};
@@ -332,31 +521,6 @@ Pipeline::Pipeline(ShaderModule *_pvertexShader, ShaderModule *_pgeometryShader,
 	colorBlendStateCreateInfo.blendConstants[2] = 0.0f;
 	colorBlendStateCreateInfo.blendConstants[3] = 0.0f;
 
-	VkPushConstantRange pushConstantRange = {};
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_GEOMETRY_BIT|VK_SHADER_STAGE_FRAGMENT_BIT;
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = 40;
-
-	uint setCount = 0;
-	for(uint i = 0; i < SHADER_MODULE_COUNT; setCount += pshaderModule[i]->setCount, ++i);
-	VkDescriptorSetLayout *pcombinedSets = new VkDescriptorSetLayout[setCount];
-
-	for(uint i = 0, descPointer = 0; i < SHADER_MODULE_COUNT; ++i){
-		std::copy(pshaderModule[i]->pdescSetLayouts,pshaderModule[i]->pdescSetLayouts+pshaderModule[i]->setCount,pcombinedSets+descPointer);
-		descPointer += pshaderModule[i]->setCount;
-	}
-
-	VkPipelineLayoutCreateInfo layoutCreateInfo = {};
-	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	layoutCreateInfo.setLayoutCount = setCount;
-	layoutCreateInfo.pSetLayouts = pcombinedSets;
-	layoutCreateInfo.pushConstantRangeCount = 1;
-	layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
-	if(vkCreatePipelineLayout(pcomp->logicalDev,&layoutCreateInfo,0,&pipelineLayout) != VK_SUCCESS)
-		throw Exception("Failed to crate a pipeline layout.");
-	
-	delete []pcombinedSets;
-
 	//VkDynamicState dynamicStates[1] = {VK_DYNAMIC_STATE_SCISSOR};
 
 	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
@@ -367,7 +531,7 @@ Pipeline::Pipeline(ShaderModule *_pvertexShader, ShaderModule *_pgeometryShader,
 
 	VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo = {};
 	graphicsPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	graphicsPipelineCreateInfo.stageCount = sizeof(shaderStageCreateInfo)/sizeof(shaderStageCreateInfo[0]);
+	graphicsPipelineCreateInfo.stageCount = stageCount;
 	graphicsPipelineCreateInfo.pStages = shaderStageCreateInfo;
 	graphicsPipelineCreateInfo.pVertexInputState = &vertexInputStateCreateInfo; //!!
 	graphicsPipelineCreateInfo.pInputAssemblyState = &inputAssemblyStateCreateInfo;
@@ -383,13 +547,27 @@ Pipeline::Pipeline(ShaderModule *_pvertexShader, ShaderModule *_pgeometryShader,
 	graphicsPipelineCreateInfo.basePipelineHandle = 0;
 	graphicsPipelineCreateInfo.basePipelineIndex = -1;
 
-	if(vkCreateGraphicsPipelines(pcomp->logicalDev,0,1,&graphicsPipelineCreateInfo,0,&pipeline) != VK_SUCCESS)
+	struct timespec compileBeginTime, compileEndTime;
+	clock_gettime(CLOCK_MONOTONIC,&compileBeginTime);
+	if(vkCreateGraphicsPipelines(pcomp->logicalDev,pcomp->pipelineCache,1,&graphicsPipelineCreateInfo,0,&pipeline) != VK_SUCCESS){
+		state = STATE_FAILED;
 		throw Exception("Failed to create a graphics pipeline.");
+	}
+	clock_gettime(CLOCK_MONOTONIC,&compileEndTime);
+	compileTime = timespec_diff(compileEndTime,compileBeginTime);
+
+	state = STATE_READY; //the pipeline may be used by other threads from now on
 }
 
 Pipeline::~Pipeline(){
-	vkDestroyPipeline(pcomp->logicalDev,pipeline,0);
-	vkDestroyPipelineLayout(pcomp->logicalDev,pipelineLayout,0);
+	//destroyed once the frames that bind the pipeline have completed
+	CompositorInterface::ReleaseEntry releaseEntry;
+	releaseEntry.type = CompositorInterface::ReleaseEntry::TYPE_PIPELINE;
+	releaseEntry.pipeline = pipeline;
+	pcomp->ReleaseObject(releaseEntry);
+	releaseEntry.type = CompositorInterface::ReleaseEntry::TYPE_PIPELINE_LAYOUT;
+	releaseEntry.pipelineLayout = pipelineLayout;
+	pcomp->ReleaseObject(releaseEntry);
 }
 
 }
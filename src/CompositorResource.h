@@ -3,6 +3,7 @@
 
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_xcb.h>
+#include <atomic>
 
 namespace Compositor{
 
@@ -13,10 +14,14 @@ public:
 	~Texture();
 	const void * Map() const;
 	void Unmap(const VkCommandBuffer *, const VkRect2D *, uint);
+	bool RequiresOwnershipTransfer() const;
+	void AcquireOwnership(const VkCommandBuffer *);
 
 	const class CompositorInterface *pcomp;
 	VkImage image;
 	VkImageLayout imageLayout;
+	uint queueFamilyIndex; //owning queue family, ~0 until the first upload
+	uint textureIndex; //slot in the bindless texture table, ~0 if not available
 	VkImageView imageView;
 	VkDeviceMemory deviceMemory;
 
@@ -24,6 +29,7 @@ public:
 	VkDeviceMemory stagingMemory;
 
 	uint stagingMemorySize;
+	uint64 uploadByteCount; //copied from the staging buffer over the lifetime of the texture
 	uint w, h;
 	uint formatIndex;
 
@@ -34,14 +40,17 @@ public:
 
 class ShaderModule{
 public:
-	ShaderModule(const char *, const Blob *, const class CompositorInterface *);
+	ShaderModule(const char *, const Blob *, class CompositorInterface *);
 	~ShaderModule();
 
-	const class CompositorInterface *pcomp;
+	class CompositorInterface *pcomp; //the handles are released through it
 	const char *pname;
 	VkShaderModule shaderModule;
 	VkDescriptorSetLayout *pdescSetLayouts;
 	uint setCount;
+	uint specConstantMask; //bit i set if the shader declares the variant constant with id Pipeline::VARIANT_CONSTANT_ID+i
+	bool frameMaskBinding; //samples the shadow and border masks
+	bool readsTime; //the time push constant is used
 
 	struct Binding{
 		const char *pname;
@@ -54,8 +63,9 @@ public:
 
 class Pipeline{
 public:
-	Pipeline(ShaderModule *, ShaderModule *, ShaderModule *, const class CompositorInterface *);
+	Pipeline(ShaderModule *, ShaderModule *, ShaderModule *, uint, class CompositorInterface *);
 	~Pipeline();
+	void Compile();
 
 	enum SHADER_MODULE{
 		SHADER_MODULE_VERTEX,
@@ -63,10 +73,31 @@ public:
 		SHADER_MODULE_FRAGMENT,
 		SHADER_MODULE_COUNT
 	}; //note: code in Pipeline() relies on this order
+	//State keys of the shader variants. Bit i specializes the boolean constant with the id
+	//VARIANT_CONSTANT_ID+i to false. The ids are reserved, so that the constants of user shaders
+	//are left untouched.
+	enum VARIANT{
+		VARIANT_NO_SHADOW = 0x1,
+		VARIANT_NO_BORDER = 0x2,
+		VARIANT_NO_ROUNDED_CORNERS = 0x4,
+		VARIANT_NO_FOCUS_INDICATOR = 0x8,
+		VARIANT_CONSTANT_ID = 1000
+	};
 	ShaderModule *pshaderModule[SHADER_MODULE_COUNT];
-	const class CompositorInterface *pcomp;
+	uint stateKey; //distinguishes pipelines created from the same shaders
+	class CompositorInterface *pcomp;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline pipeline;
+	VkShaderStageFlags pushConstantStages;
+	bool readsTime; //animated, the secondary command buffers are recorded every frame
+	enum STATE{
+		STATE_UNCOMPILED,
+		STATE_QUEUED, //waiting for the compile thread
+		STATE_READY,
+		STATE_FAILED
+	};
+	std::atomic<uint> state;
+	float compileTime; //seconds spent in vkCreateGraphicsPipelines
 };
 
 }
@@ -3,6 +3,8 @@
 #include "backend.h"
 #include <cstdlib>
 #include <algorithm>
+#include <unistd.h>
+#include <sys/select.h>
 
 #include <xcb/xcb.h>
 #include <xcb/randr.h>
@@ -18,6 +20,11 @@ typedef xcb_atom_t Atom;
 #include <X11/Xatom.h>
 
 #include <cerrno>
+#include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace Backend{
 
@@ -201,9 +208,14 @@ void X11Client::UpdateTranslation(const WManager::Rectangle *prect){
 
 bool X11Client::ProtocolSupport(xcb_atom_t atom){
 	xcb_get_property_cookie_t propertyCookie = xcb_icccm_get_wm_protocols(pbackend->pcon,window,pbackend->atoms[X11Backend::ATOM_WM_PROTOCOLS]);
+	xcb_get_property_reply_t *propertyReply = pbackend->LogReply(xcb_get_property_reply(pbackend->pcon,propertyCookie,0));
+	if(!propertyReply)
+		return false;
 	xcb_icccm_get_wm_protocols_reply_t protocols;
-	if(xcb_icccm_get_wm_protocols_reply(pbackend->pcon,propertyCookie,&protocols,0) != 1)
+	if(xcb_icccm_get_wm_protocols_from_reply(propertyReply,&protocols) != 1){
+		free(propertyReply);
 		return false;
+	}
 
 	bool support = false;
 	for(uint i = 0; i < protocols.atoms_len; ++i)
@@ -277,13 +289,14 @@ void X11Container::Fullscreen1(){
 	}else{
 		xcb_grab_server(pbackend->pcon);
 		xcb_get_property_cookie_t propertyCookie = xcb_get_property(pbackend->pcon,false,pclient11->window,pbackend->ewmh._NET_WM_STATE,XCB_GET_PROPERTY_TYPE_ANY,0,4096);
-		xcb_get_property_reply_t *propertyReply = xcb_get_property_reply(pbackend->pcon,propertyCookie,0);
+		xcb_get_property_reply_t *propertyReply = pbackend->LogReply(xcb_get_property_reply(pbackend->pcon,propertyCookie,0));
 		if(!propertyReply){
 			xcb_ungrab_server(pbackend->pcon);
 			return;
 		}
 		uint l = xcb_get_property_value_length(propertyReply);
 		if(l == 0){
+			free(propertyReply);
 			xcb_ungrab_server(pbackend->pcon);
 			return;
 		}
@@ -307,7 +320,7 @@ void X11Container::Fullscreen1(){
 	xcb_flush(pbackend->pcon);
 }
 
-X11Backend::X11Backend() : lastTime(XCB_CURRENT_TIME){
+X11Backend::X11Backend() : lastTime(XCB_CURRENT_TIME), wakeFd(-1), deferStack(false), stackPending(false), peventLog(0){
 	//
 }
 
@@ -338,6 +351,17 @@ xcb_atom_t X11Backend::GetAtom(const char *pstr) const{
 	return atom;
 }
 
+bool X11Backend::FindKeyBinding(uint keyId, xcb_keycode_t *pkeycode, uint *pmask) const{
+	auto m = std::find_if(keycodes.begin(),keycodes.end(),[&](auto &binding)->bool{
+		return binding.keyId == keyId;
+	});
+	if(m == keycodes.end())
+		return false;
+	*pkeycode = (*m).keycode;
+	*pmask = (*m).mask;
+	return true;
+}
+
 void X11Backend::StackRecursiveAppendix(const WManager::Client *pclient){
 	auto s = [&](auto &p)->bool{
 		return pclient == p.first;
@@ -372,6 +396,11 @@ void X11Backend::StackRecursive(const WManager::Container *pcontainer){
 }
 
 void X11Backend::StackClients(){
+	if(deferStack){
+		stackPending = true;
+		return;
+	}
+	Profiler::Scope profilerScope(Profiler::PHASE_STACK);
 	SortStackAppendix();
 
 	const WManager::Container *proot = GetRoot();
@@ -398,6 +427,46 @@ void X11Backend::StackClients(){
 	}
 }
 
+void X11Backend::FlushStack(){
+	deferStack = false;
+	if(!stackPending)
+		return;
+	stackPending = false;
+	StackClients();
+}
+
+xcb_generic_event_t * X11Backend::WaitForEvent(bool forcePoll) const{
+	if(!forcePoll && wakeFd < 0)
+		return xcb_wait_for_event(pcon);
+	
+	//Return after a short timeout if nothing arrives, so that the caller can retry its deferred work.
+	//Without the timeout, wait until an event arrives or the wake descriptor becomes readable.
+	xcb_generic_event_t *pevent = xcb_poll_for_event(pcon);
+	if(pevent)
+		return pevent;
+
+	sint fd = xcb_get_file_descriptor(pcon);
+
+	fd_set in;
+	FD_ZERO(&in);
+	FD_SET(fd,&in);
+	if(wakeFd >= 0)
+		FD_SET(wakeFd,&in);
+
+	struct timespec timeout = {0,1000000}; //1ms
+	if(pselect(std::max(fd,wakeFd)+1,&in,0,0,forcePoll?&timeout:0,0) <= 0)
+		return 0; //timeout, or interrupted by a signal
+	if(wakeFd >= 0 && FD_ISSET(wakeFd,&in)){
+		char buffer[64];
+		while(read(wakeFd,buffer,sizeof(buffer)) > 0);
+	}
+	return xcb_poll_for_event(pcon);
+}
+
+void X11Backend::SetWakeDescriptor(sint fd){
+	wakeFd = fd;
+}
+
 /*void X11Backend::HandleTimer() const{
 	char buffer[32];
 
@@ -412,12 +481,162 @@ void X11Backend::StackClients(){
 	xcb_flush(pcon);
 }*/
 
+//trace span names of the core events, extension events (damage) share a name
+static const char * GetEventName(uint8_t responseType){
+	static const char *peventNames[] = {
+		"Error","Reply","KeyPress","KeyRelease","ButtonPress","ButtonRelease","MotionNotify","EnterNotify",
+		"LeaveNotify","FocusIn","FocusOut","KeymapNotify","Expose","GraphicsExposure","NoExposure","VisibilityNotify",
+		"CreateNotify","DestroyNotify","UnmapNotify","MapNotify","MapRequest","ReparentNotify","ConfigureNotify","ConfigureRequest",
+		"GravityNotify","ResizeRequest","CirculateNotify","CirculateRequest","PropertyNotify","SelectionClear","SelectionRequest","SelectionNotify",
+		"ColormapNotify","ClientMessage","MappingNotify","GenericEvent"
+	};
+	uint type = responseType & 0x7f;
+	return type < sizeof(peventNames)/sizeof(peventNames[0])?peventNames[type]:"ExtensionEvent";
+}
+
 const char *X11Backend::patomStrs[ATOM_COUNT] = {
 	//"CHAMFER_ALARM",
 	"WM_PROTOCOLS","WM_DELETE_WINDOW","ESETROOT_PMAP_ID","_X_ROOTPMAP_ID"
 };
 
-Default::Default() : X11Backend(), pdragClient(0){
+static const char peventLogMagic[8] = {'C','H','A','M','F','L','O','G'};
+
+EventLog::EventLog(const char *pfileName, MODE _mode, xcb_window_t _root, xcb_window_t _ewmhWindow) : mode(_mode), batchResult(0), root(_root), ewmhWindow(_ewmhWindow), pf(0), beginTime(Profiler::GetTime()), eventCount(0), pdata(0), dataSize(0), offset(0), desync(false){
+	if(mode == MODE_RECORD){
+		pf = fopen(pfileName,"wb");
+		if(!pf)
+			throw Exception("Failed to open the event log for writing.");
+		Header header = {};
+		memcpy(header.magic,peventLogMagic,sizeof(header.magic));
+		header.version = 1;
+		header.root = root;
+		header.ewmhWindow = ewmhWindow;
+		fwrite(&header,sizeof(header),1,pf);
+		return;
+	}
+
+	sint fd = open(pfileName,O_RDONLY);
+	if(fd == -1)
+		throw Exception("Failed to open the event log.");
+	struct stat st;
+	if(fstat(fd,&st) == -1 || (size_t)st.st_size < sizeof(Header)){
+		close(fd);
+		throw Exception("Invalid event log.");
+	}
+	dataSize = st.st_size;
+	void *pmap = mmap(0,dataSize,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(pmap == MAP_FAILED)
+		throw Exception("Failed to map the event log.");
+	pdata = (const unsigned char *)pmap;
+	madvise(pmap,dataSize,MADV_SEQUENTIAL);
+
+	const Header *pheader = (const Header *)pdata;
+	if(memcmp(pheader->magic,peventLogMagic,sizeof(pheader->magic)) != 0 || pheader->version != 1){
+		munmap(pmap,dataSize);
+		throw Exception("Invalid event log, or unsupported version.");
+	}
+	root = pheader->root;
+	ewmhWindow = pheader->ewmhWindow;
+	offset = sizeof(Header);
+}
+
+EventLog::~EventLog(){
+	if(pf)
+		fclose(pf);
+	if(pdata)
+		munmap((void*)pdata,dataSize);
+}
+
+void EventLog::WriteEvent(const xcb_generic_event_t *pevent){
+	Write(RECORD_EVENT,pevent,sizeof(xcb_generic_event_t));
+	++eventCount;
+}
+
+void EventLog::WriteReply(const void *preply){
+	//size 0 for the failed requests
+	uint size = preply?32+4*((const xcb_generic_reply_t *)preply)->length:0;
+	Write(RECORD_REPLY,preply,size);
+}
+
+void EventLog::WriteBatchEnd(sint result){
+	if(eventCount == 0)
+		return;
+	eventCount = 0;
+	Write(RECORD_BATCH_END,&result,sizeof(result));
+	fflush(pf); //complete batches can be replayed even if the recording is interrupted
+}
+
+xcb_generic_event_t * EventLog::ReadEvent(){
+	for(const Record *precord = Peek(); precord; precord = Peek()){
+		Skip(precord);
+		if(precord->type == RECORD_BATCH_END){
+			if(precord->size >= sizeof(batchResult))
+				memcpy(&batchResult,precord+1,sizeof(batchResult));
+			return 0;
+		}
+		if(precord->type != RECORD_EVENT){
+			if(!desync){
+				DebugPrintf(stderr,"Event log replay out of sync, unexpected reply.\n");
+				desync = true;
+			}
+			continue;
+		}
+		xcb_generic_event_t *pevent = (xcb_generic_event_t*)calloc(1,sizeof(xcb_generic_event_t));
+		memcpy(pevent,precord+1,std::min((size_t)precord->size,sizeof(xcb_generic_event_t)));
+		return pevent;
+	}
+	return 0;
+}
+
+void * EventLog::ReadReply(){
+	const Record *precord = Peek();
+	if(!precord || precord->type != RECORD_REPLY){
+		if(!desync){
+			DebugPrintf(stderr,"Event log replay out of sync, missing reply.\n");
+			desync = true;
+		}
+		return 0;
+	}
+	Skip(precord);
+	if(precord->size == 0)
+		return 0;
+	void *preply = malloc(precord->size);
+	memcpy(preply,precord+1,precord->size);
+	return preply;
+}
+
+bool EventLog::IsFinished() const{
+	return mode == MODE_REPLAY && !Peek();
+}
+
+void EventLog::Write(RECORD type, const void *pdata1, uint size){
+	static const unsigned char padding[8] = {};
+	Record record;
+	record.time = Profiler::GetTime()-beginTime;
+	record.type = type;
+	record.size = size;
+	fwrite(&record,sizeof(record),1,pf);
+	if(size > 0)
+		fwrite(pdata1,1,size,pf);
+	if(size%8 != 0)
+		fwrite(padding,1,8-size%8,pf);
+}
+
+const EventLog::Record * EventLog::Peek() const{
+	if(offset+sizeof(Record) > dataSize)
+		return 0;
+	const Record *precord = (const Record *)(pdata+offset);
+	if(offset+sizeof(Record)+precord->size > dataSize)
+		return 0; //truncated at the end of an interrupted recording
+	return precord;
+}
+
+void EventLog::Skip(const Record *precord){
+	offset += sizeof(Record)+(precord->size+7)/8*8;
+}
+
+Default::Default() : X11Backend(), netClientListPending(false), pdragClient(0){
 	//
 	clock_gettime(CLOCK_MONOTONIC,&eventTimer);
 	pollTimer.tv_sec = 0;
@@ -427,6 +646,8 @@ Default::Default() : X11Backend(), pdragClient(0){
 
 Default::~Default(){
 	//sigprocmask(SIG_UNBLOCK,&signals,0);
+	if(peventLog)
+		delete peventLog;
 
 	//cleanup
 	xcb_destroy_window(pcon,ewmh_window);
@@ -538,7 +759,7 @@ void Default::Start(){
 	xcb_configure_window(pcon,ewmh_window,XCB_CONFIG_WINDOW_STACK_MODE,values);
 }
 
-sint Default::HandleEvent(){
+sint Default::HandleEvent(bool forcePoll){
 	struct timespec currentTime;
 	clock_gettime(CLOCK_MONOTONIC,&currentTime);
 	
@@ -591,8 +812,16 @@ sint Default::HandleEvent(){
 
 	sint result = 0;
 
+	deferStack = true;
+
+	//window ids as they appear in the events, which during replay are those of the recording
+	bool replay = peventLog && peventLog->mode == EventLog::MODE_REPLAY;
+	xcb_window_t root = replay?peventLog->root:pscr->root;
+	xcb_window_t ewmhWindow = replay?peventLog->ewmhWindow:ewmh_window;
+
 	//for(xcb_generic_event_t *pevent = xcb_poll_for_event(pcon); pevent; pevent = xcb_poll_for_event(pcon)){
-	for(xcb_generic_event_t *pevent = xcb_wait_for_event(pcon); pevent; pevent = xcb_poll_for_event(pcon)){
+	for(xcb_generic_event_t *pevent = NextEvent(true,forcePoll); pevent; pevent = NextEvent(false,forcePoll)){
+		Profiler::Scope profilerScope(Profiler::PHASE_EVENT,GetEventName(pevent->response_type));
 		//Event found, move to polling mode for some time.
 		clock_gettime(CLOCK_MONOTONIC,&pollTimer);
 		//polling = true;
@@ -605,16 +834,9 @@ sint Default::HandleEvent(){
 			xcb_create_notify_event_t *pev = (xcb_create_notify_event_t*)pevent;
 
 			WManager::Rectangle rect = {pev->x,pev->y,pev->width,pev->height};
-			
-			auto m = std::find_if(configCache.begin(),configCache.end(),[&](auto &p)->bool{
-				return pev->window == p.first;
-			});
-			if(m == configCache.end()){
-				configCache.push_back(std::pair<xcb_window_t, WManager::Rectangle>(pev->window,rect));
-				m = configCache.end()-1;
-			}else (*m).second = rect;
+			configCache[pev->window] = rect;
 
-			DebugPrintf(stdout,"create %x | %d,%d %ux%u\n",pev->window,pev->x,pev->y,pev->width,pev->height);
+			DebugLog("create %x | %d,%d %ux%u\n",pev->window,pev->x,pev->y,pev->width,pev->height);
 			}
 			break;
 		case XCB_CONFIGURE_REQUEST:{
@@ -626,10 +848,6 @@ sint Default::HandleEvent(){
 			if(pclient1 && !(pclient1->pcontainer->flags & WManager::Container::FLAG_FLOATING))
 				break;
 
-			auto mrect = std::find_if(configCache.begin(),configCache.end(),[&](auto &p)->bool{
-				return pev->window == p.first;
-			});
-
 			//TODO: allow x,y configuration if dock or desktop feature
 			xcb_get_property_cookie_t propertyCookieNormalHints = xcb_icccm_get_wm_normal_hints(pcon,pev->window);
 			xcb_get_property_cookie_t propertyCookieWindowType
@@ -638,9 +856,9 @@ sint Default::HandleEvent(){
 				= xcb_get_property(pcon,0,pev->window,ewmh._NET_WM_STATE,XCB_ATOM_ATOM,0,std::numeric_limits<uint32_t>::max());
 
 			xcb_get_property_reply_t *propertyReplyWindowType
-				= xcb_get_property_reply(pcon,propertyCookieWindowType,0);
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieWindowType,0));
 			xcb_get_property_reply_t *propertyReplyWindowState
-				= xcb_get_property_reply(pcon,propertyCookieWindowState,0);
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieWindowState,0));
 
 			WManager::Rectangle rect = {
 				pev->x,pev->y,pev->width,pev->height
@@ -672,10 +890,7 @@ sint Default::HandleEvent(){
 				pev->value_mask |= XCB_CONFIG_WINDOW_X|XCB_CONFIG_WINDOW_Y;
 			}
 			
-			if(mrect == configCache.end()){
-				configCache.push_back(std::pair<xcb_window_t, WManager::Rectangle>(pev->window,rect));
-				mrect = configCache.end()-1;
-			}else (*mrect).second = rect;
+			configCache[pev->window] = rect;
 
 			struct{
 				uint16_t m;
@@ -702,13 +917,13 @@ sint Default::HandleEvent(){
 			if(pclient1)
 				pclient1->UpdateTranslation(&rect);
 
-			DebugPrintf(stdout,"configure request: %x | %d, %d, %u, %u\n",pev->window,pev->x,pev->y,pev->width,pev->height);
+			DebugLog("configure request: %x | %d, %d, %u, %u\n",pev->window,pev->x,pev->y,pev->width,pev->height);
 			}
 			break;
 		case XCB_MAP_REQUEST:{
 			//TODO: use xprop to identify windows that don't behave as expected.
 			xcb_map_request_event_t *pev = (xcb_map_request_event_t*)pevent;
-			if(pev->window == ewmh_window){
+			if(pev->window == ewmhWindow){
 				xcb_map_window(pcon,pev->window);
 				break;
 			}
@@ -738,18 +953,24 @@ sint Default::HandleEvent(){
 				= xcb_get_property(pcon,0,pev->window,XA_WM_TRANSIENT_FOR,XCB_ATOM_WINDOW,0,std::numeric_limits<uint32_t>::max());
 
 			xcb_icccm_wm_hints_t hints;
-			bool boolHints = xcb_icccm_get_wm_hints_reply(pcon,propertyCookieHints,&hints,0);
+			xcb_get_property_reply_t *propertyReplyHints
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieHints,0));
+			bool boolHints = propertyReplyHints && xcb_icccm_get_wm_hints_from_reply(&hints,propertyReplyHints);
+			free(propertyReplyHints);
 
 			xcb_size_hints_t sizeHints;
-			bool boolSizeHints = xcb_icccm_get_wm_size_hints_reply(pcon,propertyCookieNormalHints,&sizeHints,0);
+			xcb_get_property_reply_t *propertyReplyNormalHints
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieNormalHints,0));
+			bool boolSizeHints = propertyReplyNormalHints && xcb_icccm_get_wm_size_hints_from_reply(&sizeHints,propertyReplyNormalHints);
+			free(propertyReplyNormalHints);
 			xcb_get_property_reply_t *propertyReplyWindowType
-				= xcb_get_property_reply(pcon,propertyCookieWindowType,0);
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieWindowType,0));
 			xcb_get_property_reply_t *propertyReplyWindowState
-				= xcb_get_property_reply(pcon,propertyCookieWindowState,0);
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieWindowState,0));
 			//xcb_get_property_reply_t *propertyReplyStrut
 				//= xcb_get_property_reply(pcon,propertyCookieStrut,0);
 			xcb_get_property_reply_t *propertyReplyTransientFor
-				= xcb_get_property_reply(pcon,propertyCookieTransientFor,0);
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieTransientFor,0));
 
 			bool allowPositionConfig = false;
 			if(propertyReplyWindowType){
@@ -768,15 +989,8 @@ sint Default::HandleEvent(){
 				}
 			}
 
-			auto mrect = std::find_if(configCache.begin(),configCache.end(),[&](auto &p)->bool{
-				return pev->window == p.first;
-			});
-			if(mrect == configCache.end()){
-				//an entry should always be present, since CREATE_NOTIFY creates one
-				WManager::Rectangle rect;
-				configCache.push_back(std::pair<xcb_window_t, WManager::Rectangle>(pev->window,rect));
-				mrect = configCache.end()-1;
-			}
+			//an entry should always be present, since CREATE_NOTIFY creates one
+			auto mrect = configCache.emplace(pev->window,WManager::Rectangle()).first;
 
 			if(boolHints){
 				if(hints.flags & XCB_ICCCM_WM_HINT_INPUT && !hints.input)
@@ -862,7 +1076,7 @@ sint Default::HandleEvent(){
 			propertyCookie1[0] = xcb_get_property(pcon,0,pev->window,ewmh._NET_WM_NAME,XCB_GET_PROPERTY_TYPE_ANY,0,128);
 			propertyCookie1[1] = xcb_get_property(pcon,0,pev->window,XCB_ATOM_WM_CLASS,XCB_GET_PROPERTY_TYPE_ANY,0,128);
 			for(uint i = 0; i < 2; ++i)
-				propertyReply1[i] = xcb_get_property_reply(pcon,propertyCookie1[i],0);
+				propertyReply1[i] = LogReply(xcb_get_property_reply(pcon,propertyCookie1[i],0));
 			BackendStringProperty wmName((const char *)xcb_get_property_value(propertyReply1[0]));
 			BackendStringProperty wmClass((const char *)xcb_get_property_value(propertyReply1[1]));
 
@@ -885,7 +1099,8 @@ sint Default::HandleEvent(){
 			X11Client *pclient = SetupClient(&createInfo);
 			if(!pclient)
 				break;
-			clients.push_back(std::pair<X11Client *, MODE>(pclient,MODE_MANUAL));
+			if(clients.insert_or_assign(pev->window,std::pair<X11Client *, MODE>(pclient,MODE_MANUAL)).second)
+				netClientList.push_back(pev->window);
 
 			StackClients();
 
@@ -895,31 +1110,21 @@ sint Default::HandleEvent(){
 			for(uint i = 0; i < 2; ++i)
 				free(propertyReply1[i]);
 
-			netClientList.clear();
-			for(auto &p : clients)
-				netClientList.push_back(p.first->window);
-			xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,pscr->root,ewmh._NET_CLIENT_LIST,XCB_ATOM_WINDOW,32,netClientList.size(),netClientList.data());
+			netClientListPending = true;
 
 			xcb_grab_button(pcon,0,pev->window,XCB_EVENT_MASK_BUTTON_PRESS,//|XCB_EVENT_MASK_BUTTON_RELEASE,
 				XCB_GRAB_MODE_ASYNC,XCB_GRAB_MODE_ASYNC,pscr->root,XCB_NONE,1,XCB_MOD_MASK_1);
 	
 			//check fullscreen
 		
-			DebugPrintf(stdout,"map request, %x\n",pev->window);
+			DebugLog("map request, %x\n",pev->window);
 			}
 			break;
 		case XCB_CONFIGURE_NOTIFY:{
 			xcb_configure_notify_event_t *pev = (xcb_configure_notify_event_t*)pevent;
 
 			WManager::Rectangle rect = {pev->x,pev->y,pev->width,pev->height};
-			
-			auto m = std::find_if(configCache.begin(),configCache.end(),[&](auto &p)->bool{
-				return pev->window == p.first;
-			});
-			if(m == configCache.end()){
-				configCache.push_back(std::pair<xcb_window_t, WManager::Rectangle>(pev->window,rect));
-				m = configCache.end()-1;
-			}else (*m).second = rect;
+			configCache[pev->window] = rect;
 
 			X11Client *pclient1 = FindClient(pev->window,MODE_AUTOMATIC);
 			if(!pclient1)
@@ -927,12 +1132,12 @@ sint Default::HandleEvent(){
 
 			pclient1->UpdateTranslation(&rect);
 
-			DebugPrintf(stdout,"configure to %d,%d %ux%u, %x\n",pev->x,pev->y,pev->width,pev->height,pev->window);
+			DebugLog("configure to %d,%d %ux%u, %x\n",pev->x,pev->y,pev->width,pev->height,pev->window);
 			}
 			break;
 		case XCB_MAP_NOTIFY:{
 			xcb_map_notify_event_t *pev = (xcb_map_notify_event_t*)pevent;
-			if(pev->window == ewmh_window)
+			if(pev->window == ewmhWindow)
 				break;
 
 			result = 1;
@@ -948,7 +1153,7 @@ sint Default::HandleEvent(){
 				= xcb_get_property(pcon,0,pev->window,XA_WM_TRANSIENT_FOR,XCB_ATOM_WINDOW,0,std::numeric_limits<uint32_t>::max());
 
 			xcb_get_property_reply_t *propertyReplyTransientFor
-				= xcb_get_property_reply(pcon,propertyCookieTransientFor,0);
+				= LogReply(xcb_get_property_reply(pcon,propertyCookieTransientFor,0));
 
 			if(propertyReplyTransientFor){
 				xcb_window_t *pbaseWindow = (xcb_window_t*)xcb_get_property_value(propertyReplyTransientFor);
@@ -956,21 +1161,17 @@ sint Default::HandleEvent(){
 				free(propertyReplyTransientFor);
 			}
 
-			auto m = std::find_if(configCache.begin(),configCache.end(),[&](auto &p)->bool{
-				return pev->window == p.first;
-			});
+			auto m = configCache.find(pev->window);
 			if(m == configCache.end()){
 				//it might be the case that no configure notification was received
 				xcb_get_geometry_cookie_t geometryCookie = xcb_get_geometry(pcon,pev->window);
-				xcb_get_geometry_reply_t *pgeometryReply = xcb_get_geometry_reply(pcon,geometryCookie,0);
+				xcb_get_geometry_reply_t *pgeometryReply = LogReply(xcb_get_geometry_reply(pcon,geometryCookie,0));
 				if(!pgeometryReply)
 					break; //happens sometimes on high rate of events
 				WManager::Rectangle rect = {pgeometryReply->x,pgeometryReply->y,pgeometryReply->width,pgeometryReply->height};
 				free(pgeometryReply);
 
-				configCache.push_back(std::pair<xcb_window_t, WManager::Rectangle>(pev->window,rect));
-				m = configCache.end()-1;
-
+				m = configCache.emplace(pev->window,rect).first;
 			}
 			WManager::Rectangle *prect = &(*m).second;
 			if(prect->x+prect->w <= 1 || prect->y+prect->h <= 1)
@@ -990,42 +1191,35 @@ sint Default::HandleEvent(){
 			X11Client *pclient = SetupClient(&createInfo);
 			if(!pclient)
 				break;
-			clients.push_back(std::pair<X11Client *, MODE>(pclient,MODE_AUTOMATIC));
+			if(clients.insert_or_assign(pev->window,std::pair<X11Client *, MODE>(pclient,MODE_AUTOMATIC)).second)
+				netClientList.push_back(pev->window);
 
 			StackClients();
 
-			netClientList.clear();
-			for(auto &p : clients)
-				netClientList.push_back(p.first->window);
-			xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,pscr->root,ewmh._NET_CLIENT_LIST,XCB_ATOM_WINDOW,32,netClientList.size(),netClientList.data());
+			netClientListPending = true;
 
-			DebugPrintf(stdout,"map notify, %x\n",pev->window);
+			DebugLog("map notify, %x\n",pev->window);
 			}
 			break;
 		case XCB_UNMAP_NOTIFY:{
 			//
 			xcb_unmap_notify_event_t *pev = (xcb_unmap_notify_event_t*)pevent;
 
-			auto m = std::find_if(clients.begin(),clients.end(),[&](auto &p)->bool{
-				return p.first->window == pev->window;
-			});
+			auto m = clients.find(pev->window);
 			if(m == clients.end())
 				break;
 
 			result = 1;
 
-			(*m).first->flags |= X11Client::FLAG_UNMAPPING;
-			unmappingQueue.push_back((*m).first);
+			(*m).second.first->flags |= X11Client::FLAG_UNMAPPING;
+			unmappingQueue.push_back((*m).second.first);
 
-			std::iter_swap(m,clients.end()-1);
-			clients.pop_back();
+			clients.erase(m);
+			netClientList.erase(std::find(netClientList.begin(),netClientList.end(),pev->window));
 
-			netClientList.clear();
-			for(auto &p : clients)
-				netClientList.push_back(p.first->window);
-			xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,pscr->root,ewmh._NET_CLIENT_LIST,XCB_ATOM_WINDOW,32,netClientList.size(),netClientList.data());
+			netClientListPending = true;
 
-			DebugPrintf(stdout,"unmap notify %x\n",pev->window);
+			DebugLog("unmap notify %x\n",pev->window);
 			}
 			break;
 		case XCB_PROPERTY_NOTIFY:{
@@ -1036,15 +1230,16 @@ sint Default::HandleEvent(){
 
 			result = 1;
 
-			if(pev->window == pscr->root){
+			if(pev->window == root){
 				if(pev->atom == atoms[ATOM_ESETROOT_PMAP_ID]){
 					xcb_get_property_cookie_t propertyCookie = xcb_get_property(pcon,0,pev->window,atoms[ATOM_ESETROOT_PMAP_ID],XCB_GET_PROPERTY_TYPE_ANY,0,128);
-					xcb_get_property_reply_t *propertyReply = xcb_get_property_reply(pcon,propertyCookie,0);
+					xcb_get_property_reply_t *propertyReply = LogReply(xcb_get_property_reply(pcon,propertyCookie,0));
 					if(!propertyReply)
 						break;
 
 					BackendPixmapProperty prop(*(xcb_pixmap_t*)xcb_get_property_value(propertyReply));
-					PropertyChange(0,PROPERTY_ID_PIXMAP,&prop);
+					if(!replay) //the pixmap of the recording doesn't exist
+						PropertyChange(0,PROPERTY_ID_PIXMAP,&prop);
 
 					free(propertyReply);
 				}
@@ -1057,7 +1252,7 @@ sint Default::HandleEvent(){
 
 			if(pev->atom == XCB_ATOM_WM_NAME){
 				xcb_get_property_cookie_t propertyCookie = xcb_get_property(pcon,0,pev->window,ewmh._NET_WM_NAME,XCB_GET_PROPERTY_TYPE_ANY,0,128);
-				xcb_get_property_reply_t *propertyReply = xcb_get_property_reply(pcon,propertyCookie,0);
+				xcb_get_property_reply_t *propertyReply = LogReply(xcb_get_property_reply(pcon,propertyCookie,0));
 				if(!propertyReply)
 					break; //TODO: get legacy XCB_ATOM_WM_NAME
 				BackendStringProperty prop((const char *)xcb_get_property_value(propertyReply));
@@ -1068,7 +1263,7 @@ sint Default::HandleEvent(){
 			}else
 			if(pev->atom == XCB_ATOM_WM_CLASS){
 				xcb_get_property_cookie_t propertyCookie = xcb_get_property(pcon,0,pev->window,XCB_ATOM_WM_CLASS,XCB_GET_PROPERTY_TYPE_ANY,0,128);
-				xcb_get_property_reply_t *propertyReply = xcb_get_property_reply(pcon,propertyCookie,0);
+				xcb_get_property_reply_t *propertyReply = LogReply(xcb_get_property_reply(pcon,propertyCookie,0));
 				if(!propertyReply)
 					break;
 				BackendStringProperty prop((const char *)xcb_get_property_value(propertyReply));
@@ -1079,7 +1274,7 @@ sint Default::HandleEvent(){
 			if(pev->atom == XA_WM_TRANSIENT_FOR){
 				xcb_get_property_cookie_t propertyCookie = xcb_get_property(pcon,0,pev->window,XA_WM_TRANSIENT_FOR,XCB_ATOM_WINDOW,0,std::numeric_limits<uint32_t>::max());
 
-				xcb_get_property_reply_t *propertyReply = xcb_get_property_reply(pcon,propertyCookie,0);
+				xcb_get_property_reply_t *propertyReply = LogReply(xcb_get_property_reply(pcon,propertyCookie,0));
 				if(!propertyReply)
 					break;
 				//
@@ -1122,7 +1317,7 @@ sint Default::HandleEvent(){
 
 				}else
 				if(pev->data.data32[1] == ewmh._NET_WM_STATE_DEMANDS_ATTENTION){
-					printf("urgency!\n");
+					DebugLog("urgency!\n");
 				}
 			}
 			//_NET_WM_STATE
@@ -1135,11 +1330,13 @@ sint Default::HandleEvent(){
 			lastTime = pev->time;
 			if(pev->state == (XCB_MOD_MASK_1|XCB_MOD_MASK_SHIFT) && pev->detail == exitKeycode){
 				free(pevent);
+				deferStack = false;
 				return -1;
 			//
 			}else
 			for(KeyBinding &binding : keycodes){
 				if(pev->state == binding.mask && pev->detail == binding.keycode){
+					KeyLatency::Begin();
 					KeyPress(binding.keyId,true);
 					result = 1;
 					break;
@@ -1195,7 +1392,7 @@ sint Default::HandleEvent(){
 			break;
 		case XCB_FOCUS_IN:{
 			xcb_focus_in_event_t *pev = (xcb_focus_in_event_t*)pevent;
-			printf("*** focus %x\n",pev->event);
+			DebugLog("*** focus %x\n",pev->event);
 			}
 			break;
 		case XCB_ENTER_NOTIFY:{
@@ -1206,28 +1403,25 @@ sint Default::HandleEvent(){
 			if(!pclient1)
 				break;*/
 
-			DebugPrintf(stdout,"enter %x\n",pev->event);
+			DebugLog("enter %x\n",pev->event);
 			}
 			break;
 		case XCB_MAPPING_NOTIFY:
 			//keyboard related stuff
-			DebugPrintf(stdout,"mapping\n");
+			DebugLog("mapping\n");
 			break;
 		case XCB_DESTROY_NOTIFY:{
 			xcb_destroy_notify_event_t *pev = (xcb_destroy_notify_event_t*)pevent;
-			DebugPrintf(stdout,"destroy notify, %x\n",pev->window);
+			DebugLog("destroy notify, %x\n",pev->window);
 
-			/*configCache.erase(std::remove_if(configCache.begin(),configCache.end(),[&](auto &p)->bool{
-				return p.first == pev->window;
-			}));*/
-			//
+			configCache.erase(pev->window);
 			}
 			break;
 		case 0:
 			DebugPrintf(stdout,"Invalid event\n");
 			break;
 		default:
-			DebugPrintf(stdout,"default event: %u\n",pevent->response_type & 0x7f);
+			DebugLog("default event: %u\n",pevent->response_type & 0x7f);
 
 			X11Event event11(pevent,this);
 			EventNotify(&event11);
@@ -1246,6 +1440,26 @@ sint Default::HandleEvent(){
 		DestroyClient(pclient);
 	unmappingQueue.clear();
 
+	//Restack and publish the client list once for the whole batch. A session restore maps tens of
+	//windows at once, and doing this per window grows quadratically with the number of windows.
+	FlushStack();
+	if(netClientListPending){
+		xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,pscr->root,ewmh._NET_CLIENT_LIST,XCB_ATOM_WINDOW,32,netClientList.size(),netClientList.data());
+		netClientListPending = false;
+	}
+	xcb_flush(pcon);
+	KeyLatency::Mark(KeyLatency::STAGE_REQUESTS);
+
+	if(peventLog){
+		if(replay){
+			if(peventLog->IsFinished()){
+				DebugPrintf(stdout,"Replay finished\n");
+				return -1;
+			}
+			result = peventLog->batchResult; //present the frames where the recording did
+		}else peventLog->WriteBatchEnd(result);
+	}
+
 	if(xcb_connection_has_error(pcon)){
 		DebugPrintf(stderr,"X server connection lost\n");
 		return -1;
@@ -1255,12 +1469,43 @@ sint Default::HandleEvent(){
 }
 
 X11Client * Default::FindClient(xcb_window_t window, MODE mode) const{
-	auto m = std::find_if(clients.begin(),clients.end(),[&](auto &p)->bool{
-		return p.first->window == window && (mode == MODE_UNDEFINED || p.second == mode);
-	});
-	if(m == clients.end())
+	auto m = clients.find(window);
+	if(m == clients.end() || (mode != MODE_UNDEFINED && (*m).second.second != mode))
 		return 0;
-	return (*m).first;
+	return (*m).second.first;
+}
+
+void Default::Record(const char *pfileName){
+	peventLog = new EventLog(pfileName,EventLog::MODE_RECORD,pscr->root,ewmh_window);
+}
+
+void Default::Replay(const char *pfileName){
+	peventLog = new EventLog(pfileName,EventLog::MODE_REPLAY,pscr->root,ewmh_window);
+}
+
+xcb_generic_event_t * Default::NextEvent(bool first, bool forcePoll){
+	if(peventLog && peventLog->mode == EventLog::MODE_REPLAY){
+		//Live events are dropped during replay. These are mostly errors for the requests on the
+		//windows of the recording, which don't exist.
+		for(xcb_generic_event_t *pevent = xcb_poll_for_event(pcon); pevent; pevent = xcb_poll_for_event(pcon))
+			free(pevent);
+		return peventLog->ReadEvent();
+	}
+	xcb_generic_event_t *pevent = first?WaitForEvent(forcePoll):xcb_poll_for_event(pcon);
+	if(pevent && peventLog)
+		peventLog->WriteEvent(pevent);
+	return pevent;
+}
+
+void * X11Backend::LogReply1(void *preply) const{
+	if(!peventLog)
+		return preply;
+	if(peventLog->mode == EventLog::MODE_RECORD){
+		peventLog->WriteReply(preply);
+		return preply;
+	}
+	free(preply);
+	return peventLog->ReadReply();
 }
 
 DebugClient::DebugClient(WManager::Container *pcontainer, const DebugClient::CreateInfo *pcreateInfo) : Client(pcontainer), pbackend(pcreateInfo->pbackend){
@@ -1305,12 +1550,12 @@ DebugContainer::~DebugContainer(){
 
 void DebugContainer::Focus1(){
 	//
-	printf("focusing ...\n");
+	DebugLog("focusing ...\n");
 }
 
 void DebugContainer::Stack1(){
 	//
-	printf("stacking ...\n");
+	DebugLog("stacking ...\n");
 }
 
 Debug::Debug() : X11Backend(){
@@ -1372,18 +1617,19 @@ void Debug::Start(){
 	xcb_key_symbols_free(psymbols);
 }
 
-sint Debug::HandleEvent(){
+sint Debug::HandleEvent(bool forcePoll){
 	//xcb_generic_event_t *pevent = xcb_poll_for_event(pcon);
 	//for(xcb_generic_event_t *pevent = xcb_poll_for_event(pcon); pevent; pevent = xcb_poll_for_event(pcon)){
-	for(xcb_generic_event_t *pevent = xcb_wait_for_event(pcon); pevent; pevent = xcb_poll_for_event(pcon)){
+	for(xcb_generic_event_t *pevent = WaitForEvent(forcePoll); pevent; pevent = xcb_poll_for_event(pcon)){
+		Profiler::Scope profilerScope(Profiler::PHASE_EVENT,GetEventName(pevent->response_type));
 		//switch(pevent->response_type & ~0x80){
 		switch(pevent->response_type & 0x7f){
 		/*case XCB_EXPOSE:{
-			printf("expose\n");
+			DebugLog("expose\n");
 			}
 			break;*/
 		case XCB_CLIENT_MESSAGE:{
-			DebugPrintf(stdout,"message\n");
+			DebugLog("message\n");
 			//xcb_client_message_event_t *pev = (xcb_client_message_event_t*)pevent;
 			//if(pev->data.data32[0] == wmD
 			}
@@ -1413,6 +1659,7 @@ sint Debug::HandleEvent(){
 			}else
 			for(KeyBinding &binding : keycodes){
 				if(pev->state == binding.mask && pev->detail == binding.keycode){
+					KeyLatency::Begin();
 					KeyPress(binding.keyId,true);
 					break;
 				}
@@ -1430,7 +1677,7 @@ sint Debug::HandleEvent(){
 			}
 			break;
 		default:{
-			DebugPrintf(stdout,"default event: %u\n",pevent->response_type & 0x7f);
+			DebugLog("default event: %u\n",pevent->response_type & 0x7f);
 			//TODO: find client here
 			//X11Event event11(pevent); //DebugEvent
 			//EventNotify(&event11);
@@ -1441,6 +1688,7 @@ sint Debug::HandleEvent(){
 		free(pevent);
 		xcb_flush(pcon);
 	}
+	KeyLatency::Mark(KeyLatency::STAGE_REQUESTS);
 
 	if(xcb_connection_has_error(pcon)){
 		DebugPrintf(stderr,"X server connection lost\n");
@@ -4,6 +4,7 @@
 #include <xcb/xproto.h>
 #include <xcb/xcb_keysyms.h>
 #include <xcb/xcb_ewmh.h>
+#include <unordered_map>
 
 namespace Compositor{
 //declarations for friend classes
@@ -73,7 +74,7 @@ public:
 	virtual void Start() = 0;
 	//virtual sint GetEventFileDescriptor() = 0;
 	//virtual void SetupEnvironment() = 0;
-	virtual sint HandleEvent() = 0;
+	virtual sint HandleEvent(bool) = 0;
 	virtual void MoveContainer(WManager::Container *, WManager::Container *) = 0;
 	virtual const WManager::Container * GetRoot() const = 0;
 	virtual const std::vector<std::pair<const WManager::Client *, WManager::Client *>> * GetStackAppendix() const = 0;
@@ -166,9 +167,13 @@ public:
 	virtual ~X11Backend();
 	bool QueryExtension(const char *, sint *, sint *) const;
 	xcb_atom_t GetAtom(const char *) const;
+	bool FindKeyBinding(uint, xcb_keycode_t *, uint *) const;
 	void StackRecursiveAppendix(const WManager::Client *);
 	void StackRecursive(const WManager::Container *);
 	void StackClients();
+	void FlushStack();
+	xcb_generic_event_t * WaitForEvent(bool) const;
+	void SetWakeDescriptor(sint); //a readable descriptor, such as a self-pipe, interrupts WaitForEvent()
 	//void HandleTimer() const;
 	enum MODE{
 		MODE_UNDEFINED,
@@ -186,6 +191,7 @@ protected:
 	xcb_timestamp_t lastTime;
 	struct timespec eventTimer;
 	struct timespec pollTimer;
+	sint wakeFd; //-1 if none
 	//bool polling;
 	struct KeyBinding{
 		xcb_keycode_t keycode;
@@ -197,6 +203,10 @@ protected:
 	xcb_window_t ewmh_window;
 	
 	std::deque<std::pair<const WManager::Client *, WManager::Client *>> appendixQueue;
+	//While an event batch is handled, restacking requests are merged and the windows restacked once
+	//at the end of the batch.
+	bool deferStack;
+	bool stackPending;
 
 	enum ATOM{
 		//ATOM_CHAMFER_ALARM,
@@ -209,6 +219,68 @@ protected:
 	xcb_atom_t atoms[ATOM_COUNT];
 	static const char *patomStrs[ATOM_COUNT];
 
+	//Recording or replay of the event handling, set up by Default. The clients and containers log
+	//the replies they depend on here as well.
+	class EventLog *peventLog;
+	void * LogReply1(void *) const;
+	//During recording the reply is logged, during replay it's replaced by the logged one.
+	template<class T>
+	T * LogReply(T *preply) const{
+		return (T*)LogReply1(preply);
+	}
+};
+
+//Binary log of the X events handled by the window manager, along with the replies the handling
+//depends on, to replay a session deterministically without its clients. The file is a header
+//followed by records aligned to 8 bytes: it is only appended to while recording, and mapped to
+//memory for replay. The event batches are kept, so that the same frames are presented on replay.
+class EventLog{
+public:
+	enum MODE{
+		MODE_RECORD,
+		MODE_REPLAY
+	};
+	EventLog(const char *, MODE, xcb_window_t, xcb_window_t);
+	~EventLog();
+	void WriteEvent(const xcb_generic_event_t *);
+	void WriteReply(const void *);
+	void WriteBatchEnd(sint);
+	xcb_generic_event_t * ReadEvent();
+	void * ReadReply();
+	bool IsFinished() const;
+	MODE mode;
+	sint batchResult; //HandleEvent() result of the last replayed batch
+	//Windows of the recording that the event handling treats specially
+	xcb_window_t root;
+	xcb_window_t ewmhWindow;
+private:
+	enum RECORD{
+		RECORD_EVENT,
+		RECORD_REPLY,
+		RECORD_BATCH_END
+	};
+	struct Header{
+		char magic[8];
+		uint version;
+		uint root;
+		uint ewmhWindow;
+		uint reserved;
+	};
+	struct Record{
+		uint64 time; //ns since the beginning of the recording
+		uint type;
+		uint size; //of the data following the record, without padding
+	};
+	void Write(RECORD, const void *, uint);
+	const Record * Peek() const;
+	void Skip(const Record *);
+	FILE *pf;
+	uint64 beginTime;
+	uint eventCount; //since the last batch end
+	const unsigned char *pdata;
+	size_t dataSize;
+	size_t offset;
+	bool desync; //reported once
 };
 
 class Default : public X11Backend{
@@ -217,8 +289,10 @@ public:
 	virtual ~Default();
 	void Start();
 	//void SetupEnvironment();
-	sint HandleEvent();
+	sint HandleEvent(bool);
 	X11Client * FindClient(xcb_window_t, MODE) const;
+	void Record(const char *);
+	void Replay(const char *);
 protected:
 	enum PROPERTY_ID{
 		PROPERTY_ID_PIXMAP,
@@ -231,11 +305,13 @@ protected:
 	virtual void PropertyChange(X11Client *, PROPERTY_ID, const BackendProperty *) = 0;
 	virtual void DestroyClient(X11Client *) = 0;
 private:
+	xcb_generic_event_t * NextEvent(bool, bool);
 	xcb_keycode_t exitKeycode;
-	std::vector<std::pair<X11Client *, MODE>> clients;
-	std::vector<std::pair<xcb_window_t, WManager::Rectangle>> configCache;
+	std::unordered_map<xcb_window_t, std::pair<X11Client *, MODE>> clients;
+	std::unordered_map<xcb_window_t, WManager::Rectangle> configCache;
 	std::vector<X11Client *> unmappingQueue;
-	std::vector<xcb_window_t> netClientList; //used only to update the property - not maintained
+	std::vector<xcb_window_t> netClientList; //the clients in mapping order, as _NET_CLIENT_LIST requires
+	bool netClientListPending; //_NET_CLIENT_LIST is updated once at the end of the event batch
 	X11Client *pdragClient;
 	sint dragClientX, dragClientY;
 };
@@ -270,16 +346,16 @@ public:
 	virtual ~Debug();
 	void Start();
 	//void SetupEnvironment();
-	sint HandleEvent();
+	sint HandleEvent(bool);
 	X11Client * FindClient(xcb_window_t, MODE) const;
 protected:
 	virtual DebugClient * SetupClient(const DebugClient::CreateInfo *) = 0;
 	virtual void DestroyClient(DebugClient *) = 0;
+	std::vector<DebugClient *> clients;
 private:
 	xcb_keycode_t exitKeycode;
 	xcb_keycode_t launchKeycode;
 	xcb_keycode_t closeKeycode;
-	std::vector<DebugClient *> clients;
 };
 
 }
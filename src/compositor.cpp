@@ -8,27 +8,66 @@
 #include <algorithm>
 #include <cstdlib>
 #include <limits>
+#include <atomic>
+#include <sys/stat.h>
 
 namespace Compositor{
 
-ClientFrame::ClientFrame(uint w, uint h, const char *pshaderName[Pipeline::SHADER_MODULE_COUNT], CompositorInterface *_pcomp) : pcomp(_pcomp), passignedSet(0), time(0.0f), shaderUserFlags(0), fullRegionUpdate(true){
+//default frame pipeline, also used while the requested pipelines are being compiled
+static const char *pframeShaderName[Pipeline::SHADER_MODULE_COUNT] = {
+	"frame_vertex.spv","frame_geometry.spv","frame_fragment.spv"
+};
+
+ClientFrame::ClientFrame(uint w, uint h, const char *pshaderName[Pipeline::SHADER_MODULE_COUNT], CompositorInterface *_pcomp) : pcomp(_pcomp), passignedSet(0), descSetsDirty(true), prequestedPipeline(0), maskOrigin(CompositorInterface::FRAME_MASK_NONE), time(0.0f), shaderUserFlags(0), shaderUserVariant(0), damageTime(0), fullRegionUpdate(true), surfaceAdjustPending(false){
 	pcomp->updateQueue.push_back(this);
 
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.queueFamilyIndex = pcomp->queueFamilyIndex[CompositorInterface::QUEUE_INDEX_GRAPHICS];
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	if(vkCreateCommandPool(pcomp->logicalDev,&commandPoolCreateInfo,0,&commandPool) != VK_SUCCESS)
+		throw Exception("Failed to create a command pool.");
+
+	psecondaryCommandBuffers = new VkCommandBuffer[pcomp->frameCount];
+
+	VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferAllocateInfo.commandPool = commandPool;
+	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	commandBufferAllocateInfo.commandBufferCount = pcomp->frameCount;
+	if(vkAllocateCommandBuffers(pcomp->logicalDev,&commandBufferAllocateInfo,psecondaryCommandBuffers) != VK_SUCCESS)
+		throw Exception("Failed to allocate secondary command buffers.");
+
+	pcommandBufferStates = new CommandBufferState[pcomp->frameCount];
+	InvalidateCommandBuffers();
+
+	timestampIndex = pcomp->AssignTimestampIndex();
+
 	ptexture = pcomp->CreateTexture(w,h);
-	Pipeline *pPipeline = pcomp->LoadPipeline(pshaderName);
-	if(!AssignPipeline(pPipeline))
+	//the fallback is loaded first, so that it won't have to wait for the requested pipeline to compile
+	if(!AssignPipeline(pcomp->LoadPipeline(pframeShaderName,0)))
 		throw Exception("Failed to assign a pipeline.");
-	DebugPrintf(stdout,"Texture created: %ux%u\n",w,h);
-
-	UpdateDescSets();
+	RequestPipeline(pcomp->LoadPipelineAsync(pshaderName,0));
+	DebugLog("Texture created: %ux%u\n",w,h);
 
 	clock_gettime(CLOCK_MONOTONIC,&creationTime);
+
+	pcomp->clientFrames.push_back(this);
 }
 
 ClientFrame::~ClientFrame(){
+	pcomp->clientFrames.erase(std::remove(pcomp->clientFrames.begin(),pcomp->clientFrames.end(),this),pcomp->clientFrames.end());
 	pcomp->updateQueue.erase(std::remove(pcomp->updateQueue.begin(),pcomp->updateQueue.end(),this),pcomp->updateQueue.end());
+	pcomp->latencyQueue.erase(std::remove(pcomp->latencyQueue.begin(),pcomp->latencyQueue.end(),this),pcomp->latencyQueue.end());
+	pcomp->pipelineWaitQueue.erase(std::remove(pcomp->pipelineWaitQueue.begin(),pcomp->pipelineWaitQueue.end(),this),pcomp->pipelineWaitQueue.end());
 
 	pcomp->ReleaseTexture(ptexture);
+	pcomp->FreeTimestampIndex(timestampIndex);
+
+	//the buffers are freed along with the pool
+	pcomp->ReleaseCommandPool(commandPool);
+	delete []psecondaryCommandBuffers;
+	delete []pcommandBufferStates;
 
 	for(PipelineDescriptorSet &pipelineDescSet : descSets)
 		for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i)
@@ -40,16 +79,77 @@ ClientFrame::~ClientFrame(){
 }
 
 void ClientFrame::SetShaders(const char *pshaderName[Pipeline::SHADER_MODULE_COUNT]){
-	Pipeline *pPipeline = pcomp->LoadPipeline(pshaderName);
-	if(!AssignPipeline(pPipeline))
-		throw Exception("Failed to assign a pipeline.");
+	RequestPipeline(pcomp->LoadPipelineAsync(pshaderName,0));
+}
+
+void ClientFrame::RequestPipeline(Pipeline *pPipeline){
+	if(pPipeline->state == Pipeline::STATE_READY){
+		prequestedPipeline = 0;
+		pcomp->pipelineWaitQueue.erase(std::remove(pcomp->pipelineWaitQueue.begin(),pcomp->pipelineWaitQueue.end(),this),pcomp->pipelineWaitQueue.end());
+		if(!AssignPipeline(pPipeline))
+			throw Exception("Failed to assign a pipeline.");
+		return;
+	}
+
+	//keep drawing with the current pipeline until the requested one is ready
+	if(!prequestedPipeline)
+		pcomp->pipelineWaitQueue.push_back(this);
+	prequestedPipeline = pPipeline;
+}
+
+bool ClientFrame::ValidatePipeline(){
+	//returns true once the frame no longer waits for the requested pipeline
+	switch(prequestedPipeline->state){
+	case Pipeline::STATE_READY:
+		if(!AssignPipeline(prequestedPipeline))
+			throw Exception("Failed to assign a pipeline.");
+		break;
+	case Pipeline::STATE_FAILED:
+		DebugPrintf(stderr,"Requested pipeline unavailable, keeping the current one.\n");
+		break;
+	default:
+		return false;
+	}
+	prequestedPipeline = 0;
+	return true;
+}
+
+void ClientFrame::SelectVariant(uint variant){
+	//variants of the current (or pending) shaders, limited to the features the shaders can turn off
+	const Pipeline *pbase = prequestedPipeline?prequestedPipeline:passignedSet->p;
+	ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT];
+	uint specConstantMask = 0;
+	for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i){
+		pshader[i] = pbase->pshaderModule[i];
+		if(pshader[i])
+			specConstantMask |= pshader[i]->specConstantMask;
+	}
+	variant &= specConstantMask;
+	if(variant == pbase->stateKey)
+		return;
+
+	Pipeline *pPipeline = pcomp->LoadPipelineAsync(pshader,variant);
+	if(pPipeline->state == Pipeline::STATE_FAILED)
+		return; //already reported
+	RequestPipeline(pPipeline);
+}
+
+void ClientFrame::ValidateFrameMask(const VkExtent2D &extent, const glm::vec2 &borderWidth){
+	uint origin = CompositorInterface::FRAME_MASK_NONE;
+	const ShaderModule *pfragmentShader = passignedSet->p->pshaderModule[Pipeline::SHADER_MODULE_FRAGMENT];
+	if(pfragmentShader && pfragmentShader->frameMaskBinding)
+		origin = pcomp->LookupFrameMask(extent,borderWidth);
+	if(origin != maskOrigin){
+		maskOrigin = origin;
+		InvalidateCommandBuffers();
+	}
 }
 
 void ClientFrame::Draw(const VkRect2D &frame, const glm::vec2 &borderWidth, uint flags, const VkCommandBuffer *pcommandBuffer){
 	time = timespec_diff(pcomp->frameTime,creationTime);
 
 	for(uint i = 0, descPointer = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i)
-		if(passignedSet->p->pshaderModule[i]->setCount > 0){
+		if(passignedSet->p->pshaderModule[i] && passignedSet->p->pshaderModule[i]->setCount > 0){
 			vkCmdBindDescriptorSets(*pcommandBuffer,VK_PIPELINE_BIND_POINT_GRAPHICS,passignedSet->p->pipelineLayout,descPointer,passignedSet->p->pshaderModule[i]->setCount,passignedSet->pdescSets[i],0,0);
 			descPointer += passignedSet->p->pshaderModule[i]->setCount;
 		}
@@ -60,80 +160,139 @@ void ClientFrame::Draw(const VkRect2D &frame, const glm::vec2 &borderWidth, uint
 		glm::vec2 borderWidth;
 		uint flags;
 		float time;
+		uint maskOrigin;
 	} pushConstants;
 
-	pushConstants.frameVec = {frame.offset.x,frame.offset.y,frame.offset.x+frame.extent.width,frame.offset.y+frame.extent.height};
-	pushConstants.frameVec += 0.5f;
-	pushConstants.frameVec /= (glm::vec4){pcomp->imageExtent.width,pcomp->imageExtent.height,pcomp->imageExtent.width,pcomp->imageExtent.height};
-	pushConstants.frameVec *= 2.0f;
-	pushConstants.frameVec -= 1.0f;
+	pushConstants.frameVec = pcomp->GetFrameVector(frame);
 
 	pushConstants.imageExtent = glm::vec2(pcomp->imageExtent.width,pcomp->imageExtent.height);
 	pushConstants.borderWidth = borderWidth;
 	pushConstants.flags = flags;
 	pushConstants.time = time;
+	pushConstants.maskOrigin = maskOrigin;
 
-	vkCmdPushConstants(*pcommandBuffer,passignedSet->p->pipelineLayout,VK_SHADER_STAGE_GEOMETRY_BIT|VK_SHADER_STAGE_FRAGMENT_BIT,0,40,&pushConstants); //size fixed also in CompositorResource VkPushConstantRange
+	vkCmdPushConstants(*pcommandBuffer,passignedSet->p->pipelineLayout,passignedSet->p->pushConstantStages,0,44,&pushConstants); //size fixed also in CompositorResource VkPushConstantRange
 
+	if(timestampIndex != ~0u)
+		vkCmdWriteTimestamp(*pcommandBuffer,VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,pcomp->timestampPool,pcomp->GetTimestampQuery(timestampIndex));
 	vkCmdDraw(*pcommandBuffer,1,1,0,0);
+	if(timestampIndex != ~0u)
+		vkCmdWriteTimestamp(*pcommandBuffer,VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,pcomp->timestampPool,pcomp->GetTimestampQuery(timestampIndex)+1);
+}
+
+bool ClientFrame::UpdateCommandBuffer(const VkRect2D &frame, const glm::vec2 &borderWidth, uint flags, VkCommandBuffer *pcommandBuffer){
+	//The time push constant is sampled when the buffer is recorded. Pipelines that read it are recorded
+	//every frame, the others are recorded again only when the frame or the flags change.
+	CommandBufferState &state = pcommandBufferStates[pcomp->currentFrame];
+	VkCommandBuffer commandBuffer = psecondaryCommandBuffers[pcomp->currentFrame];
+	*pcommandBuffer = commandBuffer;
 
 	passignedSet->fenceTag = pcomp->frameTag;
+
+	if(state.valid && !passignedSet->p->readsTime && state.flags == flags && state.borderWidth == borderWidth &&
+		state.frame.offset.x == frame.offset.x && state.frame.offset.y == frame.offset.y &&
+		state.frame.extent.width == frame.extent.width && state.frame.extent.height == frame.extent.height)
+		return false;
+
+	//the framebuffer is left unspecified, since the cached buffer is used with any of the swap chain images
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = pcomp->renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	commandBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+	if(vkBeginCommandBuffer(commandBuffer,&commandBufferBeginInfo) != VK_SUCCESS)
+		throw Exception("Failed to begin secondary command buffer recording.");
+
+	vkCmdBindPipeline(commandBuffer,VK_PIPELINE_BIND_POINT_GRAPHICS,passignedSet->p->pipeline);
+	Draw(frame,borderWidth,flags,&commandBuffer);
+
+	if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw Exception("Failed to end secondary command buffer recording.");
+
+	state.frame = frame;
+	state.borderWidth = borderWidth;
+	state.flags = flags;
+	state.valid = true;
+
+	return true;
+}
+
+void ClientFrame::InvalidateCommandBuffers(){
+	for(uint i = 0; i < pcomp->frameCount; ++i)
+		pcommandBufferStates[i].valid = false;
 }
 
 void ClientFrame::AdjustSurface(uint w, uint h){
-	pcomp->ReleaseTexture(ptexture);
+	//The texture is replaced only when the frame is next updated. A burst of new windows reflows the
+	//layout once per window, and recreating the textures on each of those would be quadratic.
+	surfaceExtent = (VkExtent2D){w,h};
+	surfaceAdjustPending = true;
 
-	pcomp->updateQueue.push_back(this);
+	if(std::find(pcomp->updateQueue.begin(),pcomp->updateQueue.end(),this) == pcomp->updateQueue.end())
+		pcomp->updateQueue.push_back(this);
 	fullRegionUpdate = true;
+}
+
+void ClientFrame::ApplySurfaceAdjustment(){
+	surfaceAdjustPending = false;
+	if(ptexture->w == surfaceExtent.width && ptexture->h == surfaceExtent.height)
+		return;
+
+	pcomp->ReleaseTexture(ptexture);
 
+	uint w = surfaceExtent.width, h = surfaceExtent.height;
 	ptexture = pcomp->CreateTexture(w,h);
 	//In this case updating the descriptor sets would be enough, but we can't do that because of them being used currently by frames in flight.
 	if(!AssignPipeline(passignedSet->p))
 		throw Exception("Failed to assign a pipeline.");
-	DebugPrintf(stdout,"Texture created: %ux%u\n",w,h);
-
-	UpdateDescSets();
+	DebugLog("Texture created: %ux%u\n",w,h);
 }
 
 bool ClientFrame::AssignPipeline(const Pipeline *prenderPipeline){
 	auto m = std::find_if(descSets.begin(),descSets.end(),[&](auto &r)->bool{
-		return r.p == prenderPipeline && pcomp->frameTag > r.fenceTag+pcomp->swapChainImageCount+1;
+		return r.p == prenderPipeline && pcomp->frameCompletionTag > r.fenceTag;
 	});
 	if(m != descSets.end()){
 		passignedSet = &(*m);
+		descSetsDirty = true;
+		InvalidateCommandBuffers();
 		return true;
 	}
 
-	uint totalSetCount = 0;
-
+	//The sets are allocated once the frame gets drawn through the pipeline (ValidateDescSets()).
+	//Frames drawn by the instanced path never need them.
 	PipelineDescriptorSet pipelineDescSet;
 	pipelineDescSet.fenceTag = pcomp->frameTag;
 	pipelineDescSet.p = prenderPipeline;
-	for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i){
-		if(!prenderPipeline->pshaderModule[i] || prenderPipeline->pshaderModule[i]->setCount == 0){
-			pipelineDescSet.pdescSets[i] = 0;
-			continue;
-		}
-		/*pipelineDescSet.pdescSets[i] = new VkDescriptorSet[prenderPipeline->pshaderModule[i]->setCount];
-		VkDescriptorSetAllocateInfo descSetAllocateInfo = {};
-		descSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		descSetAllocateInfo.descriptorPool = pcomp->descPool;
-		descSetAllocateInfo.pSetLayouts = prenderPipeline->pshaderModule[i]->pdescSetLayouts;
-		descSetAllocateInfo.descriptorSetCount = prenderPipeline->pshaderModule[i]->setCount;
-		if(vkAllocateDescriptorSets(pcomp->logicalDev,&descSetAllocateInfo,pipelineDescSet.pdescSets[i]) != VK_SUCCESS)
-			return false;*/
-		pipelineDescSet.pdescSets[i] = pcomp->CreateDescSets(prenderPipeline->pshaderModule[i]);
-		if(!pipelineDescSet.pdescSets[i])
-			return false;
-
-		totalSetCount += prenderPipeline->pshaderModule[i]->setCount;
-	}
+	for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i)
+		pipelineDescSet.pdescSets[i] = 0;
 	descSets.push_back(pipelineDescSet);
 	passignedSet = &descSets.back();
+	descSetsDirty = true;
+	InvalidateCommandBuffers();
 
 	return true;
 }
 
+void ClientFrame::ValidateDescSets(){
+	if(!descSetsDirty)
+		return;
+	for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i){
+		if(passignedSet->pdescSets[i] || !passignedSet->p->pshaderModule[i] || passignedSet->p->pshaderModule[i]->setCount == 0)
+			continue;
+		passignedSet->pdescSets[i] = pcomp->CreateDescSets(passignedSet->p->pshaderModule[i]);
+		if(!passignedSet->pdescSets[i])
+			throw Exception("Failed to allocate descriptor sets.");
+	}
+	UpdateDescSets();
+	descSetsDirty = false;
+}
+
 void ClientFrame::UpdateDescSets(){
 	//
 	VkDescriptorImageInfo descImageInfo = {};
@@ -141,8 +300,15 @@ void ClientFrame::UpdateDescSets(){
 	descImageInfo.imageView = ptexture->imageView;
 	descImageInfo.sampler = pcomp->pointSampler;
 
+	VkDescriptorImageInfo maskImageInfo = {};
+	maskImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	maskImageInfo.imageView = pcomp->pframeMaskAtlas->imageView;
+	maskImageInfo.sampler = pcomp->pointSampler;
+
 	std::vector<VkWriteDescriptorSet> writeDescSets;
 	for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i){
+		if(!passignedSet->p->pshaderModule[i])
+			continue;
 		auto m1 = std::find_if(passignedSet->p->pshaderModule[i]->bindings.begin(),passignedSet->p->pshaderModule[i]->bindings.end(),[&](auto &r)->bool{
 			return r.type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE && strcmp(r.pname,"content") == 0;
 		});
@@ -158,6 +324,21 @@ void ClientFrame::UpdateDescSets(){
 			writeDescSet.pImageInfo = &descImageInfo;
 		}
 
+		auto m3 = std::find_if(passignedSet->p->pshaderModule[i]->bindings.begin(),passignedSet->p->pshaderModule[i]->bindings.end(),[&](auto &r)->bool{
+			return r.type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE && strcmp(r.pname,"frameMask") == 0;
+		});
+		if(m3 != passignedSet->p->pshaderModule[i]->bindings.end()){
+			VkWriteDescriptorSet &writeDescSet = writeDescSets.emplace_back();
+			writeDescSet = (VkWriteDescriptorSet){};
+			writeDescSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescSet.dstSet = passignedSet->pdescSets[i][(*m3).setIndex];
+			writeDescSet.dstBinding = (*m3).binding;
+			writeDescSet.dstArrayElement = 0;
+			writeDescSet.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			writeDescSet.descriptorCount = 1;
+			writeDescSet.pImageInfo = &maskImageInfo;
+		}
+
 		auto m2 = std::find_if(passignedSet->p->pshaderModule[i]->bindings.begin(),passignedSet->p->pshaderModule[i]->bindings.end(),[&](auto &r)->bool{
 			return r.type == VK_DESCRIPTOR_TYPE_SAMPLER;
 		});
@@ -174,10 +355,11 @@ void ClientFrame::UpdateDescSets(){
 		}
 	}
 	vkUpdateDescriptorSets(pcomp->logicalDev,writeDescSets.size(),writeDescSets.data(),0,0);
+	InvalidateCommandBuffers();
 }
 
-CompositorInterface::CompositorInterface(uint _physicalDevIndex) : physicalDevIndex(_physicalDevIndex), currentFrame(0), frameTag(0), pbackground(0){
-	//
+CompositorInterface::CompositorInterface(const Configuration *pconfig) : physicalDevIndex(pconfig->deviceIndex), renderThreadCount(std::max(pconfig->renderThreadCount,1u)), uncachedRecording(pconfig->uncachedRecording), descriptorIndexing(false), instancedRendering(pconfig->instancedRendering), frameCount(2), currentFrame(0), imageAcquired(false), frameTag(0), frameCompletionTag(0), pbackground(0), textureTableLayout(0), textureIndexCount(0), pinstanceBuffers(0), pinstancedPipeline(0), pframePipeline(0), pipelineCache(0), pipelineCacheLoaded(false), pframeMaskAtlas(0), pframeMaskData(0), debugMode(DEBUG_MODE_NONE), debugFlags(0), gpuTiming(pconfig->gpuTiming), timestampPool(0), ptimedDraws(0), ptimestampResults(0), ptimedFrameTags(0), offscreen(false), poffscreenMemory(0), uploadByteCount(0), pipelineWaitCount(0), releaseQueueMaxDepth(0){
+	clock_gettime(CLOCK_MONOTONIC,&initTime);
 }
 
 CompositorInterface::~CompositorInterface(){
@@ -214,15 +396,16 @@ void CompositorInterface::InitializeRenderEngine(){
 		//"VK_KHR_get_physical_device_properties2",
 		//VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME
 	};
+	uint extensionCount = offscreen?1:sizeof(pextensions)/sizeof(pextensions[0]); //no surface extensions offscreen
 	DebugPrintf(stdout,"Enumerating required extensions\n");
 	uint extFound = 0;
 	for(uint i = 0; i < extCount; ++i)
-		for(uint j = 0; j < sizeof(pextensions)/sizeof(pextensions[0]); ++j)
+		for(uint j = 0; j < extensionCount; ++j)
 			if(strcmp(pextProps[i].extensionName,pextensions[j]) == 0){
 				printf("%s\n",pextensions[j]);
 				++extFound;
 			}
-	if(extFound < sizeof(pextensions)/sizeof(pextensions[0]))
+	if(extFound < extensionCount)
 		throw Exception("Could not find all required extensions.");
 	
 	VkApplicationInfo appInfo = {};
@@ -231,14 +414,14 @@ void CompositorInterface::InitializeRenderEngine(){
 	appInfo.applicationVersion = VK_MAKE_VERSION(0,0,1);
 	appInfo.pEngineName = "chamferwm-engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(0,0,1);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_2; //timeline semaphores
 
 	VkInstanceCreateInfo instanceCreateInfo = {};
 	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	instanceCreateInfo.pApplicationInfo = &appInfo;
 	instanceCreateInfo.enabledLayerCount = 0;//sizeof(players)/sizeof(players[0]); //also in vkCreateDevice
 	instanceCreateInfo.ppEnabledLayerNames = 0;//players;
-	instanceCreateInfo.enabledExtensionCount = sizeof(pextensions)/sizeof(pextensions[0]);
+	instanceCreateInfo.enabledExtensionCount = extensionCount;
 	instanceCreateInfo.ppEnabledExtensionNames = pextensions;
 	if(vkCreateInstance(&instanceCreateInfo,0,&instance) != VK_SUCCESS)
 		throw Exception("Failed to create Vulkan instance.");
@@ -246,7 +429,8 @@ void CompositorInterface::InitializeRenderEngine(){
 	//delete []playerProps;
 	delete []pextProps;
 
-	CreateSurfaceKHR(&surface);
+	if(!offscreen)
+		CreateSurfaceKHR(&surface);
 	
 	VkDebugReportCallbackCreateInfoEXT debugcbCreateInfo = {};
 	debugcbCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
@@ -283,26 +467,33 @@ void CompositorInterface::InitializeRenderEngine(){
 	physicalDev = pdevices[physicalDevIndex];
 	physicalDevProps = pdevProps[physicalDevIndex];
 
+	if(physicalDevProps.apiVersion < VK_API_VERSION_1_2){
+		snprintf(Exception::buffer,sizeof(Exception::buffer),"Vulkan 1.2 required, device supports %u.%u.",VK_VERSION_MAJOR(physicalDevProps.apiVersion),VK_VERSION_MINOR(physicalDevProps.apiVersion));
+		throw Exception();
+	}
+
 	delete []pdevices;
 	delete []pdevProps;
 
-	VkSurfaceCapabilitiesKHR surfaceCapabilities;
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDev,surface,&surfaceCapabilities);
+	VkSurfaceCapabilitiesKHR surfaceCapabilities = {};
+	if(!offscreen){
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDev,surface,&surfaceCapabilities);
 
-	uint formatCount;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDev,surface,&formatCount,0);
-	VkSurfaceFormatKHR *pformats = new VkSurfaceFormatKHR[formatCount];
-	vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDev,surface,&formatCount,pformats);
+		uint formatCount;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDev,surface,&formatCount,0);
+		VkSurfaceFormatKHR *pformats = new VkSurfaceFormatKHR[formatCount];
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDev,surface,&formatCount,pformats);
 
-	DebugPrintf(stdout,"Available surface formats: %u\n",formatCount);
-	for(uint i = 0; i < formatCount; ++i)
-		if(pformats[i].format == VK_FORMAT_B8G8R8A8_UNORM && pformats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-			printf("Surface format ok.\n");
+		DebugPrintf(stdout,"Available surface formats: %u\n",formatCount);
+		for(uint i = 0; i < formatCount; ++i)
+			if(pformats[i].format == VK_FORMAT_B8G8R8A8_UNORM && pformats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+				printf("Surface format ok.\n");
 
-	uint presentModeCount;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDev,surface,&presentModeCount,0);
-	VkPresentModeKHR *ppresentModes = new VkPresentModeKHR[presentModeCount];
-	vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDev,surface,&presentModeCount,ppresentModes);
+		uint presentModeCount;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDev,surface,&presentModeCount,0);
+		VkPresentModeKHR *ppresentModes = new VkPresentModeKHR[presentModeCount];
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDev,surface,&presentModeCount,ppresentModes);
+	}
 
 	uint queueFamilyCount;
 	vkGetPhysicalDeviceQueueFamilyProperties(physicalDev,&queueFamilyCount,0);
@@ -318,7 +509,9 @@ void CompositorInterface::InitializeRenderEngine(){
 			break;
 		}
 	}
-	for(uint i = 0; i < queueFamilyCount; ++i){
+	if(offscreen)
+		queueFamilyIndex[QUEUE_INDEX_PRESENT] = queueFamilyIndex[QUEUE_INDEX_GRAPHICS]; //nothing is presented offscreen
+	for(uint i = 0; i < queueFamilyCount && !offscreen; ++i){
 		VkBool32 presentSupport;
 		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDev,i,surface,&presentSupport);
 
@@ -329,6 +522,16 @@ void CompositorInterface::InitializeRenderEngine(){
 			break;
 		}
 	}
+	//prefer a transfer-only family for the uploads (DMA engine), fall back to the graphics queue
+	queueFamilyIndex[QUEUE_INDEX_TRANSFER] = queueFamilyIndex[QUEUE_INDEX_GRAPHICS];
+	for(uint i = 0; i < queueFamilyCount; ++i){
+		if(pqueueFamilyProps[i].queueCount > 0 && pqueueFamilyProps[i].queueFlags & VK_QUEUE_TRANSFER_BIT && !(pqueueFamilyProps[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_COMPUTE_BIT))){
+			queueFamilyIndex[QUEUE_INDEX_TRANSFER] = i;
+			break;
+		}
+	}
+	asyncTransfer = queueFamilyIndex[QUEUE_INDEX_TRANSFER] != queueFamilyIndex[QUEUE_INDEX_GRAPHICS];
+	DebugPrintf(stdout,"Transfer queue family: %u%s\n",queueFamilyIndex[QUEUE_INDEX_TRANSFER],asyncTransfer?" (dedicated)":"");
 	std::set<uint> queueSet;
 	for(uint i = 0; i < QUEUE_INDEX_COUNT; ++i){
 		if(queueFamilyIndex[i] == ~0u)
@@ -352,9 +555,37 @@ void CompositorInterface::InitializeRenderEngine(){
 		++queueCount;
 	}
 
+	VkPhysicalDeviceVulkan12Features physicalDevFeatures12 = {};
+	physicalDevFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 physicalDevFeatures2 = {};
+	physicalDevFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	physicalDevFeatures2.pNext = &physicalDevFeatures12;
+	vkGetPhysicalDeviceFeatures2(physicalDev,&physicalDevFeatures2);
+	if(!physicalDevFeatures12.timelineSemaphore)
+		throw Exception("Timeline semaphores not supported by the device.");
+
 	VkPhysicalDeviceFeatures physicalDevFeatures = {};
 	physicalDevFeatures.geometryShader = VK_TRUE;
 	//physicalDevFeatures.multiViewport = VK_TRUE;
+
+	VkPhysicalDeviceVulkan12Features enabledFeatures12 = {};
+	enabledFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	enabledFeatures12.timelineSemaphore = VK_TRUE;
+
+	if(instancedRendering){
+		if(physicalDevFeatures12.shaderSampledImageArrayNonUniformIndexing && physicalDevFeatures12.descriptorBindingPartiallyBound &&
+			physicalDevFeatures12.descriptorBindingSampledImageUpdateAfterBind && physicalDevFeatures12.descriptorBindingUpdateUnusedWhilePending){
+			enabledFeatures12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+			enabledFeatures12.descriptorBindingPartiallyBound = VK_TRUE;
+			enabledFeatures12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+			enabledFeatures12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+			descriptorIndexing = true;
+		}else{
+			DebugPrintf(stderr,"Descriptor indexing not supported by the device, instanced rendering disabled.\n");
+			instancedRendering = false;
+		}
+	}
 	
 	uint devExtCount;
 	vkEnumerateDeviceExtensionProperties(physicalDev,0,&devExtCount,0);
@@ -363,25 +594,27 @@ void CompositorInterface::InitializeRenderEngine(){
 
 	//device extensions
 	const char *pdevExtensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+	uint devExtensionCount = offscreen?0:sizeof(pdevExtensions)/sizeof(pdevExtensions[0]);
 	DebugPrintf(stdout,"Enumerating required device extensions\n");
 	uint devExtFound = 0;
 	for(uint i = 0; i < devExtCount; ++i)
-		for(uint j = 0; j < sizeof(pdevExtensions)/sizeof(pdevExtensions[0]); ++j)
+		for(uint j = 0; j < devExtensionCount; ++j)
 			if(strcmp(pdevExtProps[i].extensionName,pdevExtensions[j]) == 0){
 				printf("%s\n",pdevExtensions[j]);
 				++devExtFound;
 			}
-	if(devExtFound < sizeof(pdevExtensions)/sizeof(pdevExtensions[0]))
+	if(devExtFound < devExtensionCount)
 		throw Exception("Could not find all required device extensions.");
 	//
 
 	VkDeviceCreateInfo devCreateInfo = {};
 	devCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	devCreateInfo.pNext = &enabledFeatures12;
 	devCreateInfo.pQueueCreateInfos = queueCreateInfo;
 	devCreateInfo.queueCreateInfoCount = queueCount;
 	devCreateInfo.pEnabledFeatures = &physicalDevFeatures;
 	devCreateInfo.ppEnabledExtensionNames = pdevExtensions;
-	devCreateInfo.enabledExtensionCount = sizeof(pdevExtensions)/sizeof(pdevExtensions[0]);
+	devCreateInfo.enabledExtensionCount = devExtensionCount;
 	devCreateInfo.ppEnabledLayerNames = 0;//players;
 	devCreateInfo.enabledLayerCount = 0;//sizeof(players)/sizeof(players[0]);
 	if(vkCreateDevice(physicalDev,&devCreateInfo,0,&logicalDev) != VK_SUCCESS)
@@ -392,6 +625,8 @@ void CompositorInterface::InitializeRenderEngine(){
 	for(uint i = 0; i < QUEUE_INDEX_COUNT; ++i)
 		vkGetDeviceQueue(logicalDev,queueFamilyIndex[i],0,&queue[i]);
 
+	LoadPipelineCache();
+
 	//render pass (later an array of these for different purposes)
 	VkAttachmentReference attachmentRef = {};
 	attachmentRef.attachment = 0;
@@ -410,7 +645,7 @@ void CompositorInterface::InitializeRenderEngine(){
 	attachmentDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachmentDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachmentDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	attachmentDesc.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	attachmentDesc.finalLayout = offscreen?VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //offscreen images are only read back
 
 	VkSubpassDependency subpassDependency = {};
 	subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
@@ -434,36 +669,82 @@ void CompositorInterface::InitializeRenderEngine(){
 	
 	imageExtent = GetExtent();
 
-	//swap chain
-	VkSwapchainCreateInfoKHR swapchainCreateInfo = {};
-	swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-	swapchainCreateInfo.surface = surface;
-	swapchainCreateInfo.minImageCount = 3;
-	swapchainCreateInfo.imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
-	swapchainCreateInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-	swapchainCreateInfo.imageExtent = imageExtent;
-	swapchainCreateInfo.imageArrayLayers = 1;
-	swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-	if(queueFamilyIndex[QUEUE_INDEX_GRAPHICS] != queueFamilyIndex[QUEUE_INDEX_PRESENT]){
-		DebugPrintf(stdout,"concurrent swap chain\n");
-		static const uint queueFamilyIndex1[] = {queueFamilyIndex[QUEUE_INDEX_GRAPHICS],queueFamilyIndex[QUEUE_INDEX_PRESENT]};
-		swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-		swapchainCreateInfo.queueFamilyIndexCount = 2;
-		swapchainCreateInfo.pQueueFamilyIndices = queueFamilyIndex1;
-	}else swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	swapchainCreateInfo.preTransform = surfaceCapabilities.currentTransform;
-	swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	//swapchainCreateInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
-	swapchainCreateInfo.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-	swapchainCreateInfo.clipped = VK_TRUE;
-	swapchainCreateInfo.oldSwapchain = 0;
-	if(vkCreateSwapchainKHR(logicalDev,&swapchainCreateInfo,0,&swapChain) != VK_SUCCESS)
-		throw Exception("Failed to create swap chain.");
-
-	DebugPrintf(stdout,"Swap chain image extent %ux%u\n",swapchainCreateInfo.imageExtent.width,swapchainCreateInfo.imageExtent.height); 
-	vkGetSwapchainImagesKHR(logicalDev,swapChain,&swapChainImageCount,0);
-	pswapChainImages = new VkImage[swapChainImageCount];
-	vkGetSwapchainImagesKHR(logicalDev,swapChain,&swapChainImageCount,pswapChainImages);
+	if(offscreen){
+		//render targets in place of the swap chain, one per frame slot
+		swapChainImageCount = frameCount;
+		pswapChainImages = new VkImage[swapChainImageCount];
+		poffscreenMemory = new VkDeviceMemory[swapChainImageCount];
+
+		VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProps;
+		vkGetPhysicalDeviceMemoryProperties(physicalDev,&physicalDeviceMemoryProps);
+
+		for(uint i = 0; i < swapChainImageCount; ++i){
+			VkImageCreateInfo imageCreateInfo = {};
+			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
+			imageCreateInfo.extent.width = imageExtent.width;
+			imageCreateInfo.extent.height = imageExtent.height;
+			imageCreateInfo.extent.depth = 1;
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if(vkCreateImage(logicalDev,&imageCreateInfo,0,&pswapChainImages[i]) != VK_SUCCESS)
+				throw Exception("Failed to create an offscreen image.");
+
+			VkMemoryRequirements memoryRequirements;
+			vkGetImageMemoryRequirements(logicalDev,pswapChainImages[i],&memoryRequirements);
+
+			VkMemoryAllocateInfo memoryAllocateInfo = {};
+			memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			memoryAllocateInfo.allocationSize = memoryRequirements.size;
+			for(memoryAllocateInfo.memoryTypeIndex = 0; memoryAllocateInfo.memoryTypeIndex < physicalDeviceMemoryProps.memoryTypeCount; memoryAllocateInfo.memoryTypeIndex++){
+				if(memoryRequirements.memoryTypeBits & (1<<memoryAllocateInfo.memoryTypeIndex) && physicalDeviceMemoryProps.memoryTypes[memoryAllocateInfo.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+					break;
+			}
+
+			if(vkAllocateMemory(logicalDev,&memoryAllocateInfo,0,&poffscreenMemory[i]) != VK_SUCCESS)
+				throw Exception("Failed to allocate offscreen image memory.");
+
+			vkBindImageMemory(logicalDev,pswapChainImages[i],poffscreenMemory[i],0);
+		}
+		DebugPrintf(stdout,"Offscreen image extent %ux%u\n",imageExtent.width,imageExtent.height);
+	}else{
+		//swap chain
+		VkSwapchainCreateInfoKHR swapchainCreateInfo = {};
+		swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		swapchainCreateInfo.surface = surface;
+		swapchainCreateInfo.minImageCount = 3;
+		swapchainCreateInfo.imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+		swapchainCreateInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+		swapchainCreateInfo.imageExtent = imageExtent;
+		swapchainCreateInfo.imageArrayLayers = 1;
+		swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		if(queueFamilyIndex[QUEUE_INDEX_GRAPHICS] != queueFamilyIndex[QUEUE_INDEX_PRESENT]){
+			DebugPrintf(stdout,"concurrent swap chain\n");
+			static const uint queueFamilyIndex1[] = {queueFamilyIndex[QUEUE_INDEX_GRAPHICS],queueFamilyIndex[QUEUE_INDEX_PRESENT]};
+			swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+			swapchainCreateInfo.queueFamilyIndexCount = 2;
+			swapchainCreateInfo.pQueueFamilyIndices = queueFamilyIndex1;
+		}else swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		swapchainCreateInfo.preTransform = surfaceCapabilities.currentTransform;
+		swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		//swapchainCreateInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+		swapchainCreateInfo.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+		swapchainCreateInfo.clipped = VK_TRUE;
+		swapchainCreateInfo.oldSwapchain = 0;
+		if(vkCreateSwapchainKHR(logicalDev,&swapchainCreateInfo,0,&swapChain) != VK_SUCCESS)
+			throw Exception("Failed to create swap chain.");
+
+		DebugPrintf(stdout,"Swap chain image extent %ux%u\n",swapchainCreateInfo.imageExtent.width,swapchainCreateInfo.imageExtent.height); 
+		vkGetSwapchainImagesKHR(logicalDev,swapChain,&swapChainImageCount,0);
+		pswapChainImages = new VkImage[swapChainImageCount];
+		vkGetSwapchainImagesKHR(logicalDev,swapChain,&swapChainImageCount,pswapChainImages);
+	}
 
 	VkImageViewCreateInfo imageViewCreateInfo = {};
 	imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -500,20 +781,24 @@ void CompositorInterface::InitializeRenderEngine(){
 	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
 	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	VkFenceCreateInfo fenceCreateInfo = {};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-	psemaphore = new VkSemaphore[swapChainImageCount][SEMAPHORE_INDEX_COUNT];
-	pfence = new VkFence[swapChainImageCount];
-
-	for(uint i = 0; i < swapChainImageCount; ++i){
-		if(vkCreateFence(logicalDev,&fenceCreateInfo,0,&pfence[i]) != VK_SUCCESS)
-			throw Exception("Failed to create a fence.");
+	psemaphore = new VkSemaphore[frameCount][SEMAPHORE_INDEX_COUNT];
+	for(uint i = 0; i < frameCount; ++i)
 		for(uint j = 0; j < SEMAPHORE_INDEX_COUNT; ++j)
 			if(vkCreateSemaphore(logicalDev,&semaphoreCreateInfo,0,&psemaphore[i][j]) != VK_SUCCESS)
 				throw Exception("Failed to create a semaphore.");
-	}
+
+	prenderFinishedSemaphores = new VkSemaphore[swapChainImageCount];
+	for(uint i = 0; i < swapChainImageCount; ++i)
+		if(vkCreateSemaphore(logicalDev,&semaphoreCreateInfo,0,&prenderFinishedSemaphores[i]) != VK_SUCCESS)
+			throw Exception("Failed to create a semaphore.");
+
+	VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = {};
+	semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	semaphoreTypeCreateInfo.initialValue = 0;
+	semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+	if(vkCreateSemaphore(logicalDev,&semaphoreCreateInfo,0,&frameTimeline) != VK_SUCCESS)
+		throw Exception("Failed to create the frame timeline semaphore.");
 
 	//sampler
 	VkSamplerCreateInfo samplerCreateInfo = {};
@@ -536,6 +821,12 @@ void CompositorInterface::InitializeRenderEngine(){
 	if(vkCreateSampler(logicalDev,&samplerCreateInfo,0,&pointSampler) != VK_SUCCESS)
 		throw Exception("Failed to create a sampler.");
 
+	//the atlas is partially updated while sampled, so it's always uploaded on the graphics queue
+	pframeMaskAtlas = new Texture(FRAME_MASK_ATLAS_SIZE,FRAME_MASK_ATLAS_SIZE,VK_FORMAT_R8G8B8A8_UNORM,this);
+	pframeMaskAtlas->queueFamilyIndex = queueFamilyIndex[QUEUE_INDEX_GRAPHICS];
+	for(uint i = FRAME_MASK_CELL_COUNT; i > 0; --i)
+		frameMaskFreeList.push_back(i-1);
+
 	//descriptor pool
 	//descriptors of this pool
 	/*VkDescriptorPoolSize descPoolSizes[2];
@@ -566,38 +857,256 @@ void CompositorInterface::InitializeRenderEngine(){
 	if(vkCreateCommandPool(logicalDev,&commandPoolCreateInfo,0,&commandPool) != VK_SUCCESS)
 		throw Exception("Failed to create a command pool.");
 	
-	pcommandBuffers = new VkCommandBuffer[swapChainImageCount];
-	pcopyCommandBuffers = new VkCommandBuffer[swapChainImageCount];
+	pcommandBuffers = new VkCommandBuffer[frameCount];
+	pcopyCommandBuffers = new VkCommandBuffer[frameCount];
 
 	VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
 	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	commandBufferAllocateInfo.commandPool = commandPool;
 	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	commandBufferAllocateInfo.commandBufferCount = swapChainImageCount;
+	commandBufferAllocateInfo.commandBufferCount = frameCount;
 	if(vkAllocateCommandBuffers(logicalDev,&commandBufferAllocateInfo,pcommandBuffers) != VK_SUCCESS)
 		throw Exception("Failed to allocate command buffers.");
 	
 	if(vkAllocateCommandBuffers(logicalDev,&commandBufferAllocateInfo,pcopyCommandBuffers) != VK_SUCCESS)
 		throw Exception("Failed to allocate copy command buffer.");
 
-	shaders.reserve(1024);
+	if(asyncTransfer){
+		commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex[QUEUE_INDEX_TRANSFER];
+		if(vkCreateCommandPool(logicalDev,&commandPoolCreateInfo,0,&transferCommandPool) != VK_SUCCESS)
+			throw Exception("Failed to create a transfer command pool.");
+
+		ptransferCommandBuffers = new VkCommandBuffer[frameCount];
+
+		commandBufferAllocateInfo.commandPool = transferCommandPool;
+		if(vkAllocateCommandBuffers(logicalDev,&commandBufferAllocateInfo,ptransferCommandBuffers) != VK_SUCCESS)
+			throw Exception("Failed to allocate transfer command buffers.");
+	}else ptransferCommandBuffers = 0;
+
+	if(gpuTiming && !physicalDevProps.limits.timestampComputeAndGraphics){
+		DebugPrintf(stderr,"Timestamp queries not supported, GPU timing disabled.\n");
+		gpuTiming = false;
+	}
+	if(gpuTiming){
+		uint queueFamilyCount;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDev,&queueFamilyCount,0);
+		VkQueueFamilyProperties *pqueueFamilyProps = new VkQueueFamilyProperties[queueFamilyCount];
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDev,&queueFamilyCount,pqueueFamilyProps);
+		uint validBits = pqueueFamilyProps[queueFamilyIndex[QUEUE_INDEX_GRAPHICS]].timestampValidBits;
+		timestampMask = validBits >= 64?~0ull:(1ull<<validBits)-1;
+		delete []pqueueFamilyProps;
+
+		timestampPeriod = physicalDevProps.limits.timestampPeriod;
+
+		VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+		queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCreateInfo.queryCount = frameCount*TIMESTAMP_QUERY_COUNT;
+		if(vkCreateQueryPool(logicalDev,&queryPoolCreateInfo,0,&timestampPool) != VK_SUCCESS)
+			throw Exception("Failed to create a timestamp query pool.");
+
+		ptimedDraws = new std::vector<TimedDraw>[frameCount];
+		ptimestampResults = new uint64[2*TIMESTAMP_QUERY_COUNT];
+		ptimedFrameTags = new uint64[frameCount];
+		std::fill(ptimedFrameTags,ptimedFrameTags+frameCount,~0ull);
+
+		for(uint i = TIMESTAMP_FRAME_COUNT; i > 0; --i)
+			timestampIndexFreeList.push_back(TIMESTAMP_PASS_COUNT+i-1);
+	}
+
+	compileThreadExit = false;
+	compileThread = std::thread(&CompositorInterface::CompileThreadProc,this);
+
+	if(instancedRendering){
+		VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProps;
+		vkGetPhysicalDeviceMemoryProperties(physicalDev,&physicalDeviceMemoryProps);
+
+		pinstanceBuffers = new InstanceBuffer[frameCount];
+		for(uint i = 0; i < frameCount; ++i){
+			VkBufferCreateInfo bufferCreateInfo = {};
+			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferCreateInfo.size = INSTANCE_COUNT*sizeof(Instance);
+			bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			if(vkCreateBuffer(logicalDev,&bufferCreateInfo,0,&pinstanceBuffers[i].buffer) != VK_SUCCESS)
+				throw Exception("Failed to create an instance buffer.");
+
+			VkMemoryRequirements memoryRequirements;
+			vkGetBufferMemoryRequirements(logicalDev,pinstanceBuffers[i].buffer,&memoryRequirements);
+
+			VkMemoryAllocateInfo memoryAllocateInfo = {};
+			memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			memoryAllocateInfo.allocationSize = memoryRequirements.size;
+			for(memoryAllocateInfo.memoryTypeIndex = 0; memoryAllocateInfo.memoryTypeIndex < physicalDeviceMemoryProps.memoryTypeCount; memoryAllocateInfo.memoryTypeIndex++){
+				if(memoryRequirements.memoryTypeBits & (1<<memoryAllocateInfo.memoryTypeIndex) && (physicalDeviceMemoryProps.memoryTypes[memoryAllocateInfo.memoryTypeIndex].propertyFlags & (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) == (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+					break;
+			}
+
+			if(vkAllocateMemory(logicalDev,&memoryAllocateInfo,0,&pinstanceBuffers[i].deviceMemory) != VK_SUCCESS)
+				throw Exception("Failed to allocate instance buffer memory.");
+			vkBindBufferMemory(logicalDev,pinstanceBuffers[i].buffer,pinstanceBuffers[i].deviceMemory,0);
+
+			if(vkMapMemory(logicalDev,pinstanceBuffers[i].deviceMemory,0,bufferCreateInfo.size,0,(void**)&pinstanceBuffers[i].pinstances) != VK_SUCCESS)
+				throw Exception("Failed to map instance buffer memory.");
+		}
+
+		VkDescriptorPoolSize descPoolSize = {};
+		descPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descPoolSize.descriptorCount = frameCount;
+
+		VkDescriptorPoolCreateInfo descPoolCreateInfo = {};
+		descPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		descPoolCreateInfo.poolSizeCount = 1;
+		descPoolCreateInfo.pPoolSizes = &descPoolSize;
+		descPoolCreateInfo.maxSets = frameCount;
+		if(vkCreateDescriptorPool(logicalDev,&descPoolCreateInfo,0,&instanceDescPool) != VK_SUCCESS)
+			throw Exception("Failed to create an instance descriptor pool.");
+	}
+
+	if(descriptorIndexing){
+		//slots may be written while the table is bound by frames in flight, as long as those frames don't access them
+		VkDescriptorSetLayoutBinding binding = {};
+		binding.binding = 0;
+		binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		binding.descriptorCount = TEXTURE_TABLE_SIZE;
+		binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT|VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT|VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+		VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo = {};
+		bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		bindingFlagsCreateInfo.bindingCount = 1;
+		bindingFlagsCreateInfo.pBindingFlags = &bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo descSetLayoutCreateInfo = {};
+		descSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descSetLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+		descSetLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		descSetLayoutCreateInfo.bindingCount = 1;
+		descSetLayoutCreateInfo.pBindings = &binding;
+		if(vkCreateDescriptorSetLayout(logicalDev,&descSetLayoutCreateInfo,0,&textureTableLayout) != VK_SUCCESS)
+			throw Exception("Failed to create the texture table layout.");
+
+		VkDescriptorPoolSize descPoolSize = {};
+		descPoolSize.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		descPoolSize.descriptorCount = TEXTURE_TABLE_SIZE;
+
+		VkDescriptorPoolCreateInfo descPoolCreateInfo = {};
+		descPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		descPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+		descPoolCreateInfo.poolSizeCount = 1;
+		descPoolCreateInfo.pPoolSizes = &descPoolSize;
+		descPoolCreateInfo.maxSets = 1;
+		if(vkCreateDescriptorPool(logicalDev,&descPoolCreateInfo,0,&textureTablePool) != VK_SUCCESS)
+			throw Exception("Failed to create the texture table pool.");
+
+		VkDescriptorSetAllocateInfo descSetAllocateInfo = {};
+		descSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descSetAllocateInfo.descriptorPool = textureTablePool;
+		descSetAllocateInfo.pSetLayouts = &textureTableLayout;
+		descSetAllocateInfo.descriptorSetCount = 1;
+		if(vkAllocateDescriptorSets(logicalDev,&descSetAllocateInfo,&textureTable) != VK_SUCCESS)
+			throw Exception("Failed to allocate the texture table.");
+
+		AssignTextureIndex(pframeMaskAtlas); //for the instanced shaders
+	}
 
-	pipelines.reserve(1024);
+	renderGeneration = 0;
+	renderPending = 0;
+	renderThreadExit = false;
+	renderRanges.resize(renderThreadCount);
+	for(uint i = 1; i < renderThreadCount; ++i)
+		renderThreads.emplace_back(&CompositorInterface::RenderThreadProc,this,i);
+	DebugPrintf(stdout,"Render threads: %u\n",renderThreadCount);
+
+	struct timespec initEndTime;
+	clock_gettime(CLOCK_MONOTONIC,&initEndTime);
+	DebugPrintf(stdout,"Render engine initialized in %.3f s (%s pipeline cache).\n",timespec_diff(initEndTime,initTime),pipelineCacheLoaded?"warm":"cold");
 }
 
 void CompositorInterface::DestroyRenderEngine(){
 	DebugPrintf(stdout,"Compositor cleanup\n");
 
-	for(TextureCacheEntry &textureCacheEntry : textureCache)
+	if(gpuTiming){
+		LogFlush();
+		PrintTimingStats(stdout);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(renderMutex);
+		renderThreadExit = true;
+	}
+	renderCond.notify_all();
+	for(std::thread &thread : renderThreads)
+		thread.join();
+	renderThreads.clear();
+
+	DestroyReleasedObjects(~0ull); //the device is idle, everything can be destroyed
+
+	for(TextureCacheEntry &textureCacheEntry : textureCache){
+		FreeTextureIndex(textureCacheEntry.ptexture);
 		delete textureCacheEntry.ptexture;
+	}
+	textureCache.clear();
+
+	frameMaskTable.clear();
+	frameMaskList.clear();
+	frameMaskFreeList.clear();
+	FreeTextureIndex(pframeMaskAtlas);
+	delete pframeMaskAtlas;
+
+	{
+		std::unique_lock<std::mutex> lock(compileMutex);
+		compileThreadExit = true;
+	}
+	compileCond.notify_all();
+	compileThread.join();
+	compileQueue.clear();
 
+	pipelineTable.clear();
 	pipelines.clear();
+	shaderTable.clear();
 	shaders.clear();
 
 	delete []pcommandBuffers;
 	delete []pcopyCommandBuffers;
 	vkDestroyCommandPool(logicalDev,commandPool,0);
 
+	if(descriptorIndexing){
+		vkDestroyDescriptorPool(logicalDev,textureTablePool,0);
+		vkDestroyDescriptorSetLayout(logicalDev,textureTableLayout,0);
+	}
+
+	if(pinstanceBuffers){
+		vkDestroyDescriptorPool(logicalDev,instanceDescPool,0);
+		for(uint i = 0; i < frameCount; ++i){
+			vkUnmapMemory(logicalDev,pinstanceBuffers[i].deviceMemory);
+			ReleaseEntry releaseEntry;
+			releaseEntry.type = ReleaseEntry::TYPE_BUFFER;
+			releaseEntry.buffer = pinstanceBuffers[i].buffer;
+			ReleaseObject(releaseEntry);
+			releaseEntry.type = ReleaseEntry::TYPE_MEMORY;
+			releaseEntry.memory = pinstanceBuffers[i].deviceMemory;
+			ReleaseObject(releaseEntry);
+		}
+		delete []pinstanceBuffers;
+	}
+
+	DestroyReleasedObjects(~0ull); //pipelines, shader modules and buffers queued above
+
+	if(asyncTransfer){
+		delete []ptransferCommandBuffers;
+		vkDestroyCommandPool(logicalDev,transferCommandPool,0);
+	}
+
+	if(gpuTiming){
+		vkDestroyQueryPool(logicalDev,timestampPool,0);
+		delete []ptimedDraws;
+		delete []ptimestampResults;
+		delete []ptimedFrameTags;
+		timestampIndexFreeList.clear();
+		pipelineStats.clear();
+	}
+
 	for(VkDescriptorPool &descPool : descPoolArray)
 		vkDestroyDescriptorPool(logicalDev,descPool,0);
 	descPoolArray.clear();
@@ -605,32 +1114,51 @@ void CompositorInterface::DestroyRenderEngine(){
 
 	vkDestroySampler(logicalDev,pointSampler,0);
 
-	for(uint i = 0; i < swapChainImageCount; ++i){
-		vkDestroyFence(logicalDev,pfence[i],0);
+	vkDestroySemaphore(logicalDev,frameTimeline,0);
+	for(uint i = 0; i < frameCount; ++i)
 		for(uint j = 0; j < SEMAPHORE_INDEX_COUNT; ++j)
 			vkDestroySemaphore(logicalDev,psemaphore[i][j],0);
 
+	for(uint i = 0; i < swapChainImageCount; ++i){
+		vkDestroySemaphore(logicalDev,prenderFinishedSemaphores[i],0);
+
 		vkDestroyFramebuffer(logicalDev,pframebuffers[i],0);
 		vkDestroyImageView(logicalDev,pswapChainImageViews[i],0);
 	}
 	delete []psemaphore;
-	delete []pfence;
+	delete []prenderFinishedSemaphores;
+	delete []pframebuffers;
 	delete []pswapChainImageViews;
+	if(offscreen){
+		for(uint i = 0; i < swapChainImageCount; ++i){
+			vkDestroyImage(logicalDev,pswapChainImages[i],0);
+			vkFreeMemory(logicalDev,poffscreenMemory[i],0);
+		}
+		delete []poffscreenMemory;
+	}else vkDestroySwapchainKHR(logicalDev,swapChain,0);
 	delete []pswapChainImages;
-	vkDestroySwapchainKHR(logicalDev,swapChain,0);
 
 	vkDestroyRenderPass(logicalDev,renderPass,0);
 
+	SavePipelineCache();
+	vkDestroyPipelineCache(logicalDev,pipelineCache,0);
+
 	vkDestroyDevice(logicalDev,0);
 
 	((PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance,"vkDestroyDebugReportCallbackEXT"))(instance,debugReportCb,0);
 
-	vkDestroySurfaceKHR(instance,surface,0);
+	if(!offscreen)
+		vkDestroySurfaceKHR(instance,surface,0);
 	vkDestroyInstance(instance,0);
 }
 
 void CompositorInterface::AddShader(const char *pname, const Blob *pblob){
-	shaders.emplace_back(pname,pblob,this);
+	if(shaderTable.find(pname) != shaderTable.end()){
+		DebugPrintf(stderr,"Shader %s already loaded, ignoring.\n",pname);
+		return;
+	}
+	ShaderModule *pshader = &shaders.emplace_back(pname,pblob,this);
+	shaderTable.emplace(pshader->pname,pshader);
 }
 
 void CompositorInterface::WaitIdle(){
@@ -677,229 +1205,1200 @@ void CompositorInterface::CreateRenderQueue(const WManager::Container *pcontaine
 	CreateRenderQueueAppendix(pcontainer->pclient,pfocus);
 }
 
+void CompositorInterface::WaitFrameSlot(){
+	//Block until the frame that last used the current slot has completed, so that the
+	//following PollFrameFence() doesn't defer the frame.
+	if(frameTag < frameCount)
+		return;
+	uint64 waitValue = frameTag-frameCount+1;
+	VkSemaphoreWaitInfo semaphoreWaitInfo = {};
+	semaphoreWaitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	semaphoreWaitInfo.semaphoreCount = 1;
+	semaphoreWaitInfo.pSemaphores = &frameTimeline;
+	semaphoreWaitInfo.pValues = &waitValue;
+	if(vkWaitSemaphores(logicalDev,&semaphoreWaitInfo,std::numeric_limits<uint64_t>::max()) != VK_SUCCESS)
+		throw Exception("Failed to wait for the frame timeline.");
+}
+
 bool CompositorInterface::PollFrameFence(){
-	if(vkWaitForFences(logicalDev,1,&pfence[currentFrame],VK_TRUE,0) == VK_TIMEOUT)
+	uint64 completionTag;
+	if(vkGetSemaphoreCounterValue(logicalDev,frameTimeline,&completionTag) != VK_SUCCESS)
+		throw Exception("Failed to query the frame timeline.");
+	if(completionTag > frameCompletionTag){
+		struct timespec retireTime;
+		clock_gettime(CLOCK_MONOTONIC,&retireTime);
+		for(uint64 i = std::max(frameCompletionTag,completionTag > FRAME_TIMING_COUNT?completionTag-FRAME_TIMING_COUNT:0); i < completionTag; ++i)
+			frameTimings[i%FRAME_TIMING_COUNT].retireTime = retireTime;
+		frameCompletionTag = completionTag;
+	}
+
+	//The frame slot is free once the frame that last used it has completed. If it isn't, or no image
+	//is available yet, the frame is deferred and the caller is expected to retry shortly.
+	if(frameTag >= frameCount && frameCompletionTag < frameTag-frameCount+1)
 		return false;
-	vkResetFences(logicalDev,1,&pfence[currentFrame]);
+	if(gpuTiming)
+		ReadTimestamps();
 
-	//release the textures no longer in use
-	textureCache.erase(std::remove_if(textureCache.begin(),textureCache.end(),[&](auto &textureCacheEntry)->bool{
-		if(frameTag < textureCacheEntry.releaseTag+swapChainImageCount+1 || timespec_diff(frameTime,textureCacheEntry.releaseTime) < 5.0f)
+	if(offscreen){
+		imageIndex = currentFrame; //one offscreen image per frame slot, free with the slot
+		imageAcquired = true;
+	}
+	if(!imageAcquired){
+		VkResult result = vkAcquireNextImageKHR(logicalDev,swapChain,0,psemaphore[currentFrame][SEMAPHORE_INDEX_IMAGE_AVAILABLE],0,&imageIndex);
+		if(result == VK_TIMEOUT || result == VK_NOT_READY)
 			return false;
-		delete textureCacheEntry.ptexture;
-		return true;
-	}),textureCache.end());
+		if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+			throw Exception("Failed to acquire a swap chain image.");
+		imageAcquired = true;
+	}
 
-	descSetCache.erase(std::remove_if(descSetCache.begin(),descSetCache.end(),[&](auto &descSetCacheEntry)->bool{
-		if(frameTag < descSetCacheEntry.releaseTag+swapChainImageCount+1)
-			return false;
-		auto m = std::find_if(descPoolReference.begin(),descPoolReference.end(),[&](auto &p)->bool{
-			return descSetCacheEntry.pdescSets == p.first;
-		});
-		if(m == descPoolReference.end())
-			return true;
-		vkFreeDescriptorSets(logicalDev,(*m).second,descSetCacheEntry.setCount,descSetCacheEntry.pdescSets);
-		descPoolReference.erase(m);
-		printf("************ releasing desc set\n");
+	FrameTiming &frameTiming = frameTimings[frameTag%FRAME_TIMING_COUNT];
+	frameTiming = (FrameTiming){};
+	frameTiming.frameTag = frameTag;
+	clock_gettime(CLOCK_MONOTONIC,&frameTiming.beginTime);
 
-		delete []descSetCacheEntry.pdescSets;
-		return true;
-	}),descSetCache.end());
+	DestroyReleasedObjects(frameCompletionTag);
+	frameTiming.releaseQueueDepth = releaseQueue.size();
+	releaseQueueMaxDepth = std::max(releaseQueueMaxDepth,frameTiming.releaseQueueDepth);
+
+	//destroy the textures that haven't been reused for a while
+	for(; textureCache.size() > 0 && timespec_diff(frameTiming.beginTime,textureCache.front().releaseTime) >= (float)TEXTURE_CACHE_EXPIRY; textureCache.pop_front()){
+		FreeTextureIndex(textureCache.front().ptexture);
+		delete textureCache.front().ptexture;
+	}
 	return true;
 }
 
-void CompositorInterface::GenerateCommandBuffers(const WManager::Container *proot, const std::vector<std::pair<const WManager::Client *, WManager::Client *>> *pstackAppendix, const WManager::Container *pfocus){
-	if(!proot)
-		return;
-	
-	//Create a render list elements arranged from back to front
-	renderQueue.clear();
-	appendixQueue.clear();
-	for(auto &p : *pstackAppendix){
-		if(p.first){
-			appendixQueue.push_back(p);
-			continue;
+void CompositorInterface::ReleaseObject(ReleaseEntry &releaseEntry){
+	releaseEntry.releaseTag = frameTag;
+	releaseQueue.push_back(releaseEntry);
+}
+
+void CompositorInterface::DestroyReleasedObjects(uint64 completionTag){
+	//entries are queued in frame order, so the expired ones are always at the front
+	for(; releaseQueue.size() > 0 && completionTag >= releaseQueue.front().releaseTag; releaseQueue.pop_front()){
+		ReleaseEntry &releaseEntry = releaseQueue.front();
+		switch(releaseEntry.type){
+		case ReleaseEntry::TYPE_TEXTURE:{
+			//no longer in use, available for reuse
+			TextureCacheEntry &textureCacheEntry = textureCache.emplace_back();
+			textureCacheEntry.ptexture = releaseEntry.ptexture;
+			clock_gettime(CLOCK_MONOTONIC,&textureCacheEntry.releaseTime);
+			}
+			break;
+		case ReleaseEntry::TYPE_DESC_SETS:{
+			auto m = descPoolReference.find(releaseEntry.descSets.pdescSets);
+			if(m != descPoolReference.end()){
+				vkFreeDescriptorSets(logicalDev,(*m).second,releaseEntry.descSets.setCount,releaseEntry.descSets.pdescSets);
+				descPoolReference.erase(m);
+			}
+			delete []releaseEntry.descSets.pdescSets;
+			}
+			break;
+		case ReleaseEntry::TYPE_COMMAND_POOL:
+			vkDestroyCommandPool(logicalDev,releaseEntry.commandPool,0);
+			break;
+		case ReleaseEntry::TYPE_PIPELINE:
+			vkDestroyPipeline(logicalDev,releaseEntry.pipeline,0);
+			break;
+		case ReleaseEntry::TYPE_PIPELINE_LAYOUT:
+			vkDestroyPipelineLayout(logicalDev,releaseEntry.pipelineLayout,0);
+			break;
+		case ReleaseEntry::TYPE_SHADER_MODULE:
+			vkDestroyShaderModule(logicalDev,releaseEntry.shaderModule,0);
+			break;
+		case ReleaseEntry::TYPE_DESC_SET_LAYOUT:
+			vkDestroyDescriptorSetLayout(logicalDev,releaseEntry.descSetLayout,0);
+			break;
+		case ReleaseEntry::TYPE_BUFFER:
+			vkDestroyBuffer(logicalDev,releaseEntry.buffer,0);
+			break;
+		case ReleaseEntry::TYPE_MEMORY:
+			vkFreeMemory(logicalDev,releaseEntry.memory,0);
+			break;
+		default:
+			break;
 		}
-		//desktop features are placed first
-		RenderObject renderObject;
-		renderObject.pclient = p.second;
-		renderObject.pclientFrame = dynamic_cast<ClientFrame *>(p.second);
-		renderObject.flags = renderObject.pclient->pcontainer == pfocus?0x1:0;
-		renderQueue.push_back(renderObject);
 	}
+}
 
-	CreateRenderQueue(proot,pfocus);
-	for(auto &p : appendixQueue){ //push the remaining (untransient) windows to the end of the queue
-		RenderObject renderObject;
-		renderObject.pclient = p.second;
-		renderObject.pclientFrame = dynamic_cast<ClientFrame *>(p.second);
-		renderObject.flags = renderObject.pclient->pcontainer == pfocus?0x1:0;
-		renderQueue.push_back(renderObject);
+void CompositorInterface::RecordRenderRange(RenderRange *prange){
+	Tracer::Scope traceScope("RecordRenderRange");
+	prange->recordCount = 0;
+	try{
+		for(uint i = prange->begin; i < prange->end; ++i){
+			RenderObject &renderObject = renderQueue[i];
+
+			VkRect2D frame;
+			frame.offset = {renderObject.pclient->rect.x,renderObject.pclient->rect.y};
+			frame.extent = {renderObject.pclient->rect.w,renderObject.pclient->rect.h};
+
+			/*VkRect2D scissor = frame;
+			for(uint j = i+1; j < renderQueue.size(); ++j){
+				RenderObject &renderObject1 = renderQueue[j];
+
+				if(frame.offset.y >= renderObject1.pclient->rect.y-1 &&
+					frame.offset.y+frame.extent.height <= renderObject1.pclient->rect.y+renderObject1.pclient->rect.h+1){
+					if(scissor.offset.x+scissor.extent.width > renderObject1.pclient->rect.x &&
+						scissor.offset.x < renderObject1.pclient->rect.x)
+						scissor.extent.width = renderObject1.pclient->rect.x-scissor.offset.x;
+
+					if(renderObject1.pclient->rect.x+renderObject1.pclient->rect.w > scissor.offset.x &&
+						renderObject1.pclient->rect.x < scissor.offset.x){
+						sint oldOffset = scissor.offset.x;
+						scissor.offset.x = renderObject1.pclient->rect.x+renderObject1.pclient->rect.w;
+						scissor.extent.width -= scissor.offset.x-oldOffset;
+					}
+				}
+			}
+			//TODO: need five scissors, one for the content and 4 for the thin borders around it
+			glm::ivec2 borderWidth = 2*glm::ivec2(
+				renderObject.pclient->pcontainer->borderWidth.x*(float)imageExtent.width,
+				renderObject.pclient->pcontainer->borderWidth.x*(float)imageExtent.width); //due to aspect, this must be *width
+			scissor.offset.x = std::max(scissor.offset.x-borderWidth.x,0);
+			scissor.extent.width += 2*borderWidth.x;
+			scissor.offset.y = std::max(scissor.offset.y-borderWidth.y,0);
+			scissor.extent.height += 2*borderWidth.y;*/
+
+			//vkCmdSetScissor(pcommandBuffers[currentFrame],0,1,&scissor);
+			if(uncachedRecording)
+				renderObject.pclientFrame->InvalidateCommandBuffers();
+			if(renderObject.pclientFrame->UpdateCommandBuffer(frame,renderObject.pclient->pcontainer->borderWidth,renderObject.flags,&secondaryCommandBuffers[prange->offset+i]))
+				prange->recordCount++;
+		}
+
+	}catch(...){
+		prange->pexception = std::current_exception();
 	}
+}
 
-	//deque of scissors, pop_front
-	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	commandBufferBeginInfo.flags = 0;
-	if(vkBeginCommandBuffer(pcopyCommandBuffers[currentFrame],&commandBufferBeginInfo) != VK_SUCCESS)
-		throw Exception("Failed to begin command buffer recording.");
-	
-	if(pbackground)
-		pbackground->UpdateContents(&pcopyCommandBuffers[currentFrame]);
+void CompositorInterface::RenderThreadProc(uint index){
+	uint64 generation = 0;
+	for(;;){
+		std::unique_lock<std::mutex> lock(renderMutex);
+		renderCond.wait(lock,[&]()->bool{
+			return renderThreadExit || renderGeneration != generation;
+		});
+		if(renderThreadExit)
+			break;
+		generation = renderGeneration;
+		lock.unlock();
 
-	for(ClientFrame *pclientFrame : updateQueue)
-		pclientFrame->UpdateContents(&pcopyCommandBuffers[currentFrame]);
-	updateQueue.clear();
+		RecordRenderRange(&renderRanges[index]);
 
-	if(vkEndCommandBuffer(pcopyCommandBuffers[currentFrame]) != VK_SUCCESS)
-		throw Exception("Failed to end command buffer recording.");
+		lock.lock();
+		if(--renderPending == 0)
+			renderDoneCond.notify_one();
+	}
+}
 
-	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-	if(vkBeginCommandBuffer(pcommandBuffers[currentFrame],&commandBufferBeginInfo) != VK_SUCCESS)
-		throw Exception("Failed to begin command buffer recording.");
+glm::vec4 CompositorInterface::GetFrameVector(const VkRect2D &frame) const{
+	//pixel rectangle to normalized device coordinates
+	glm::vec4 frameVec = {frame.offset.x,frame.offset.y,frame.offset.x+frame.extent.width,frame.offset.y+frame.extent.height};
+	frameVec += 0.5f;
+	frameVec /= (glm::vec4){imageExtent.width,imageExtent.height,imageExtent.width,imageExtent.height};
+	frameVec *= 2.0f;
+	frameVec -= 1.0f;
+	return frameVec;
+}
 
-	static const VkClearValue clearValue = {1.0f,1.0f,1.0f,1.0f};
-	VkRenderPassBeginInfo renderPassBeginInfo = {};
-	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.renderPass = renderPass;
-	renderPassBeginInfo.framebuffer = pframebuffers[currentFrame];
-	renderPassBeginInfo.renderArea.offset = {0,0};
-	renderPassBeginInfo.renderArea.extent = imageExtent;
-	renderPassBeginInfo.clearValueCount = 1;
-	renderPassBeginInfo.pClearValues = &clearValue;
-	vkCmdBeginRenderPass(pcommandBuffers[currentFrame],&renderPassBeginInfo,VK_SUBPASS_CONTENTS_INLINE);
+void CompositorInterface::InitializeInstancedRenderer(){
+	//Called once the shaders have been added. Without the shaders or a compatible layout, the windows
+	//are drawn through the geometry shader path instead.
+	static const char *pinstancedShaderName[Pipeline::SHADER_MODULE_COUNT] = {
+		"frame_instanced_vertex.spv",0,"frame_instanced_fragment.spv"
+	};
+	if(!instancedRendering)
+		return;
+	try{
+		pinstancedPipeline = LoadPipeline(pinstancedShaderName,0);
+		pframePipeline = LoadPipeline(pframeShaderName,0);
+
+	}catch(Exception e){
+		DebugPrintf(stderr,"%s Instanced rendering disabled.\n",e.what());
+		instancedRendering = false;
+		pinstancedPipeline = 0;
+		return;
+	}
 
-	clock_gettime(CLOCK_MONOTONIC,&frameTime);
+	const ShaderModule *pvertexShader = pinstancedPipeline->pshaderModule[Pipeline::SHADER_MODULE_VERTEX];
+	const ShaderModule *pfragmentShader = pinstancedPipeline->pshaderModule[Pipeline::SHADER_MODULE_FRAGMENT];
+	if(pvertexShader->setCount != 1 || pfragmentShader->setCount != 1 || pfragmentShader->pdescSetLayouts[0] != textureTableLayout){
+		DebugPrintf(stderr,"Unexpected instanced shader descriptor set layout. Instanced rendering disabled.\n");
+		instancedRendering = false;
+		pinstancedPipeline = 0;
+		return;
+	}
 
-	if(pbackground){
-		vkCmdBindPipeline(pcommandBuffers[currentFrame],VK_PIPELINE_BIND_POINT_GRAPHICS,pbackground->passignedSet->p->pipeline);
-		//
-		VkRect2D frame;
-		frame.offset = {0,0};
-		frame.extent = imageExtent;
-
-		vkCmdSetScissor(pcommandBuffers[currentFrame],0,1,&frame);
-		pbackground->Draw(frame,glm::vec2(0.0f),0,&pcommandBuffers[currentFrame]);
+	for(uint i = 0; i < frameCount; ++i){
+		VkDescriptorSetAllocateInfo descSetAllocateInfo = {};
+		descSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descSetAllocateInfo.descriptorPool = instanceDescPool;
+		descSetAllocateInfo.pSetLayouts = pvertexShader->pdescSetLayouts;
+		descSetAllocateInfo.descriptorSetCount = 1;
+		if(vkAllocateDescriptorSets(logicalDev,&descSetAllocateInfo,&pinstanceBuffers[i].descSet) != VK_SUCCESS)
+			throw Exception("Failed to allocate instance descriptor sets.");
+
+		VkDescriptorBufferInfo descBufferInfo = {};
+		descBufferInfo.buffer = pinstanceBuffers[i].buffer;
+		descBufferInfo.offset = 0;
+		descBufferInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet writeDescSet = {};
+		writeDescSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writeDescSet.dstSet = pinstanceBuffers[i].descSet;
+		writeDescSet.dstBinding = 0;
+		writeDescSet.dstArrayElement = 0;
+		writeDescSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writeDescSet.descriptorCount = 1;
+		writeDescSet.pBufferInfo = &descBufferInfo;
+		vkUpdateDescriptorSets(logicalDev,1,&writeDescSet,0,0);
 	}
+	DebugPrintf(stdout,"Instanced rendering enabled.\n");
+}
+
+uint CompositorInterface::GetVariant(const RenderObject &renderObject) const{
+	uint variant = renderObject.pclientFrame->shaderUserVariant;
+	if(renderObject.pclient->pcontainer->borderWidth.x <= 0.0f && renderObject.pclient->pcontainer->borderWidth.y <= 0.0f)
+		variant |= Pipeline::VARIANT_NO_SHADOW|Pipeline::VARIANT_NO_BORDER;
+	if(renderObject.pclient->pcontainer->flags & WManager::Container::FLAG_NO_FOCUS)
+		variant |= Pipeline::VARIANT_NO_FOCUS_INDICATOR;
+	//the shadow and the border of a fullscreen window are off-screen
+	if(renderObject.pclient->pcontainer->flags & WManager::Container::FLAG_FULLSCREEN)
+		variant |= Pipeline::VARIANT_NO_SHADOW|Pipeline::VARIANT_NO_BORDER;
+	return variant;
+}
+
+bool CompositorInterface::IsInstanced(const ClientFrame *pclientFrame) const{
+	//any variant of the frame shaders, the instanced shaders select the features per window
+	return instancedRendering && pclientFrame->ptexture->textureIndex != ~0u &&
+		std::equal(pframePipeline->pshaderModule,pframePipeline->pshaderModule+Pipeline::SHADER_MODULE_COUNT,pclientFrame->passignedSet->p->pshaderModule);
+}
+
+void CompositorInterface::RecordInstancedRenderQueue(const VkCommandBuffer *pcommandBuffer){
+	InstanceBuffer &instanceBuffer = pinstanceBuffers[currentFrame];
+
+	struct InstanceRun{
+		uint renderQueueIndex; //first render object of the run
+		uint first, count; //instances
+	};
+	std::vector<InstanceRun> runs;
 
-	//for(RenderObject &renderObject : renderQueue){
+	uint instanceCount = 0;
 	for(uint i = 0; i < renderQueue.size(); ++i){
 		RenderObject &renderObject = renderQueue[i];
+		renderObject.pclientFrame->passignedSet->fenceTag = frameTag;
+		if(!IsInstanced(renderObject.pclientFrame) || instanceCount >= INSTANCE_COUNT)
+			continue;
 
 		VkRect2D frame;
 		frame.offset = {renderObject.pclient->rect.x,renderObject.pclient->rect.y};
 		frame.extent = {renderObject.pclient->rect.w,renderObject.pclient->rect.h};
 
-		/*VkRect2D scissor = frame;
-		for(uint j = i+1; j < renderQueue.size(); ++j){
-			RenderObject &renderObject1 = renderQueue[j];
-
-			if(frame.offset.y >= renderObject1.pclient->rect.y-1 &&
-				frame.offset.y+frame.extent.height <= renderObject1.pclient->rect.y+renderObject1.pclient->rect.h+1){
-				if(scissor.offset.x+scissor.extent.width > renderObject1.pclient->rect.x &&
-					scissor.offset.x < renderObject1.pclient->rect.x)
-					scissor.extent.width = renderObject1.pclient->rect.x-scissor.offset.x;
-
-				if(renderObject1.pclient->rect.x+renderObject1.pclient->rect.w > scissor.offset.x &&
-					renderObject1.pclient->rect.x < scissor.offset.x){
-					sint oldOffset = scissor.offset.x;
-					scissor.offset.x = renderObject1.pclient->rect.x+renderObject1.pclient->rect.w;
-					scissor.extent.width -= scissor.offset.x-oldOffset;
-				}
-			}
+		Instance &instance = instanceBuffer.pinstances[instanceCount];
+		instance.frameVec = GetFrameVector(frame);
+		instance.borderWidth = renderObject.pclient->pcontainer->borderWidth;
+		instance.flags = renderObject.flags;
+		instance.time = timespec_diff(frameTime,renderObject.pclientFrame->creationTime);
+		instance.textureIndex = renderObject.pclientFrame->ptexture->textureIndex;
+		instance.maskOrigin = pframeMaskAtlas->textureIndex != ~0u?renderObject.pclientFrame->maskOrigin:FRAME_MASK_NONE;
+		instance.variant = GetVariant(renderObject); //selected in the shader, no pipeline switch needed
+
+		if(runs.size() == 0 || runs.back().renderQueueIndex+runs.back().count != i)
+			runs.push_back((InstanceRun){i,instanceCount,0});
+		runs.back().count++;
+		++instanceCount;
+	}
+
+	VkDescriptorSet descSets[] = {instanceBuffer.descSet,textureTable};
+
+	struct{
+		glm::vec2 imageExtent;
+		uint instanceOffset;
+		uint frameMaskIndex;
+	} pushConstants;
+	pushConstants.imageExtent = glm::vec2(imageExtent.width,imageExtent.height);
+	pushConstants.frameMaskIndex = pframeMaskAtlas->textureIndex;
+
+	uint drawCount = 0;
+	for(uint i = 0, runIndex = 0; i < renderQueue.size();){
+		if(runIndex < runs.size() && runs[runIndex].renderQueueIndex == i){
+			InstanceRun &run = runs[runIndex++];
+			vkCmdBindPipeline(*pcommandBuffer,VK_PIPELINE_BIND_POINT_GRAPHICS,pinstancedPipeline->pipeline);
+			vkCmdBindDescriptorSets(*pcommandBuffer,VK_PIPELINE_BIND_POINT_GRAPHICS,pinstancedPipeline->pipelineLayout,0,2,descSets,0,0);
+
+			pushConstants.instanceOffset = run.first;
+			vkCmdPushConstants(*pcommandBuffer,pinstancedPipeline->pipelineLayout,pinstancedPipeline->pushConstantStages,0,sizeof(pushConstants),&pushConstants);
+
+			vkCmdDraw(*pcommandBuffer,18,run.count,0,0); //shadow, border and content quads of each window
+			i += run.count;
+			++drawCount;
+			continue;
 		}
-		//TODO: need five scissors, one for the content and 4 for the thin borders around it
-		glm::ivec2 borderWidth = 2*glm::ivec2(
-			renderObject.pclient->pcontainer->borderWidth.x*(float)imageExtent.width,
-			renderObject.pclient->pcontainer->borderWidth.x*(float)imageExtent.width); //due to aspect, this must be *width
-		scissor.offset.x = std::max(scissor.offset.x-borderWidth.x,0);
-		scissor.extent.width += 2*borderWidth.x;
-		scissor.offset.y = std::max(scissor.offset.y-borderWidth.y,0);
-		scissor.extent.height += 2*borderWidth.y;*/
 
-		vkCmdBindPipeline(pcommandBuffers[currentFrame],VK_PIPELINE_BIND_POINT_GRAPHICS,renderObject.pclientFrame->passignedSet->p->pipeline);
+		//custom shaders, textures without a table slot or out of instances
+		RenderObject &renderObject = renderQueue[i++];
+		renderObject.pclientFrame->ValidateDescSets();
 
-		//vkCmdSetScissor(pcommandBuffers[currentFrame],0,1,&scissor);
-		renderObject.pclientFrame->Draw(frame,renderObject.pclient->pcontainer->borderWidth,renderObject.flags,&pcommandBuffers[currentFrame]);
+		VkRect2D frame;
+		frame.offset = {renderObject.pclient->rect.x,renderObject.pclient->rect.y};
+		frame.extent = {renderObject.pclient->rect.w,renderObject.pclient->rect.h};
+
+		vkCmdBindPipeline(*pcommandBuffer,VK_PIPELINE_BIND_POINT_GRAPHICS,renderObject.pclientFrame->passignedSet->p->pipeline);
+		renderObject.pclientFrame->Draw(frame,renderObject.pclient->pcontainer->borderWidth,renderObject.flags,pcommandBuffer);
+		++drawCount;
 	}
 
+	frameTimings[frameTag%FRAME_TIMING_COUNT].drawCount += drawCount;
+}
+
+void CompositorInterface::GenerateCommandBuffers(const WManager::Container *proot, const std::vector<std::pair<const WManager::Client *, WManager::Client *>> *pstackAppendix, const WManager::Container *pfocus){
+	if(!proot)
+		return;
+	Tracer::Scope traceScope("GenerateCommandBuffers");
+
+	//switch the frames to their requested pipelines once compiled
+	pipelineWaitQueue.erase(std::remove_if(pipelineWaitQueue.begin(),pipelineWaitQueue.end(),[&](ClientFrame *pclientFrame)->bool{
+		return pclientFrame->ValidatePipeline();
+	}),pipelineWaitQueue.end());
+	frameTimings[frameTag%FRAME_TIMING_COUNT].pipelineWaitCount = pipelineWaitQueue.size();
+	pipelineWaitCount += pipelineWaitQueue.size();
+	
+	//Create a render list elements arranged from back to front
+	uint64 renderQueueBeginTime = Profiler::GetTime();
+	renderQueue.clear();
+	appendixQueue.clear();
+	for(auto &p : *pstackAppendix){
+		if(p.first){
+			appendixQueue.push_back(p);
+			continue;
+		}
+		//desktop features are placed first
+		RenderObject renderObject;
+		renderObject.pclient = p.second;
+		renderObject.pclientFrame = dynamic_cast<ClientFrame *>(p.second);
+		renderObject.flags = renderObject.pclient->pcontainer == pfocus?0x1:0;
+		renderQueue.push_back(renderObject);
+	}
+
+	CreateRenderQueue(proot,pfocus);
+	for(auto &p : appendixQueue){ //push the remaining (untransient) windows to the end of the queue
+		RenderObject renderObject;
+		renderObject.pclient = p.second;
+		renderObject.pclientFrame = dynamic_cast<ClientFrame *>(p.second);
+		renderObject.flags = renderObject.pclient->pcontainer == pfocus?0x1:0;
+		renderQueue.push_back(renderObject);
+	}
+	Profiler::Add(Profiler::PHASE_RENDER_QUEUE,renderQueueBeginTime);
+
+	//deque of scissors, pop_front
+	VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	commandBufferBeginInfo.flags = 0;
+	if(vkBeginCommandBuffer(pcopyCommandBuffers[currentFrame],&commandBufferBeginInfo) != VK_SUCCESS)
+		throw Exception("Failed to begin command buffer recording.");
+	if(asyncTransfer && vkBeginCommandBuffer(ptransferCommandBuffers[currentFrame],&commandBufferBeginInfo) != VK_SUCCESS)
+		throw Exception("Failed to begin transfer command buffer recording.");
+	if(gpuTiming){
+		vkCmdResetQueryPool(pcopyCommandBuffers[currentFrame],timestampPool,currentFrame*TIMESTAMP_QUERY_COUNT,TIMESTAMP_QUERY_COUNT);
+		vkCmdWriteTimestamp(pcopyCommandBuffers[currentFrame],VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,timestampPool,GetTimestampQuery(TIMESTAMP_PASS_COPY));
+	}
+	
+	auto UpdateContents = [&](ClientFrame *pclientFrame)->void{
+		Tracer::Scope traceScope("UpdateContents");
+		if(pclientFrame->damageTime != 0)
+			latencyQueue.push_back(pclientFrame);
+		if(pclientFrame->surfaceAdjustPending)
+			pclientFrame->ApplySurfaceAdjustment();
+		Texture *ptexture = pclientFrame->ptexture;
+		uint64 textureUploadByteCount = ptexture->uploadByteCount;
+		if(!ptexture->RequiresOwnershipTransfer())
+			pclientFrame->UpdateContents(&pcopyCommandBuffers[currentFrame]);
+		else{
+			pclientFrame->UpdateContents(&ptransferCommandBuffers[currentFrame]);
+			if(!pclientFrame->ptexture->RequiresOwnershipTransfer()) //upload was recorded and the image released
+				acquireQueue.push_back(pclientFrame->ptexture);
+		}
+		frameTimings[frameTag%FRAME_TIMING_COUNT].uploadByteCount += ptexture->uploadByteCount-textureUploadByteCount;
+		uploadByteCount += ptexture->uploadByteCount-textureUploadByteCount;
+	};
+
+	if(pbackground)
+		UpdateContents(pbackground);
+
+	for(ClientFrame *pclientFrame : updateQueue)
+		UpdateContents(pclientFrame);
+	updateQueue.clear();
+
+	for(Texture *ptexture : acquireQueue)
+		ptexture->AcquireOwnership(&pcopyCommandBuffers[currentFrame]);
+
+	//New mask tiles are uploaded along with the window contents, before they are drawn
+	for(RenderObject &renderObject : renderQueue){
+		renderObject.pclientFrame->ValidateFrameMask((VkExtent2D){renderObject.pclient->rect.w,renderObject.pclient->rect.h},renderObject.pclient->pcontainer->borderWidth);
+		renderObject.flags |= debugFlags;
+	}
+	frameTimings[frameTag%FRAME_TIMING_COUNT].maskUploadCount = frameMaskUploads.size();
+	if(frameMaskUploads.size() > 0){
+		pframeMaskAtlas->Unmap(&pcopyCommandBuffers[currentFrame],frameMaskUploads.data(),frameMaskUploads.size());
+		frameMaskUploads.clear();
+		pframeMaskData = 0;
+	}
+
+	if(gpuTiming)
+		vkCmdWriteTimestamp(pcopyCommandBuffers[currentFrame],VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,timestampPool,GetTimestampQuery(TIMESTAMP_PASS_COPY)+1);
+	if(vkEndCommandBuffer(pcopyCommandBuffers[currentFrame]) != VK_SUCCESS)
+		throw Exception("Failed to end command buffer recording.");
+	if(asyncTransfer && vkEndCommandBuffer(ptransferCommandBuffers[currentFrame]) != VK_SUCCESS)
+		throw Exception("Failed to end transfer command buffer recording.");
+
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	uint64 commandBeginTime = Profiler::GetTime();
+	if(vkBeginCommandBuffer(pcommandBuffers[currentFrame],&commandBufferBeginInfo) != VK_SUCCESS)
+		throw Exception("Failed to begin command buffer recording.");
+	if(gpuTiming)
+		vkCmdWriteTimestamp(pcommandBuffers[currentFrame],VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,timestampPool,GetTimestampQuery(TIMESTAMP_PASS_RENDER));
+
+	//the debug heatmaps accumulate on black
+	static const VkClearValue clearValue[] = {{1.0f,1.0f,1.0f,1.0f},{0.0f,0.0f,0.0f,1.0f}};
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = renderPass;
+	renderPassBeginInfo.framebuffer = pframebuffers[imageIndex];
+	renderPassBeginInfo.renderArea.offset = {0,0};
+	renderPassBeginInfo.renderArea.extent = imageExtent;
+	renderPassBeginInfo.clearValueCount = 1;
+	renderPassBeginInfo.pClearValues = &clearValue[debugMode != DEBUG_MODE_NONE?1:0];
+	clock_gettime(CLOCK_MONOTONIC,&frameTime);
+
+	if(instancedRendering){
+		//with only a few draws in total, everything is recorded directly into the primary buffer
+		vkCmdBeginRenderPass(pcommandBuffers[currentFrame],&renderPassBeginInfo,VK_SUBPASS_CONTENTS_INLINE);
+
+		if(pbackground){
+			VkRect2D frame;
+			frame.offset = {0,0};
+			frame.extent = imageExtent;
+
+			pbackground->passignedSet->fenceTag = frameTag;
+			pbackground->ValidateDescSets();
+			vkCmdBindPipeline(pcommandBuffers[currentFrame],VK_PIPELINE_BIND_POINT_GRAPHICS,pbackground->passignedSet->p->pipeline);
+			pbackground->Draw(frame,glm::vec2(0.0f),debugFlags,&pcommandBuffers[currentFrame]);
+			frameTimings[frameTag%FRAME_TIMING_COUNT].drawCount = 1;
+		}
+
+		RecordInstancedRenderQueue(&pcommandBuffers[currentFrame]);
+
+		vkCmdEndRenderPass(pcommandBuffers[currentFrame]);
+		if(gpuTiming){
+			vkCmdWriteTimestamp(pcommandBuffers[currentFrame],VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,timestampPool,GetTimestampQuery(TIMESTAMP_PASS_RENDER)+1);
+			CollectTimedDraws();
+		}
+
+		if(vkEndCommandBuffer(pcommandBuffers[currentFrame]) != VK_SUCCESS)
+			throw Exception("Failed to end command buffer recording.");
+		Profiler::Add(Profiler::PHASE_RECORD,commandBeginTime);
+		return;
+	}
+
+	vkCmdBeginRenderPass(pcommandBuffers[currentFrame],&renderPassBeginInfo,VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	//draw commands of each frame are cached in its secondary command buffers
+	secondaryCommandBuffers.clear();
+
+	if(pbackground){
+		VkRect2D frame;
+		frame.offset = {0,0};
+		frame.extent = imageExtent;
+
+		pbackground->ValidateDescSets();
+		if(pbackground->UpdateCommandBuffer(frame,glm::vec2(0.0f),debugFlags,&secondaryCommandBuffers.emplace_back()))
+			frameTimings[frameTag%FRAME_TIMING_COUNT].recordCount++;
+	}
+
+	//Descriptor pools are shared, so the sets are allocated before the threads are started. Frames
+	//without borders or focus, and fullscreen ones, are switched to the cheaper shader variants here as well.
+	for(RenderObject &renderObject : renderQueue){
+		renderObject.pclientFrame->SelectVariant(GetVariant(renderObject));
+		renderObject.pclientFrame->ValidateDescSets();
+	}
+
+	//The render queue is split into contiguous ranges, recorded in parallel. Each frame has its own
+	//command pool, so no synchronization is needed as long as every frame appears once in the queue.
+	uint offset = secondaryCommandBuffers.size();
+	secondaryCommandBuffers.resize(offset+renderQueue.size());
+
+	struct timespec recordBeginTime, recordEndTime;
+	clock_gettime(CLOCK_MONOTONIC,&recordBeginTime);
+
+	uint rangeCount = std::max(std::min((uint)renderThreads.size()+1,(uint)renderQueue.size()/RENDER_RANGE_MIN_SIZE),1u);
+	for(uint i = 0; i < renderRanges.size(); ++i){
+		if(i < rangeCount){
+			renderRanges[i].begin = renderQueue.size()*i/rangeCount;
+			renderRanges[i].end = renderQueue.size()*(i+1)/rangeCount;
+		}else renderRanges[i].begin = renderRanges[i].end = 0; //idle thread
+		renderRanges[i].offset = offset;
+		renderRanges[i].pexception = nullptr;
+	}
+
+	if(rangeCount > 1){
+		std::unique_lock<std::mutex> lock(renderMutex);
+		renderPending = renderThreads.size();
+		renderGeneration++;
+		lock.unlock();
+		renderCond.notify_all();
+	}
+
+	RecordRenderRange(&renderRanges[0]);
+
+	if(rangeCount > 1){
+		std::unique_lock<std::mutex> lock(renderMutex);
+		renderDoneCond.wait(lock,[&]()->bool{
+			return renderPending == 0;
+		});
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&recordEndTime);
+
+	FrameTiming &frameTiming = frameTimings[frameTag%FRAME_TIMING_COUNT];
+	frameTiming.recordTime = timespec_diff(recordEndTime,recordBeginTime);
+	recordStats.Add(frameTiming.recordTime*1e3f);
+	for(uint i = 0; i < rangeCount; ++i){
+		if(renderRanges[i].pexception)
+			std::rethrow_exception(renderRanges[i].pexception);
+		frameTiming.recordCount += renderRanges[i].recordCount;
+	}
+
+	if(secondaryCommandBuffers.size() > 0)
+		vkCmdExecuteCommands(pcommandBuffers[currentFrame],secondaryCommandBuffers.size(),secondaryCommandBuffers.data());
+	frameTimings[frameTag%FRAME_TIMING_COUNT].drawCount = secondaryCommandBuffers.size();
+
 	vkCmdEndRenderPass(pcommandBuffers[currentFrame]);
+	if(gpuTiming){
+		vkCmdWriteTimestamp(pcommandBuffers[currentFrame],VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,timestampPool,GetTimestampQuery(TIMESTAMP_PASS_RENDER)+1);
+		CollectTimedDraws();
+	}
 
 	if(vkEndCommandBuffer(pcommandBuffers[currentFrame]) != VK_SUCCESS)
 		throw Exception("Failed to end command buffer recording.");
+	Profiler::Add(Profiler::PHASE_RECORD,commandBeginTime);
 }
 
 void CompositorInterface::Present(){
-	uint imageIndex;
-	if(vkAcquireNextImageKHR(logicalDev,swapChain,std::numeric_limits<uint64_t>::max(),psemaphore[currentFrame][SEMAPHORE_INDEX_IMAGE_AVAILABLE],0,&imageIndex) != VK_SUCCESS)
-		throw Exception("Failed to acquire a swap chain image.\n");
-	//
-	VkPipelineStageFlags pipelineStageFlags[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+	VkPipelineStageFlags pipelineStageFlags[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT};
 	//VkPipelineStageFlags pipelineStageFlags[] = {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT};
-	
+	VkSemaphore waitSemaphores[] = {psemaphore[currentFrame][SEMAPHORE_INDEX_IMAGE_AVAILABLE],psemaphore[currentFrame][SEMAPHORE_INDEX_UPLOAD_FINISHED]};
+	uint waitSemaphoreCount = 1;
+	uint semaphoreOffset = offscreen?1:0; //no image acquired nor presented offscreen
+
+	uint64 submitBeginTime = Profiler::GetTime();
+	if(acquireQueue.size() > 0){
+		//new textures uploaded on the transfer queue, sampled once the upload semaphore has been signaled
+		VkSubmitInfo transferSubmitInfo = {};
+		transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		transferSubmitInfo.commandBufferCount = 1;
+		transferSubmitInfo.pCommandBuffers = &ptransferCommandBuffers[currentFrame];
+		transferSubmitInfo.signalSemaphoreCount = 1;
+		transferSubmitInfo.pSignalSemaphores = &psemaphore[currentFrame][SEMAPHORE_INDEX_UPLOAD_FINISHED];
+		if(vkQueueSubmit(queue[QUEUE_INDEX_TRANSFER],1,&transferSubmitInfo,0) != VK_SUCCESS)
+			throw Exception("Failed to submit a transfer queue.");
+
+		waitSemaphoreCount = 2;
+		acquireQueue.clear();
+	}
+
+	//copy and render work of the frame in a single batch, signaling the frame timeline on completion
+	VkCommandBuffer commandBuffers[] = {pcopyCommandBuffers[currentFrame],pcommandBuffers[currentFrame]};
+	VkSemaphore signalSemaphores[] = {prenderFinishedSemaphores[imageIndex],frameTimeline};
+	uint64 signalValues[] = {0,frameTag+1}; //binary semaphore value ignored
+
+	VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+	timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineSubmitInfo.signalSemaphoreValueCount = sizeof(signalValues)/sizeof(signalValues[0])-semaphoreOffset;
+	timelineSubmitInfo.pSignalSemaphoreValues = signalValues+semaphoreOffset;
+
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &pcopyCommandBuffers[currentFrame];
+	submitInfo.pNext = &timelineSubmitInfo;
+	submitInfo.waitSemaphoreCount = waitSemaphoreCount-semaphoreOffset;
+	submitInfo.pWaitSemaphores = waitSemaphores+semaphoreOffset;
+	submitInfo.pWaitDstStageMask = pipelineStageFlags+semaphoreOffset;
+	submitInfo.commandBufferCount = sizeof(commandBuffers)/sizeof(commandBuffers[0]);
+	submitInfo.pCommandBuffers = commandBuffers;
+	submitInfo.signalSemaphoreCount = sizeof(signalSemaphores)/sizeof(signalSemaphores[0])-semaphoreOffset;
+	submitInfo.pSignalSemaphores = signalSemaphores+semaphoreOffset;
 	if(vkQueueSubmit(queue[QUEUE_INDEX_GRAPHICS],1,&submitInfo,0) != VK_SUCCESS)
 		throw Exception("Failed to submit a queue.");
+	Profiler::Add(Profiler::PHASE_SUBMIT,submitBeginTime);
 
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &psemaphore[currentFrame][SEMAPHORE_INDEX_IMAGE_AVAILABLE];
-	submitInfo.pWaitDstStageMask = pipelineStageFlags;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &psemaphore[currentFrame][SEMAPHORE_INDEX_RENDER_FINISHED];
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &pcommandBuffers[currentFrame];
-	if(vkQueueSubmit(queue[QUEUE_INDEX_GRAPHICS],1,&submitInfo,pfence[currentFrame]) != VK_SUCCESS)
-		throw Exception("Failed to submit a queue.");
+	uint64 submitTime = Profiler::GetTime();
+	for(ClientFrame *pclientFrame : latencyQueue){
+		pclientFrame->damageLatency[ClientFrame::DAMAGE_LATENCY_SUBMIT].Add((float)(submitTime-pclientFrame->damageTime)*1e-6f);
+		damageLatency[ClientFrame::DAMAGE_LATENCY_SUBMIT].Add((float)(submitTime-pclientFrame->damageTime)*1e-6f);
+	}
+
+	FrameTiming &frameTiming = frameTimings[frameTag%FRAME_TIMING_COUNT];
+	clock_gettime(CLOCK_MONOTONIC,&frameTiming.submitTime);
 	
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &psemaphore[currentFrame][SEMAPHORE_INDEX_RENDER_FINISHED];
+	presentInfo.pWaitSemaphores = &prenderFinishedSemaphores[imageIndex];
 	presentInfo.swapchainCount = 1;
 	presentInfo.pSwapchains = &swapChain;
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = 0;
-	vkQueuePresentKHR(queue[QUEUE_INDEX_PRESENT],&presentInfo);
+	uint64 presentBeginTime = Profiler::GetTime();
+	if(!offscreen)
+		vkQueuePresentKHR(queue[QUEUE_INDEX_PRESENT],&presentInfo);
+	Profiler::Add(Profiler::PHASE_PRESENT,presentBeginTime);
+
+	//present queued, the actual scanout time is not known
+	uint64 presentTime = Profiler::GetTime();
+	for(ClientFrame *pclientFrame : latencyQueue){
+		pclientFrame->damageLatency[ClientFrame::DAMAGE_LATENCY_PRESENT].Add((float)(presentTime-pclientFrame->damageTime)*1e-6f);
+		damageLatency[ClientFrame::DAMAGE_LATENCY_PRESENT].Add((float)(presentTime-pclientFrame->damageTime)*1e-6f);
+		pclientFrame->damageTime = 0;
+	}
+	latencyQueue.clear();
+
+	clock_gettime(CLOCK_MONOTONIC,&frameTiming.presentTime);
+
+	if(frameTag == 0)
+		DebugPrintf(stdout,"First frame presented %.3f s after startup (%s pipeline cache).\n",timespec_diff(frameTiming.presentTime,initTime),pipelineCacheLoaded?"warm":"cold");
 
-	currentFrame = (currentFrame+1)%swapChainImageCount;
+	imageAcquired = false;
+	currentFrame = (currentFrame+1)%frameCount;
 
 	frameTag++;
 }
 
-Pipeline * CompositorInterface::LoadPipeline(const char *pshaderName[Pipeline::SHADER_MODULE_COUNT]){
-	auto m = std::find_if(pipelines.begin(),pipelines.end(),[&](auto &r)->bool{
-		for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i)
-			if(strcmp(r.pshaderModule[i]->pname,pshaderName[i]) != 0)
-				return false;
+bool CompositorInterface::PipelineKey::operator==(const PipelineKey &key) const{
+	return std::equal(pshaderModule,pshaderModule+Pipeline::SHADER_MODULE_COUNT,key.pshaderModule) && stateKey == key.stateKey;
+}
+
+size_t CompositorInterface::PipelineKeyHash::operator()(const PipelineKey &key) const{
+	//shader names are interned, so the modules can be identified by their addresses
+	size_t h = std::hash<uint>()(key.stateKey);
+	for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i)
+		h = h*31+std::hash<const ShaderModule *>()(key.pshaderModule[i]);
+	return h;
+}
+
+uint CompositorInterface::AssignTimestampIndex(){
+	if(!gpuTiming || timestampIndexFreeList.size() == 0)
+		return ~0u;
+	uint index = timestampIndexFreeList.back();
+	timestampIndexFreeList.pop_back();
+	return index;
+}
+
+void CompositorInterface::FreeTimestampIndex(uint index){
+	//Frames still in flight may write the queries, but they get reset before the next use. The
+	//result of a frame destroyed in between is attributed to its pipeline as usual.
+	if(index != ~0u)
+		timestampIndexFreeList.push_back(index);
+}
+
+uint CompositorInterface::GetTimestampQuery(uint index) const{
+	//first query of the pair in the current frame slot
+	return currentFrame*TIMESTAMP_QUERY_COUNT+2*index;
+}
+
+void CompositorInterface::CollectTimedDraws(){
+	//the draws that will write their queries during the frame, with the pipelines they were recorded with
+	std::vector<TimedDraw> &timedDraws = ptimedDraws[currentFrame];
+	timedDraws.clear();
+	if(pbackground && pbackground->timestampIndex != ~0u && pbackground->passignedSet)
+		timedDraws.push_back(TimedDraw{pbackground->timestampIndex,0});
+	for(RenderObject &renderObject : renderQueue)
+		if(renderObject.pclientFrame->timestampIndex != ~0u && renderObject.pclientFrame->passignedSet)
+			timedDraws.push_back(TimedDraw{renderObject.pclientFrame->timestampIndex,renderObject.pclientFrame->passignedSet->p});
+	ptimedFrameTags[currentFrame] = frameTag;
+}
+
+void CompositorInterface::ReadTimestamps(){
+	//The frame that last used the slot has completed, so the results are available without waiting.
+	//Draws that didn't write their queries (instanced windows) are left unavailable.
+	if(ptimedFrameTags[currentFrame] == ~0ull)
+		return;
+	ptimedFrameTags[currentFrame] = ~0ull;
+
+	VkResult result = vkGetQueryPoolResults(logicalDev,timestampPool,currentFrame*TIMESTAMP_QUERY_COUNT,TIMESTAMP_QUERY_COUNT,2*TIMESTAMP_QUERY_COUNT*sizeof(uint64),ptimestampResults,2*sizeof(uint64),VK_QUERY_RESULT_64_BIT|VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	if(result != VK_SUCCESS && result != VK_NOT_READY)
+		return;
+
+	auto GetElapsed = [&](uint index, float *pt)->bool{
+		const uint64 *pbegin = ptimestampResults+4*index, *pend = pbegin+2;
+		if(!pbegin[1] || !pend[1])
+			return false;
+		*pt = (float)((pend[0]-pbegin[0])&timestampMask)*timestampPeriod*1e-6f;
 		return true;
-	});
-	Pipeline *pPipeline;
-	if(m != pipelines.end())
-		pPipeline = &(*m);
-	else{
-		ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT];
-		for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i){
-			auto n = std::find_if(shaders.begin(),shaders.end(),[&](auto &r)->bool{
-				return strcmp(r.pname,pshaderName[i]) == 0;
-			});
-			if(n == shaders.end()){
-				snprintf(Exception::buffer,sizeof(Exception::buffer),"Shader not found: %s.",pshaderName[i]);
-				throw Exception();
+	};
+
+	float t;
+	if(GetElapsed(TIMESTAMP_PASS_COPY,&t))
+		passStats[TIMESTAMP_PASS_COPY].Add(t);
+	if(GetElapsed(TIMESTAMP_PASS_RENDER,&t))
+		passStats[TIMESTAMP_PASS_RENDER].Add(t);
+	for(TimedDraw &timedDraw : ptimedDraws[currentFrame]){
+		if(!GetElapsed(timedDraw.timestampIndex,&t))
+			continue;
+		if(timedDraw.p)
+			pipelineStats[timedDraw.p].Add(t);
+		else backgroundStats.Add(t);
+	}
+	ptimedDraws[currentFrame].clear();
+}
+
+//in TIMESTAMP_PASS order
+static const char *ppassName[] = {"copy","render"};
+
+//labeled by the fragment shader and the variant
+static std::string GetPipelineLabel(const Pipeline *p){
+	const ShaderModule *pfragmentShader = p->pshaderModule[Pipeline::SHADER_MODULE_FRAGMENT];
+	char label[256];
+	snprintf(label,sizeof(label),"%s/%x",pfragmentShader?pfragmentShader->pname:"-",p->stateKey);
+	return label;
+}
+
+//GPU time statistics of the passes, the background and each pipeline, labeled. Empty without gpuTiming.
+void CompositorInterface::GetTimingStats(std::vector<std::pair<std::string, const TimingStats *>> &stats) const{
+	if(!gpuTiming)
+		return;
+	for(uint i = 0; i < TIMESTAMP_PASS_COUNT; ++i)
+		stats.emplace_back(ppassName[i],&passStats[i]);
+	stats.emplace_back("background",&backgroundStats);
+	for(auto &m : pipelineStats)
+		stats.emplace_back(GetPipelineLabel(m.first),&m.second);
+}
+
+//Pipeline::compileTime of the compiled pipelines in milliseconds, labeled
+void CompositorInterface::GetCompileTimes(std::vector<std::pair<std::string, float>> &compileTimes) const{
+	for(const Pipeline &pipeline : pipelines)
+		if(pipeline.state == Pipeline::STATE_READY) //compileTime is written before the state
+			compileTimes.emplace_back(GetPipelineLabel(&pipeline),1e3f*pipeline.compileTime);
+}
+
+uint64 CompositorInterface::GetPipelineWaitCount() const{
+	return pipelineWaitCount;
+}
+
+void CompositorInterface::PrintTimingStats(FILE *pf) const{
+	std::vector<std::pair<std::string, const TimingStats *>> stats;
+	GetTimingStats(stats);
+	fprintf(pf,"GPU time (ms)                  mean      p50      p99  samples\n");
+	for(auto &m : stats)
+		fprintf(pf,"%-28s %8.3f %8.3f %8.3f %8u\n",m.first.c_str(),m.second->GetMean(),m.second->GetPercentile(0.5f),m.second->GetPercentile(0.99f),m.second->GetCount());
+}
+
+void CompositorInterface::PrintLatencyStats(FILE *pf) const{
+	//The render queue may refer to clients destroyed since the last frame, only the live frames are listed
+	fprintf(pf,"Damage latency (ms)     submit mean      p50      p99  present mean      p50      p99  samples\n");
+	for(const ClientFrame *pclientFrame : clientFrames){
+		const TimingStats *pstats = pclientFrame->damageLatency;
+		if(pstats[ClientFrame::DAMAGE_LATENCY_PRESENT].GetCount() == 0)
+			continue;
+		const Backend::X11Client *pclient11 = dynamic_cast<const Backend::X11Client *>(pclientFrame);
+		fprintf(pf,"%-20x",pclient11?pclient11->window:0);
+		for(uint i = 0; i < ClientFrame::DAMAGE_LATENCY_COUNT; ++i)
+			fprintf(pf," %12.3f %8.3f %8.3f",pstats[i].GetMean(),pstats[i].GetPercentile(0.5f),pstats[i].GetPercentile(0.99f));
+		fprintf(pf," %8u\n",pstats[ClientFrame::DAMAGE_LATENCY_PRESENT].GetCount());
+	}
+	fflush(pf);
+}
+
+void CompositorInterface::WriteStatsJSON(FILE *pf) const{
+	static const char *platencyName[ClientFrame::DAMAGE_LATENCY_COUNT] = {"submit","present"};
+	fprintf(pf,"{\"framesPresented\": %llu, \"uploadBytes\": %llu, \"damageLatencyMs\": {",frameTag,uploadByteCount);
+	for(uint i = 0; i < ClientFrame::DAMAGE_LATENCY_COUNT; ++i){
+		fprintf(pf,"%s\"%s\": ",i > 0?", ":"",platencyName[i]);
+		damageLatency[i].WriteJSON(pf);
+	}
+	fprintf(pf,"}, \"releaseQueueDepth\": %zu, \"releaseQueueMaxDepth\": %u, \"pipelineWaitCount\": %llu, \"recordTimeMs\": ",releaseQueue.size(),releaseQueueMaxDepth,pipelineWaitCount);
+	recordStats.WriteJSON(pf);
+	std::vector<std::pair<std::string, float>> compileTimes;
+	GetCompileTimes(compileTimes);
+	fprintf(pf,", \"compileTimeMs\": {");
+	for(uint i = 0; i < compileTimes.size(); ++i)
+		fprintf(pf,"%s\"%s\": %.3f",i > 0?", ":"",compileTimes[i].first.c_str(),compileTimes[i].second);
+	fprintf(pf,"}");
+	if(gpuTiming){
+		std::vector<std::pair<std::string, const TimingStats *>> stats;
+		GetTimingStats(stats);
+		fprintf(pf,", \"gpuTimeMs\": {");
+		for(uint i = 0; i < stats.size(); ++i){
+			fprintf(pf,"%s\"%s\": ",i > 0?", ":"",stats[i].first.c_str());
+			stats[i].second->WriteJSON(pf);
+		}
+		fprintf(pf,"}");
+	}
+	fprintf(pf,"}");
+}
+
+uint CompositorInterface::GetReleaseQueueDepth() const{
+	return releaseQueue.size();
+}
+
+uint CompositorInterface::GetReleaseQueueMaxDepth() const{
+	return releaseQueueMaxDepth;
+}
+
+void CompositorInterface::SetDebugMode(uint mode){
+	if(mode >= DEBUG_MODE_COUNT)
+		return; //validated by the configuration
+	static const uint flags[DEBUG_MODE_COUNT] = {0,0x100,0x200};
+	debugMode = mode;
+	debugFlags = flags[mode];
+}
+
+bool CompositorInterface::FrameMaskKey::operator==(const FrameMaskKey &key) const{
+	return borderWidth[0] == key.borderWidth[0] && borderWidth[1] == key.borderWidth[1] &&
+		sizeBucket[0] == key.sizeBucket[0] && sizeBucket[1] == key.sizeBucket[1] && screenWidth == key.screenWidth;
+}
+
+size_t CompositorInterface::FrameMaskKeyHash::operator()(const FrameMaskKey &key) const{
+	size_t h = std::hash<uint>()(key.screenWidth);
+	for(uint i = 0; i < 2; ++i)
+		h = (h*31+std::hash<uint>()(key.borderWidth[i]))*31+std::hash<uint>()(key.sizeBucket[i]);
+	return h;
+}
+
+uint CompositorInterface::LookupFrameMask(const VkExtent2D &extent, const glm::vec2 &borderWidth){
+	//the border is scaled by the screen width on both axes (see frame.hlsl)
+	FrameMaskKey key;
+	key.borderWidth[0] = (uint)(borderWidth.x*(float)imageExtent.width+0.5f);
+	key.borderWidth[1] = (uint)(borderWidth.y*(float)imageExtent.width+0.5f);
+	key.sizeBucket[0] = extent.width/FRAME_MASK_SIZE_BUCKET;
+	key.sizeBucket[1] = extent.height/FRAME_MASK_SIZE_BUCKET;
+	key.screenWidth = imageExtent.width;
+
+	//the corner has to fit in a cell, and small windows would overlap their own corners
+	if(FRAME_MASK_INSET+4*std::max(key.borderWidth[0],key.borderWidth[1]) > FRAME_MASK_CELL_SIZE ||
+		extent.width < 2*FRAME_MASK_INSET || extent.height < 2*FRAME_MASK_INSET)
+		return FRAME_MASK_NONE;
+
+	auto m = frameMaskTable.find(key);
+	if(m != frameMaskTable.end()){
+		frameMaskList.splice(frameMaskList.begin(),frameMaskList,(*m).second);
+		(*m).second->useTag = frameTag;
+	}else{
+		uint cell;
+		if(frameMaskFreeList.size() > 0){
+			cell = frameMaskFreeList.back();
+			frameMaskFreeList.pop_back();
+		}else{
+			//replace the least recently used tile, unless it may still be read by a frame in flight
+			if(frameMaskList.back().useTag >= frameCompletionTag)
+				return FRAME_MASK_NONE;
+			cell = frameMaskList.back().cell;
+			frameMaskTable.erase(frameMaskList.back().key);
+			frameMaskList.pop_back();
+		}
+		GenerateFrameMask(key,cell);
+
+		FrameMask frameMask;
+		frameMask.key = key;
+		frameMask.cell = cell;
+		frameMask.useTag = frameTag;
+		frameMaskList.push_front(frameMask);
+		m = frameMaskTable.emplace(key,frameMaskList.begin()).first;
+	}
+
+	uint cell = (*m).second->cell;
+	uint x = (cell%(FRAME_MASK_ATLAS_SIZE/FRAME_MASK_CELL_SIZE))*FRAME_MASK_CELL_SIZE;
+	uint y = (cell/(FRAME_MASK_ATLAS_SIZE/FRAME_MASK_CELL_SIZE))*FRAME_MASK_CELL_SIZE;
+	return x|(y<<16);
+}
+
+void CompositorInterface::GenerateFrameMask(const FrameMaskKey &key, uint cell){
+	//Evaluates the shadow and border distance functions of frame.hlsl for the corner of a window at
+	//the center of the size bucket. Texel (x,y) is at x+0.5 pixels from the inner edge of the corner.
+	if(!pframeMaskData)
+		pframeMaskData = (unsigned char *)pframeMaskAtlas->Map();
+
+	glm::vec2 d1 = (glm::vec2(key.sizeBucket[0],key.sizeBucket[1])+0.5f)*(float)FRAME_MASK_SIZE_BUCKET;
+	glm::vec2 e = 0.5f*d1;
+	float constScaling = (float)key.screenWidth/(d1.x+2.0f*(float)key.borderWidth[0]);
+	float s = 1.0f+0.015f*constScaling;
+
+	VkRect2D &rect = frameMaskUploads.emplace_back();
+	rect.offset.x = (cell%(FRAME_MASK_ATLAS_SIZE/FRAME_MASK_CELL_SIZE))*FRAME_MASK_CELL_SIZE;
+	rect.offset.y = (cell/(FRAME_MASK_ATLAS_SIZE/FRAME_MASK_CELL_SIZE))*FRAME_MASK_CELL_SIZE;
+	rect.extent = {FRAME_MASK_CELL_SIZE,FRAME_MASK_CELL_SIZE};
+
+	for(uint y = 0; y < FRAME_MASK_CELL_SIZE; ++y){
+		unsigned char *prow = pframeMaskData+4*(FRAME_MASK_ATLAS_SIZE*(rect.offset.y+y)+rect.offset.x);
+		for(uint x = 0; x < FRAME_MASK_CELL_SIZE; ++x){
+			glm::vec2 q = glm::vec2(x,y)+0.5f+e-(float)FRAME_MASK_INSET;
+
+			//shadow, cut out below the window
+			float shadow = 0.0f;
+			if(glm::length(glm::max(q-(e-40.0f),0.0f))-40.0f >= 0.0f){
+				float d = (glm::length(glm::max(q/s-(e-50.0f),0.0f))-75.0f)*1.015f;
+				shadow = 0.9f*glm::clamp(-d/30.0f,0.0f,1.0f);
 			}
-			pshader[i] = &(*n);
+			//border, between the outer and inner rounded boxes
+			bool border = glm::length(glm::max(q-(e-50.0f),0.0f))-75.0f <= 0.0f && glm::length(glm::max(q-(e-42.0f),0.0f))-40.0f >= 0.0f;
+
+			//the image view swaps red and blue, green and alpha are used
+			prow[4*x+0] = 0;
+			prow[4*x+1] = border?255:0;
+			prow[4*x+2] = 0;
+			prow[4*x+3] = (unsigned char)(255.0f*shadow+0.5f);
+		}
+	}
+}
+
+ShaderModule * CompositorInterface::FindShader(const char *pname) const{
+	auto m = shaderTable.find(pname);
+	return m != shaderTable.end()?(*m).second:0;
+}
+
+void CompositorInterface::FindShaders(const char *pshaderName[Pipeline::SHADER_MODULE_COUNT], ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT]) const{
+	//null shader name: stage not used
+	for(uint i = 0; i < Pipeline::SHADER_MODULE_COUNT; ++i){
+		if(!pshaderName[i]){
+			pshader[i] = 0;
+			continue;
+		}
+		pshader[i] = FindShader(pshaderName[i]);
+		if(!pshader[i]){
+			snprintf(Exception::buffer,sizeof(Exception::buffer),"Shader not found: %s.",pshaderName[i]);
+			throw Exception();
 		}
-		pipelines.reserve(pipelines.size());
-		pPipeline = &pipelines.emplace_back(
-			pshader[Pipeline::SHADER_MODULE_VERTEX],
-			pshader[Pipeline::SHADER_MODULE_GEOMETRY],
-			pshader[Pipeline::SHADER_MODULE_FRAGMENT],this);
 	}
+}
+
+Pipeline * CompositorInterface::FindPipeline(ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT], uint stateKey) const{
+	PipelineKey key;
+	std::copy(pshader,pshader+Pipeline::SHADER_MODULE_COUNT,key.pshaderModule);
+	key.stateKey = stateKey;
+	auto m = pipelineTable.find(key);
+	return m != pipelineTable.end()?(*m).second:0;
+}
+
+Pipeline * CompositorInterface::CreatePipeline(ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT], uint stateKey){
+	//creates the layout, the pipeline itself gets compiled separately
+	Pipeline *pPipeline = &pipelines.emplace_back(
+		pshader[Pipeline::SHADER_MODULE_VERTEX],
+		pshader[Pipeline::SHADER_MODULE_GEOMETRY],
+		pshader[Pipeline::SHADER_MODULE_FRAGMENT],stateKey,this);
+
+	PipelineKey key;
+	std::copy(pshader,pshader+Pipeline::SHADER_MODULE_COUNT,key.pshaderModule);
+	key.stateKey = stateKey;
+	pipelineTable.emplace(key,pPipeline);
+
 	return pPipeline;
 }
 
+Pipeline * CompositorInterface::LoadPipeline(const char *pshaderName[Pipeline::SHADER_MODULE_COUNT], uint stateKey){
+	Pipeline *pPipeline = LoadPipelineAsync(pshaderName,stateKey);
+	if(pPipeline->state == Pipeline::STATE_QUEUED){
+		//not prebuilt, stall until compiled
+		std::unique_lock<std::mutex> lock(compileMutex);
+		auto m = std::find(compileQueue.begin(),compileQueue.end(),pPipeline);
+		if(m != compileQueue.end()){
+			compileQueue.erase(m);
+			compileQueue.push_front(pPipeline);
+		}
+		compileDoneCond.wait(lock,[&]()->bool{
+			return pPipeline->state != Pipeline::STATE_QUEUED;
+		});
+	}
+	if(pPipeline->state == Pipeline::STATE_FAILED)
+		throw Exception("Failed to create a graphics pipeline.");
+	return pPipeline;
+}
+
+Pipeline * CompositorInterface::LoadPipelineAsync(const char *pshaderName[Pipeline::SHADER_MODULE_COUNT], uint stateKey){
+	ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT];
+	FindShaders(pshaderName,pshader);
+
+	return LoadPipelineAsync(pshader,stateKey);
+}
+
+Pipeline * CompositorInterface::LoadPipelineAsync(ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT], uint stateKey){
+	Pipeline *pPipeline = FindPipeline(pshader,stateKey);
+	if(!pPipeline)
+		pPipeline = CreatePipeline(pshader,stateKey);
+	if(pPipeline->state == Pipeline::STATE_UNCOMPILED){
+		std::unique_lock<std::mutex> lock(compileMutex);
+		pPipeline->state = Pipeline::STATE_QUEUED;
+		compileQueue.push_back(pPipeline);
+		lock.unlock();
+		compileCond.notify_one();
+	}
+	return pPipeline;
+}
+
+void CompositorInterface::CompileThreadProc(){
+	std::unique_lock<std::mutex> lock(compileMutex);
+	for(;;){
+		compileCond.wait(lock,[&]()->bool{
+			return compileQueue.size() > 0 || compileThreadExit;
+		});
+		if(compileThreadExit)
+			break;
+		Pipeline *pPipeline = compileQueue.front();
+		compileQueue.pop_front();
+		lock.unlock();
+
+		try{
+			pPipeline->Compile();
+			DebugPrintf(stdout,"Pipeline compiled in %.3f ms.\n",1e3f*pPipeline->compileTime);
+		}catch(Exception e){
+			DebugPrintf(stderr,"%s\n",e.what());
+		}
+
+		lock.lock();
+		compileDoneCond.notify_all();
+	}
+}
+
+void CompositorInterface::PrebuildPipelines(){
+	//Known combinations are identified by the shader names: <name>_vertex.spv, <name>_fragment.spv
+	//and optionally <name>_geometry.spv.
+	std::vector<Pipeline *> prebuildQueue;
+	for(ShaderModule &shader : shaders){
+		const char *psuffix = strstr(shader.pname,"_vertex.spv");
+		if(!psuffix || strcmp(psuffix,"_vertex.spv") != 0)
+			continue;
+		std::string prefix(shader.pname,psuffix-shader.pname);
+		ShaderModule *pshader[Pipeline::SHADER_MODULE_COUNT] = {
+			&shader,FindShader((prefix+"_geometry.spv").c_str()),FindShader((prefix+"_fragment.spv").c_str())
+		};
+		if(!pshader[Pipeline::SHADER_MODULE_FRAGMENT])
+			continue;
+
+		try{
+			Pipeline *pPipeline = FindPipeline(pshader,0);
+			if(!pPipeline)
+				pPipeline = CreatePipeline(pshader,0);
+			if(pPipeline->state == Pipeline::STATE_UNCOMPILED)
+				prebuildQueue.push_back(pPipeline);
+		}catch(Exception e){
+			DebugPrintf(stderr,"%s (prebuild: %s)\n",e.what(),prefix.c_str());
+		}
+	}
+
+	struct timespec prebuildBeginTime, prebuildEndTime;
+	clock_gettime(CLOCK_MONOTONIC,&prebuildBeginTime);
+
+	//The pipeline cache is internally synchronized, so the pipelines can be compiled in parallel.
+	//Failed ones are left uncompiled, and queued again once first used.
+	std::atomic<uint> next(0);
+	auto CompileProc = [&]()->void{
+		for(uint i; (i = next++) < prebuildQueue.size();){
+			try{
+				prebuildQueue[i]->Compile();
+			}catch(Exception e){
+				DebugPrintf(stderr,"Prebuild failed: %s Retrying on first use.\n",e.what());
+				prebuildQueue[i]->state = Pipeline::STATE_UNCOMPILED;
+			}
+		}
+	};
+	uint threadCount = std::min(std::max(std::thread::hardware_concurrency(),1u),(uint)prebuildQueue.size());
+	std::vector<std::thread> prebuildThreads;
+	for(uint i = 1; i < threadCount; ++i)
+		prebuildThreads.emplace_back(CompileProc);
+	CompileProc();
+	for(std::thread &thread : prebuildThreads)
+		thread.join();
+
+	clock_gettime(CLOCK_MONOTONIC,&prebuildEndTime);
+	DebugPrintf(stdout,"Prebuilt %u pipelines in %.3f s on %u threads.\n",(uint)prebuildQueue.size(),timespec_diff(prebuildEndTime,prebuildBeginTime),std::max(threadCount,1u));
+
+	if(prebuildQueue.size() > 0)
+		SavePipelineCache();
+}
+
+std::string CompositorInterface::GetPipelineCachePath() const{
+	const char *pcacheHome = getenv("XDG_CACHE_HOME");
+	if(pcacheHome && pcacheHome[0] == '/')
+		return std::string(pcacheHome)+"/chamfer";
+	const char *phome = getenv("HOME");
+	if(!phome)
+		return std::string();
+	return std::string(phome)+"/.cache/chamfer";
+}
+
+void CompositorInterface::LoadPipelineCache(){
+	std::vector<char> data;
+
+	std::string path = GetPipelineCachePath();
+	FILE *pf = path.empty()?0:fopen((path+"/pipeline_cache.bin").c_str(),"rb");
+	if(pf){
+		//the cache is discarded if it's from another version or device
+		PipelineCacheHeader header;
+		if(fread(&header,1,sizeof(header),pf) == sizeof(header) &&
+			header.magic == PIPELINE_CACHE_MAGIC && header.version == PIPELINE_CACHE_VERSION &&
+			header.vendorID == physicalDevProps.vendorID && header.deviceID == physicalDevProps.deviceID &&
+			memcmp(header.pipelineCacheUUID,physicalDevProps.pipelineCacheUUID,VK_UUID_SIZE) == 0){
+			data.resize(header.dataSize);
+			if(fread(data.data(),1,data.size(),pf) != data.size())
+				data.clear();
+		}
+		fclose(pf);
+	}
+
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	pipelineCacheCreateInfo.initialDataSize = data.size();
+	pipelineCacheCreateInfo.pInitialData = data.size() > 0?data.data():0;
+	if(vkCreatePipelineCache(logicalDev,&pipelineCacheCreateInfo,0,&pipelineCache) != VK_SUCCESS){
+		//the data may still be rejected, start with an empty cache
+		pipelineCacheCreateInfo.initialDataSize = 0;
+		pipelineCacheCreateInfo.pInitialData = 0;
+		data.clear();
+		if(vkCreatePipelineCache(logicalDev,&pipelineCacheCreateInfo,0,&pipelineCache) != VK_SUCCESS)
+			throw Exception("Failed to create a pipeline cache.");
+	}
+	pipelineCacheLoaded = data.size() > 0;
+	DebugPrintf(stdout,"Pipeline cache: %s (%zu bytes)\n",pipelineCacheLoaded?"loaded":"empty",data.size());
+}
+
+void CompositorInterface::SavePipelineCache(){
+	std::string path = GetPipelineCachePath();
+	if(path.empty())
+		return;
+
+	size_t dataSize;
+	if(vkGetPipelineCacheData(logicalDev,pipelineCache,&dataSize,0) != VK_SUCCESS)
+		return;
+	std::vector<char> data(dataSize);
+	if(vkGetPipelineCacheData(logicalDev,pipelineCache,&dataSize,data.data()) != VK_SUCCESS)
+		return;
+
+	for(size_t i = path.find('/',1); ; i = path.find('/',i+1)){
+		mkdir(path.substr(0,i).c_str(),0700); //existing directories fail silently
+		if(i == std::string::npos)
+			break;
+	}
+
+	PipelineCacheHeader header;
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.version = PIPELINE_CACHE_VERSION;
+	header.vendorID = physicalDevProps.vendorID;
+	header.deviceID = physicalDevProps.deviceID;
+	memcpy(header.pipelineCacheUUID,physicalDevProps.pipelineCacheUUID,VK_UUID_SIZE);
+	header.dataSize = dataSize;
+
+	//written to a temporary file first, so that an interrupted write won't leave a truncated cache
+	std::string tmpPath = path+"/pipeline_cache.bin.tmp";
+	FILE *pf = fopen(tmpPath.c_str(),"wb");
+	if(!pf){
+		DebugPrintf(stderr,"Unable to write the pipeline cache to %s.\n",path.c_str());
+		return;
+	}
+	bool result = fwrite(&header,1,sizeof(header),pf) == sizeof(header) && fwrite(data.data(),1,dataSize,pf) == dataSize;
+	if(fclose(pf) != 0 || !result || rename(tmpPath.c_str(),(path+"/pipeline_cache.bin").c_str()) != 0){
+		remove(tmpPath.c_str());
+		DebugPrintf(stderr,"Unable to write the pipeline cache to %s.\n",path.c_str());
+	}
+}
+
 Texture * CompositorInterface::CreateTexture(uint w, uint h){
 	Texture *ptexture;
 
@@ -909,22 +2408,63 @@ Texture * CompositorInterface::CreateTexture(uint w, uint h){
 	if(m != textureCache.end()){
 		ptexture = (*m).ptexture;
 
-		std::iter_swap(m,textureCache.end()-1);
-		textureCache.pop_back();
-		printf("----------- found cached texture\n");
+		textureCache.erase(m); //keep the release order
+		DebugLog("Found cached texture %ux%u\n",w,h);
 
-	}else ptexture = new Texture(w,h,VK_FORMAT_R8G8B8A8_UNORM,this);
+	}else{
+		ptexture = new Texture(w,h,VK_FORMAT_R8G8B8A8_UNORM,this);
+		if(descriptorIndexing)
+			AssignTextureIndex(ptexture);
+	}
 
 	return ptexture;
 }
 
+void CompositorInterface::AssignTextureIndex(Texture *ptexture){
+	if(textureIndexFreeList.size() > 0){
+		ptexture->textureIndex = textureIndexFreeList.back();
+		textureIndexFreeList.pop_back();
+	}else
+	if(textureIndexCount < TEXTURE_TABLE_SIZE)
+		ptexture->textureIndex = textureIndexCount++;
+	else return; //table full, the texture can only be drawn through per-frame sets
+
+	VkDescriptorImageInfo descImageInfo = {};
+	descImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	descImageInfo.imageView = ptexture->imageView;
+	descImageInfo.sampler = pointSampler;
+
+	VkWriteDescriptorSet writeDescSet = {};
+	writeDescSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescSet.dstSet = textureTable;
+	writeDescSet.dstBinding = 0;
+	writeDescSet.dstArrayElement = ptexture->textureIndex;
+	writeDescSet.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	writeDescSet.descriptorCount = 1;
+	writeDescSet.pImageInfo = &descImageInfo;
+	vkUpdateDescriptorSets(logicalDev,1,&writeDescSet,0,0);
+}
+
+void CompositorInterface::FreeTextureIndex(Texture *ptexture){
+	//called once the texture is no longer referenced by any frame in flight
+	if(ptexture->textureIndex == ~0u)
+		return;
+	textureIndexFreeList.push_back(ptexture->textureIndex);
+	ptexture->textureIndex = ~0u;
+}
+
 void CompositorInterface::ReleaseTexture(Texture *ptexture){
-	TextureCacheEntry textureCacheEntry;
-	textureCacheEntry.ptexture = ptexture;
-	textureCacheEntry.releaseTag = frameTag;
-	clock_gettime(CLOCK_MONOTONIC,&textureCacheEntry.releaseTime);
-	
-	textureCache.push_back(textureCacheEntry); //->emplace_back
+	ReleaseEntry releaseEntry;
+	releaseEntry.type = ReleaseEntry::TYPE_TEXTURE;
+	releaseEntry.ptexture = ptexture;
+	ReleaseObject(releaseEntry);
+}
+
+void CompositorInterface::ReleaseCommandPool(VkCommandPool commandPool){
+	ReleaseEntry releaseEntry;
+	releaseEntry.type = ReleaseEntry::TYPE_COMMAND_POOL;
+	releaseEntry.commandPool = commandPool;
+	ReleaseObject(releaseEntry);
 }
 
 VkDescriptorSet * CompositorInterface::CreateDescSets(const ShaderModule *pshaderModule){
@@ -937,7 +2477,7 @@ VkDescriptorSet * CompositorInterface::CreateDescSets(const ShaderModule *pshade
 		descSetAllocateInfo.pSetLayouts = pshaderModule->pdescSetLayouts;
 		descSetAllocateInfo.descriptorSetCount = pshaderModule->setCount;
 		if(vkAllocateDescriptorSets(logicalDev,&descSetAllocateInfo,pdescSets) == VK_SUCCESS){
-			descPoolReference.push_back(std::pair<VkDescriptorSet *, VkDescriptorPool>(pdescSets,descPool));
+			descPoolReference.emplace(pdescSets,descPool);
 			return pdescSets;
 		}
 	}
@@ -945,11 +2485,11 @@ VkDescriptorSet * CompositorInterface::CreateDescSets(const ShaderModule *pshade
 	VkDescriptorPoolSize descPoolSizes[2];
 	descPoolSizes[0] = (VkDescriptorPoolSize){};
 	descPoolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLER;//VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descPoolSizes[0].descriptorCount = 16;
+	descPoolSizes[0].descriptorCount = DESC_POOL_SET_COUNT;
 
 	descPoolSizes[1] = (VkDescriptorPoolSize){};
 	descPoolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	descPoolSizes[1].descriptorCount = 16;
+	descPoolSizes[1].descriptorCount = DESC_POOL_SET_COUNT;
 
 	VkDescriptorPool descPool;
 
@@ -958,7 +2498,7 @@ VkDescriptorSet * CompositorInterface::CreateDescSets(const ShaderModule *pshade
 	descPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	descPoolCreateInfo.poolSizeCount = sizeof(descPoolSizes)/sizeof(descPoolSizes[0]);
 	descPoolCreateInfo.pPoolSizes = descPoolSizes;
-	descPoolCreateInfo.maxSets = 16;
+	descPoolCreateInfo.maxSets = DESC_POOL_SET_COUNT;
 	descPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
 	if(vkCreateDescriptorPool(logicalDev,&descPoolCreateInfo,0,&descPool) != VK_SUCCESS){
 		delete []pdescSets;
@@ -972,7 +2512,7 @@ VkDescriptorSet * CompositorInterface::CreateDescSets(const ShaderModule *pshade
 	descSetAllocateInfo.pSetLayouts = pshaderModule->pdescSetLayouts;
 	descSetAllocateInfo.descriptorSetCount = pshaderModule->setCount;
 	if(vkAllocateDescriptorSets(logicalDev,&descSetAllocateInfo,pdescSets) == VK_SUCCESS){
-		descPoolReference.push_back(std::pair<VkDescriptorSet *, VkDescriptorPool>(pdescSets,descPool));
+		descPoolReference.emplace(pdescSets,descPool);
 		return pdescSets;
 	}
 
@@ -981,12 +2521,11 @@ VkDescriptorSet * CompositorInterface::CreateDescSets(const ShaderModule *pshade
 }
 
 void CompositorInterface::ReleaseDescSets(const ShaderModule *pshaderModule, VkDescriptorSet *pdescSets){
-	DescSetCacheEntry descSetCacheEntry;
-	descSetCacheEntry.pdescSets = pdescSets;
-	descSetCacheEntry.setCount = pshaderModule->setCount;
-	descSetCacheEntry.releaseTag = frameTag;
-
-	descSetCache.push_back(descSetCacheEntry);
+	ReleaseEntry releaseEntry;
+	releaseEntry.type = ReleaseEntry::TYPE_DESC_SETS;
+	releaseEntry.descSets.pdescSets = pdescSets;
+	releaseEntry.descSets.setCount = pshaderModule->setCount;
+	ReleaseObject(releaseEntry);
 }
 
 VKAPI_ATTR VkBool32 VKAPI_CALL CompositorInterface::ValidationLayerDebugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t obj, size_t location, int32_t code, const char *playerPrefix, const char *pmsg, void *puserData){
@@ -1019,13 +2558,36 @@ X11ClientFrame::~X11ClientFrame(){
 void X11ClientFrame::UpdateContents(const VkCommandBuffer *pcommandBuffer){
 	if(!fullRegionUpdate && damageRegions.size() == 0)
 		return;
+
+	if(pbackend->peventLog && pbackend->peventLog->mode == Backend::EventLog::MODE_REPLAY){
+		//The windows of the recording don't exist, and fetching their pixmaps would only wait for
+		//errors. The damaged regions are filled with a flat color, so that the uploads are still made.
+		unsigned char *pdata = (unsigned char *)ptexture->Map();
+		if(fullRegionUpdate){
+			memset(pdata,0x80,rect.w*rect.h*4);
+			fullRegionUpdate = false;
+
+			VkRect2D rect1 = {0,0,rect.w,rect.h};
+			ptexture->Unmap(pcommandBuffer,&rect1,1);
+
+		}else{
+			for(VkRect2D &rect1 : damageRegions)
+				for(uint y = rect1.offset.y, Y = y+rect1.extent.height; y < Y; ++y)
+					memset(pdata+4*(rect.w*y+rect1.offset.x),0x80,4*rect1.extent.width);
+			ptexture->Unmap(pcommandBuffer,damageRegions.data(),damageRegions.size());
+		}
+		damageRegions.clear();
+		return;
+	}
 	
 	/*struct timespec t1;
 	clock_gettime(CLOCK_MONOTONIC,&t1);*/
 
 	//TODO: can we acquire only the damaged regions?
+	uint64 fetchBeginTime = Profiler::GetTime();
 	xcb_get_image_cookie_t imageCookie = xcb_get_image_unchecked(pbackend->pcon,XCB_IMAGE_FORMAT_Z_PIXMAP,windowPixmap,0,0,rect.w,rect.h,~0);
 	xcb_get_image_reply_t *pimageReply = xcb_get_image_reply(pbackend->pcon,imageCookie,0);
+	Profiler::Add(Profiler::PHASE_IMAGE_FETCH,fetchBeginTime);
 	if(!pimageReply){
 		DebugPrintf(stderr,"Failed to receive image reply.\n");
 		return;
@@ -1038,6 +2600,7 @@ void X11ClientFrame::UpdateContents(const VkCommandBuffer *pcommandBuffer){
 	//http://doc.qt.io/qt-5/qimage.html
 	//argb can be swizzled (image view)
 
+	Profiler::Scope profilerScope(Profiler::PHASE_PIXEL_COPY);
 	unsigned char *pchpixels = xcb_get_image_data(pimageReply);
 	if(fullRegionUpdate){
 		{
@@ -1054,9 +2617,9 @@ void X11ClientFrame::UpdateContents(const VkCommandBuffer *pcommandBuffer){
 		}
 
 	}else{
-		for(VkRect2D &rect1 : damageRegions){
-			unsigned char *pdata = (unsigned char *)ptexture->Map();
+		unsigned char *pdata = (unsigned char *)ptexture->Map();
 
+		for(VkRect2D &rect1 : damageRegions){
 			for(uint y = rect1.offset.y, Y = y+rect1.extent.height; y < Y; ++y){
 				uint offset = 4*(rect.w*y+rect1.offset.x);
 				memcpy(pdata+offset,pchpixels+offset,4*rect1.extent.width);
@@ -1064,9 +2627,9 @@ void X11ClientFrame::UpdateContents(const VkCommandBuffer *pcommandBuffer){
 					for(uint i = 0; i < rect1.extent.width; ++i)
 						pdata[offset+4*i+3] = 255;
 			}
-
-			ptexture->Unmap(pcommandBuffer,damageRegions.data(),damageRegions.size());
 		}
+
+		ptexture->Unmap(pcommandBuffer,damageRegions.data(),damageRegions.size());
 	}
 
 	/*struct timespec t3;
@@ -1101,13 +2664,16 @@ void X11Background::UpdateContents(const VkCommandBuffer *pcommandBuffer){
 	if(!fullRegionUpdate)
 		return;
 	//
+	uint64 fetchBeginTime = Profiler::GetTime();
 	xcb_get_image_cookie_t imageCookie = xcb_get_image_unchecked(pcomp11->pbackend->pcon,XCB_IMAGE_FORMAT_Z_PIXMAP,pixmap,0,0,w,h,~0);
 	xcb_get_image_reply_t *pimageReply = xcb_get_image_reply(pcomp11->pbackend->pcon,imageCookie,0);
+	Profiler::Add(Profiler::PHASE_IMAGE_FETCH,fetchBeginTime);
 	if(!pimageReply){
 		DebugPrintf(stderr,"Failed to receive image reply.\n");
 		return;
 	}
 
+	Profiler::Scope profilerScope(Profiler::PHASE_PIXEL_COPY);
 	unsigned char *pchpixels = xcb_get_image_data(pimageReply);
 	unsigned char *pdata = (unsigned char *)ptexture->Map();
 
@@ -1123,7 +2689,7 @@ void X11Background::UpdateContents(const VkCommandBuffer *pcommandBuffer){
 	free(pimageReply);
 }
 
-X11Compositor::X11Compositor(uint physicalDevIndex, const Backend::X11Backend *_pbackend) : CompositorInterface(physicalDevIndex), pbackend(_pbackend){//, pbackground(0){
+X11Compositor::X11Compositor(const Configuration *pconfig, const Backend::X11Backend *_pbackend) : CompositorInterface(pconfig), pbackend(_pbackend){//, pbackground(0){
 	//
 }
 
@@ -1222,6 +2788,8 @@ bool X11Compositor::FilterEvent(const Backend::X11Event *pevent){
 		X11ClientFrame *pclientFrame = dynamic_cast<X11ClientFrame *>(pclient);
 		if(std::find(updateQueue.begin(),updateQueue.end(),pclientFrame) == updateQueue.end())
 			updateQueue.push_back(pclientFrame);
+		if(pclientFrame->damageTime == 0)
+			pclientFrame->damageTime = Profiler::GetTime();
 
 		VkRect2D rect;
 		rect.offset = {pev->area.x,pev->area.y};
@@ -1266,7 +2834,7 @@ void X11Compositor::SetBackgroundPixmap(const Backend::BackendPixmapProperty *pP
 			"default_vertex.spv","default_geometry.spv","default_fragment.spv"
 		};
 		pbackground = new X11Background(pPixmapProperty->pixmap,pgeometryReply->width,pgeometryReply->height,pshaderName,this);
-		printf("background set!\n");
+		DebugLog("background set!\n");
 	}
 }
 
@@ -1280,7 +2848,7 @@ VkExtent2D X11Compositor::GetExtent() const{
 	return e;
 }
 
-X11DebugClientFrame::X11DebugClientFrame(WManager::Container *pcontainer, const Backend::DebugClient::CreateInfo *_pcreateInfo, const char *_pshaderName[Pipeline::SHADER_MODULE_COUNT], CompositorInterface *_pcomp) : DebugClient(pcontainer,_pcreateInfo), ClientFrame(rect.w,rect.h,_pshaderName,_pcomp){
+X11DebugClientFrame::X11DebugClientFrame(WManager::Container *pcontainer, const Backend::DebugClient::CreateInfo *_pcreateInfo, const char *_pshaderName[Pipeline::SHADER_MODULE_COUNT], CompositorInterface *_pcomp) : DebugClient(pcontainer,_pcreateInfo), ClientFrame(rect.w,rect.h,_pshaderName,_pcomp), damagePattern(DAMAGE_PATTERN_NONE), damageIndex(0){
 	//
 }
 
@@ -1289,7 +2857,53 @@ X11DebugClientFrame::~X11DebugClientFrame(){
 }
 
 void X11DebugClientFrame::UpdateContents(const VkCommandBuffer *pcommandBuffer){
-	//
+	Profiler::Scope profilerScope(Profiler::PHASE_PIXEL_COPY);
+	if(damagePattern != DAMAGE_PATTERN_NONE && !fullRegionUpdate){
+		//synthetic load: generate the damaged region only, and upload nothing else
+		uint stride = ptexture->w;
+		VkRect2D rect1;
+		switch(damagePattern){
+		case DAMAGE_PATTERN_VIDEO:
+			rect1.offset = {0,0};
+			rect1.extent = {rect.w,rect.h};
+			break;
+		case DAMAGE_PATTERN_SCROLL:
+			rect1.offset = {0,std::max(rect.h-64,0)};
+			rect1.extent = {rect.w,std::min(rect.h,64)};
+			break;
+		case DAMAGE_PATTERN_BLINK:
+			rect1.offset = {std::min(16,rect.w-1),std::max(rect.h-32,0)};
+			rect1.extent = {std::min(8,rect.w-rect1.offset.x),std::min(16,rect.h-rect1.offset.y)};
+			break;
+		default:
+			return;
+		}
+		unsigned char *pdata = (unsigned char*)ptexture->Map();
+		for(uint y = rect1.offset.y; y < rect1.offset.y+rect1.extent.height; ++y)
+			for(uint x = rect1.offset.x; x < rect1.offset.x+rect1.extent.width; ++x){
+				unsigned char *ppixel = pdata+4*(y*stride+x);
+				switch(damagePattern){
+				case DAMAGE_PATTERN_VIDEO:
+					ppixel[0] = x+4*damageIndex;
+					ppixel[1] = y+2*damageIndex;
+					ppixel[2] = (x^y)+damageIndex;
+					break;
+				case DAMAGE_PATTERN_SCROLL:{
+					//text-like rows, moving up one line per damage
+					uint line = y/16+damageIndex;
+					bool glyph = (line*2654435761u>>(x/8%24))&0x1 && y%16 < 12;
+					ppixel[0] = ppixel[1] = ppixel[2] = glyph?220:40;
+					}
+					break;
+				case DAMAGE_PATTERN_BLINK:
+					ppixel[0] = ppixel[1] = ppixel[2] = damageIndex&0x1?220:40;
+					break;
+				}
+				ppixel[3] = 255;
+			}
+		ptexture->Unmap(pcommandBuffer,&rect1,1);
+		return;
+	}
 	uint color[3];
 	for(uint &t : color)
 		//t = rand()%255;
@@ -1306,6 +2920,7 @@ void X11DebugClientFrame::UpdateContents(const VkCommandBuffer *pcommandBuffer){
 	rect1.offset = {0,0};
 	rect1.extent = {rect.w,rect.h};
 	ptexture->Unmap(pcommandBuffer,&rect1,1);
+	fullRegionUpdate = false;
 }
 
 void X11DebugClientFrame::AdjustSurface1(){
@@ -1313,7 +2928,7 @@ void X11DebugClientFrame::AdjustSurface1(){
 	AdjustSurface(rect.w,rect.h);
 }
 
-X11DebugCompositor::X11DebugCompositor(uint physicalDevIndex, const Backend::X11Backend *pbackend) : X11Compositor(physicalDevIndex,pbackend){
+X11DebugCompositor::X11DebugCompositor(const Configuration *pconfig, const Backend::X11Backend *pbackend) : X11Compositor(pconfig,pbackend){
 	//
 }
 
@@ -1331,7 +2946,224 @@ void X11DebugCompositor::Stop(){
 	DestroyRenderEngine();
 }
 
-NullCompositor::NullCompositor() : CompositorInterface(0){
+void X11DebugCompositor::Damage(X11DebugClientFrame *pclientFrame){
+	pclientFrame->damageIndex++;
+	if(std::find(updateQueue.begin(),updateQueue.end(),pclientFrame) == updateQueue.end())
+		updateQueue.push_back(pclientFrame);
+	if(pclientFrame->damageTime == 0)
+		pclientFrame->damageTime = Profiler::GetTime();
+}
+
+static WManager::Rectangle GetHeadlessRect(const WManager::Container *pcontainer, uint w, uint h){
+	glm::vec4 screen(w,h,w,h);
+	glm::vec2 aspect = glm::vec2(1.0,screen.x/screen.y);
+	glm::vec4 coord = glm::vec4(pcontainer->p+pcontainer->borderWidth*aspect,pcontainer->e-2.0f*pcontainer->borderWidth*aspect)*screen;
+	return (WManager::Rectangle){coord.x,coord.y,std::max((sint)coord.z,1),std::max((sint)coord.w,1)};
+}
+
+HeadlessClientFrame::HeadlessClientFrame(WManager::Container *pcontainer, const char *_pshaderName[Pipeline::SHADER_MODULE_COUNT], HeadlessCompositor *_pcomp) : Client(pcontainer), ClientFrame(GetHeadlessRect(pcontainer,_pcomp->w,_pcomp->h).w,GetHeadlessRect(pcontainer,_pcomp->w,_pcomp->h).h,_pshaderName,_pcomp), pcompHeadless(_pcomp), contentIndex(0){
+	rect = GetHeadlessRect(pcontainer,pcompHeadless->w,pcompHeadless->h);
+}
+
+HeadlessClientFrame::~HeadlessClientFrame(){
+	//
+}
+
+void HeadlessClientFrame::UpdateTranslation(){
+	WManager::Rectangle rect1 = GetHeadlessRect(pcontainer,pcompHeadless->w,pcompHeadless->h);
+	bool resize = rect1.w != rect.w || rect1.h != rect.h;
+	rect = rect1;
+	if(resize)
+		AdjustSurface(rect.w,rect.h);
+}
+
+void HeadlessClientFrame::UpdateContents(const VkCommandBuffer *pcommandBuffer){
+	Profiler::Scope profilerScope(Profiler::PHASE_PIXEL_COPY);
+	//Deterministic contents so that the rendered frames can be compared: a checkerboard tinted
+	//by the window position and the number of damages so far.
+	unsigned char color[3] = {
+		(unsigned char)(7*rect.x+53*contentIndex),
+		(unsigned char)(11*rect.y+97*contentIndex),
+		(unsigned char)(rect.w+rect.h+31*contentIndex)
+	};
+	unsigned char *pdata = (unsigned char*)ptexture->Map();
+	for(sint y = 0; y < rect.h; ++y)
+		for(sint x = 0; x < rect.w; ++x){
+			uint i = 4*(y*rect.w+x);
+			unsigned char t = ((x>>4)^(y>>4))&0x1?0x40:0x0;
+			pdata[i+0] = color[0]^t;
+			pdata[i+1] = color[1]^t;
+			pdata[i+2] = color[2]^t;
+			pdata[i+3] = 255;
+		}
+	VkRect2D rect1;
+	rect1.offset = {0,0};
+	rect1.extent = {rect.w,rect.h};
+	ptexture->Unmap(pcommandBuffer,&rect1,1);
+}
+
+HeadlessCompositor::HeadlessCompositor(const Configuration *pconfig, uint _w, uint _h) : CompositorInterface(pconfig), w(_w), h(_h){
+	offscreen = true;
+}
+
+HeadlessCompositor::~HeadlessCompositor(){
+	//
+}
+
+void HeadlessCompositor::Start(){
+	InitializeRenderEngine();
+}
+
+void HeadlessCompositor::Stop(){
+	DestroyRenderEngine();
+}
+
+void HeadlessCompositor::Damage(HeadlessClientFrame *pclientFrame){
+	pclientFrame->contentIndex++;
+	if(std::find(updateQueue.begin(),updateQueue.end(),pclientFrame) == updateQueue.end())
+		updateQueue.push_back(pclientFrame);
+	if(pclientFrame->damageTime == 0)
+		pclientFrame->damageTime = Profiler::GetTime();
+}
+
+void HeadlessCompositor::ReadFrame(unsigned char *pdst){
+	//Copy the most recently submitted image to a host visible buffer. Stalls until the GPU
+	//is idle, so this is not meant to be called while measuring the frame times.
+	if(frameTag == 0)
+		throw Exception("No frame rendered yet.");
+	uint index = (currentFrame+frameCount-1)%frameCount;
+	VkDeviceSize size = 4*(VkDeviceSize)w*h;
+
+	VkBuffer buffer = 0;
+	VkDeviceMemory bufferMemory = 0;
+	VkCommandBuffer commandBuffer = 0;
+	//the readback resources are released on the error paths as well
+	auto Release = [&]()->void{
+		if(commandBuffer)
+			vkFreeCommandBuffers(logicalDev,commandPool,1,&commandBuffer);
+		vkDestroyBuffer(logicalDev,buffer,0);
+		vkFreeMemory(logicalDev,bufferMemory,0);
+	};
+
+	try{
+		VkBufferCreateInfo bufferCreateInfo = {};
+		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferCreateInfo.size = size;
+		bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if(vkCreateBuffer(logicalDev,&bufferCreateInfo,0,&buffer) != VK_SUCCESS){
+			buffer = 0;
+			throw Exception("Failed to create a readback buffer.");
+		}
+
+		VkMemoryRequirements memoryRequirements;
+		vkGetBufferMemoryRequirements(logicalDev,buffer,&memoryRequirements);
+
+		VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProps;
+		vkGetPhysicalDeviceMemoryProperties(physicalDev,&physicalDeviceMemoryProps);
+
+		VkMemoryAllocateInfo memoryAllocateInfo = {};
+		memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		memoryAllocateInfo.allocationSize = memoryRequirements.size;
+		for(memoryAllocateInfo.memoryTypeIndex = 0; memoryAllocateInfo.memoryTypeIndex < physicalDeviceMemoryProps.memoryTypeCount; memoryAllocateInfo.memoryTypeIndex++){
+			if(memoryRequirements.memoryTypeBits & (1<<memoryAllocateInfo.memoryTypeIndex) && (physicalDeviceMemoryProps.memoryTypes[memoryAllocateInfo.memoryTypeIndex].propertyFlags & (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) == (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+				break;
+		}
+		if(memoryAllocateInfo.memoryTypeIndex >= physicalDeviceMemoryProps.memoryTypeCount)
+			throw Exception("No host visible and coherent memory type for the readback buffer.");
+
+		if(vkAllocateMemory(logicalDev,&memoryAllocateInfo,0,&bufferMemory) != VK_SUCCESS){
+			bufferMemory = 0;
+			throw Exception("Failed to allocate readback buffer memory.");
+		}
+		if(vkBindBufferMemory(logicalDev,buffer,bufferMemory,0) != VK_SUCCESS)
+			throw Exception("Failed to bind readback buffer memory.");
+
+		VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+		commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		commandBufferAllocateInfo.commandPool = commandPool;
+		commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		commandBufferAllocateInfo.commandBufferCount = 1;
+		if(vkAllocateCommandBuffers(logicalDev,&commandBufferAllocateInfo,&commandBuffer) != VK_SUCCESS){
+			commandBuffer = 0;
+			throw Exception("Failed to allocate a readback command buffer.");
+		}
+
+		VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+		commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if(vkBeginCommandBuffer(commandBuffer,&commandBufferBeginInfo) != VK_SUCCESS)
+			throw Exception("Failed to begin command buffer recording.");
+
+		//the render pass leaves the image in TRANSFER_SRC_OPTIMAL, only the writes need to be made visible
+		VkImageMemoryBarrier imageMemoryBarrier = {};
+		imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageMemoryBarrier.image = pswapChainImages[index];
+		imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+		imageMemoryBarrier.subresourceRange.levelCount = 1;
+		imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+		imageMemoryBarrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(commandBuffer,VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,VK_PIPELINE_STAGE_TRANSFER_BIT,0,0,0,0,0,1,&imageMemoryBarrier);
+
+		VkBufferImageCopy bufferImageCopy = {};
+		bufferImageCopy.bufferOffset = 0;
+		bufferImageCopy.bufferRowLength = 0;
+		bufferImageCopy.bufferImageHeight = 0;
+		bufferImageCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		bufferImageCopy.imageSubresource.mipLevel = 0;
+		bufferImageCopy.imageSubresource.baseArrayLayer = 0;
+		bufferImageCopy.imageSubresource.layerCount = 1;
+		bufferImageCopy.imageOffset = (VkOffset3D){0,0,0};
+		bufferImageCopy.imageExtent = (VkExtent3D){w,h,1};
+		vkCmdCopyImageToBuffer(commandBuffer,pswapChainImages[index],VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,buffer,1,&bufferImageCopy);
+
+		if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+			throw Exception("Failed to end command buffer recording.");
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		if(vkQueueSubmit(queue[QUEUE_INDEX_GRAPHICS],1,&submitInfo,0) != VK_SUCCESS)
+			throw Exception("Failed to submit a queue.");
+		vkQueueWaitIdle(queue[QUEUE_INDEX_GRAPHICS]);
+
+		void *pdata;
+		if(vkMapMemory(logicalDev,bufferMemory,0,size,0,&pdata) != VK_SUCCESS)
+			throw Exception("Failed to map the readback buffer.");
+		memcpy(pdst,pdata,size);
+		vkUnmapMemory(logicalDev,bufferMemory);
+
+	}catch(Exception e){
+		Release();
+		throw;
+	}
+
+	Release();
+}
+
+bool HeadlessCompositor::CheckPresentQueueCompatibility(VkPhysicalDevice physicalDev, uint queueFamilyIndex) const{
+	return true;
+}
+
+void HeadlessCompositor::CreateSurfaceKHR(VkSurfaceKHR *psurface) const{
+	//
+}
+
+VkExtent2D HeadlessCompositor::GetExtent() const{
+	return (VkExtent2D){w,h};
+}
+
+static const CompositorInterface::Configuration nullConfig = {0,1,false,false,false,false};
+
+NullCompositor::NullCompositor() : CompositorInterface(&nullConfig){
 	//
 }
 
@@ -7,6 +7,14 @@
 #include <xcb/composite.h>
 #include <xcb/damage.h>
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <unordered_map>
+#include <list>
+#include <string>
+
 namespace Backend{
 class X11Backend;
 };
@@ -21,13 +29,32 @@ public:
 	virtual void UpdateContents(const VkCommandBuffer *) = 0;
 	void SetShaders(const char *[Pipeline::SHADER_MODULE_COUNT]);
 	void Draw(const VkRect2D &, const glm::vec2 &, uint, const VkCommandBuffer *);
+	bool UpdateCommandBuffer(const VkRect2D &, const glm::vec2 &, uint, VkCommandBuffer *);
 	void AdjustSurface(uint, uint);
 	bool AssignPipeline(const Pipeline *);
 private:
+	void RequestPipeline(Pipeline *);
+	bool ValidatePipeline();
+	void SelectVariant(uint);
+	void ValidateFrameMask(const VkExtent2D &, const glm::vec2 &);
+	void ValidateDescSets();
 	void UpdateDescSets();
+	void InvalidateCommandBuffers();
+	void ApplySurfaceAdjustment();
 protected:
 	Texture *ptexture;
 	class CompositorInterface *pcomp;
+	//Secondary command buffers recorded with the draw commands of this frame, one per frame in flight.
+	//These are re-recorded only when the state they were recorded with changes.
+	VkCommandPool commandPool;
+	VkCommandBuffer *psecondaryCommandBuffers;
+	struct CommandBufferState{
+		VkRect2D frame;
+		glm::vec2 borderWidth;
+		uint flags;
+		bool valid; //false if the pipeline, descriptor sets or texture have changed since the recording
+	};
+	CommandBufferState *pcommandBufferStates;
 	struct PipelineDescriptorSet{
 		uint64 fenceTag;
 		const Pipeline *p;
@@ -35,12 +62,29 @@ protected:
 	};
 	PipelineDescriptorSet *passignedSet;
 	std::vector<PipelineDescriptorSet> descSets;
+	bool descSetsDirty; //assigned sets need to be allocated or written
+	const Pipeline *prequestedPipeline; //being compiled, replaces the assigned fallback pipeline once ready
+	uint maskOrigin; //shadow and border mask tile in the atlas, FRAME_MASK_NONE if drawn without
+	uint timestampIndex; //query pair of the draw, ~0 if not timed
 	struct timespec creationTime;
 	float time;
 public:
 	uint shaderUserFlags;
+	uint shaderUserVariant; //Pipeline::VARIANT bits forced by the user, in addition to the automatic ones
+	//Time from the arrival of a damage event to the submit and to the present of the frame that
+	//uploads it, in milliseconds.
+	enum DAMAGE_LATENCY{
+		DAMAGE_LATENCY_SUBMIT,
+		DAMAGE_LATENCY_PRESENT,
+		DAMAGE_LATENCY_COUNT
+	};
+	TimingStats damageLatency[DAMAGE_LATENCY_COUNT];
+	uint64 damageTime; //arrival of the oldest damage not yet uploaded (Profiler::GetTime()), 0 if none
 protected:
 	bool fullRegionUpdate;
+private:
+	VkExtent2D surfaceExtent; //requested by the last AdjustSurface()
+	bool surfaceAdjustPending;
 };
 
 class CompositorInterface{
@@ -49,10 +93,40 @@ friend class ShaderModule;
 friend class Pipeline;
 friend class ClientFrame;
 public:
-	CompositorInterface(uint);
+	struct Configuration{
+		uint deviceIndex;
+		uint renderThreadCount; //threads recording the render queue, including the main thread
+		bool instancedRendering; //draw the windows using the default frame shaders with instanced draws
+		bool prebuildPipelines; //compile all the shader combinations at startup
+		bool gpuTiming; //timestamp queries around the passes and the window draws
+		bool uncachedRecording; //re-record the secondary command buffers every frame, for comparison
+	};
+	//Smallest range of the render queue handed over to another thread. Waking up a thread takes a few tens
+	//of microseconds, roughly the time it takes to re-record this many secondary command buffers, and
+	//usually only a few of them need re-recording.
+	enum{
+		RENDER_RANGE_MIN_SIZE = 32
+	};
+	CompositorInterface(const Configuration *);
 	virtual ~CompositorInterface();
 	virtual void Start() = 0;
 	virtual void Stop() = 0;
+	enum DEBUG_MODE{
+		DEBUG_MODE_NONE,
+		DEBUG_MODE_OVERDRAW, //number of layers shaded per pixel
+		DEBUG_MODE_SHADING_COST, //SDF evaluations and texture fetches per pixel
+		DEBUG_MODE_COUNT
+	};
+	void SetDebugMode(uint);
+	void GetTimingStats(std::vector<std::pair<std::string, const TimingStats *>> &) const;
+	void GetCompileTimes(std::vector<std::pair<std::string, float>> &) const;
+	uint64 GetPipelineWaitCount() const;
+	void PrintTimingStats(FILE *) const;
+	void PrintLatencyStats(FILE *) const;
+	void WriteStatsJSON(FILE *) const;
+	uint GetReleaseQueueDepth() const;
+	uint GetReleaseQueueMaxDepth() const;
+	void WaitFrameSlot();
 protected:
 	void InitializeRenderEngine();
 	void DestroyRenderEngine();
@@ -61,7 +135,18 @@ protected:
 	void CreateRenderQueueAppendix(const WManager::Client *, const WManager::Container *);
 	void CreateRenderQueue(const WManager::Container *, const WManager::Container *);
 	bool PollFrameFence();
+	glm::vec4 GetFrameVector(const VkRect2D &) const;
 	void GenerateCommandBuffers(const WManager::Container *, const std::vector<std::pair<const WManager::Client *, WManager::Client *>> *, const WManager::Container *);
+	struct RenderRange{
+		uint begin, end; //[begin,end) of the render queue
+		uint offset; //offset of the render queue in secondaryCommandBuffers
+		uint recordCount;
+		std::exception_ptr pexception;
+	};
+	void RecordRenderRange(RenderRange *);
+	void RenderThreadProc(uint);
+	void InitializeInstancedRenderer();
+	void RecordInstancedRenderQueue(const VkCommandBuffer *);
 	void Present();
 	virtual bool CheckPresentQueueCompatibility(VkPhysicalDevice, uint) const = 0;
 	virtual void CreateSurfaceKHR(VkSurfaceKHR *) const = 0;
@@ -75,6 +160,7 @@ protected:
 	enum QUEUE_INDEX{
 		QUEUE_INDEX_GRAPHICS,
 		QUEUE_INDEX_PRESENT,
+		QUEUE_INDEX_TRANSFER, //dedicated transfer family if available, otherwise same as graphics
 		QUEUE_INDEX_COUNT
 	};
 	VkQueue queue[QUEUE_INDEX_COUNT];
@@ -82,42 +168,215 @@ protected:
 	VkSwapchainKHR swapChain;
 	VkExtent2D imageExtent;
 	VkImage *pswapChainImages;
+	bool offscreen; //render into device-local images in place of the swap chain, nothing is presented
+	VkDeviceMemory *poffscreenMemory;
 	VkImageView *pswapChainImageViews;
 	VkFramebuffer *pframebuffers;
 	enum SEMAPHORE_INDEX{
 		SEMAPHORE_INDEX_IMAGE_AVAILABLE,
-		SEMAPHORE_INDEX_RENDER_FINISHED,
+		SEMAPHORE_INDEX_UPLOAD_FINISHED,
 		SEMAPHORE_INDEX_COUNT
 	};
-	VkSemaphore (*psemaphore)[SEMAPHORE_INDEX_COUNT];
-	VkFence *pfence;
+	VkSemaphore (*psemaphore)[SEMAPHORE_INDEX_COUNT]; //per frame in flight
+	VkSemaphore *prenderFinishedSemaphores; //per swap chain image, waited by the presentation engine
+	//Timeline semaphore signaled to frameTag+1 once the frame with frameTag has finished on the GPU.
+	VkSemaphore frameTimeline;
 	VkCommandPool commandPool;
 	VkCommandBuffer *pcommandBuffers;
 	VkCommandBuffer *pcopyCommandBuffers;
+	std::vector<VkCommandBuffer> secondaryCommandBuffers; //secondaries executed by the current frame, in stacking order
+	//Uploads to textures not yet in use by the graphics queue are recorded here and submitted
+	//to the transfer queue, when a separate transfer queue family is available.
+	VkCommandPool transferCommandPool;
+	VkCommandBuffer *ptransferCommandBuffers;
+	bool asyncTransfer;
+	std::vector<Texture *> acquireQueue; //textures released by the transfer queue this frame
 
 	//VkDescriptorPool descPool;
 	std::deque<VkDescriptorPool> descPoolArray;
-	std::vector<std::pair<VkDescriptorSet *, VkDescriptorPool>> descPoolReference;
+	std::unordered_map<VkDescriptorSet *, VkDescriptorPool> descPoolReference;
+	enum{
+		DESC_POOL_SET_COUNT = 256
+	};
+
+	//Bindless texture table: every texture is written once to its own slot of a single update-after-bind
+	//descriptor array, and referenced by the slot index afterwards. Available with descriptor indexing.
+	VkDescriptorSetLayout textureTableLayout;
+	VkDescriptorPool textureTablePool;
+	VkDescriptorSet textureTable;
+	std::vector<uint> textureIndexFreeList;
+	uint textureIndexCount; //slots allocated so far
+	void AssignTextureIndex(Texture *);
+	void FreeTextureIndex(Texture *);
 
 	uint queueFamilyIndex[QUEUE_INDEX_COUNT]; //
 	uint physicalDevIndex;
+	uint renderThreadCount;
+	bool uncachedRecording;
+	bool descriptorIndexing; //partially bound, non-uniformly indexed descriptor arrays enabled
+	bool instancedRendering;
 	uint swapChainImageCount;
-	uint currentFrame;
+	uint frameCount; //number of frames in flight, independent of the swap chain image count
+	uint currentFrame; //frame slot, [0,frameCount)
+	uint imageIndex; //acquired swap chain image of the current frame
+	bool imageAcquired;
+
+	ShaderModule * FindShader(const char *) const;
+	void FindShaders(const char *[Pipeline::SHADER_MODULE_COUNT], ShaderModule *[Pipeline::SHADER_MODULE_COUNT]) const;
+	Pipeline * FindPipeline(ShaderModule *[Pipeline::SHADER_MODULE_COUNT], uint) const;
+	Pipeline * CreatePipeline(ShaderModule *[Pipeline::SHADER_MODULE_COUNT], uint);
+	Pipeline * LoadPipeline(const char *[Pipeline::SHADER_MODULE_COUNT], uint);
+	Pipeline * LoadPipelineAsync(const char *[Pipeline::SHADER_MODULE_COUNT], uint);
+	Pipeline * LoadPipelineAsync(ShaderModule *[Pipeline::SHADER_MODULE_COUNT], uint);
+	void PrebuildPipelines();
+
+	//Pipelines requested by the clients are compiled on a separate thread to avoid stalling the event
+	//handling. Meanwhile the frames are drawn with the default frame pipeline.
+	void CompileThreadProc();
+	std::thread compileThread;
+	std::deque<Pipeline *> compileQueue;
+	std::mutex compileMutex;
+	std::condition_variable compileCond;
+	std::condition_variable compileDoneCond;
+	bool compileThreadExit;
+	std::vector<ClientFrame *> pipelineWaitQueue; //frames waiting for their pipelines
 
-	Pipeline * LoadPipeline(const char *[Pipeline::SHADER_MODULE_COUNT]);
+	//Pipeline cache, stored in the user cache directory between the sessions.
+	VkPipelineCache pipelineCache;
+	bool pipelineCacheLoaded; //the cache was warm at startup
+	std::string GetPipelineCachePath() const;
+	void LoadPipelineCache();
+	void SavePipelineCache();
+	struct PipelineCacheHeader{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+	};
+	enum{
+		PIPELINE_CACHE_MAGIC = 0x63706863, //"chpc"
+		PIPELINE_CACHE_VERSION = 1
+	};
+	struct timespec initTime; //compositor creation, for the startup measurements
 
-	//all the resources are preloaded for now
-	std::vector<ShaderModule> shaders;
-	std::vector<Pipeline> pipelines;
+	//All the resources are preloaded for now. The shader modules and pipelines are stored in deques,
+	//so that the pointers handed out remain valid until the render engine is destroyed.
+	std::deque<ShaderModule> shaders;
+	std::unordered_map<std::string, ShaderModule *> shaderTable; //interned shader names
 
+	struct PipelineKey{
+		const ShaderModule *pshaderModule[Pipeline::SHADER_MODULE_COUNT];
+		uint stateKey;
+		bool operator==(const PipelineKey &) const;
+	};
+	struct PipelineKeyHash{
+		size_t operator()(const PipelineKey &) const;
+	};
+	std::deque<Pipeline> pipelines;
+	std::unordered_map<PipelineKey, Pipeline *, PipelineKeyHash> pipelineTable;
+
+	std::vector<ClientFrame *> clientFrames; //all live frames, for the statistics
 	std::vector<ClientFrame *> updateQueue;
+	std::vector<ClientFrame *> latencyQueue; //damaged frames uploaded in the current frame
+	TimingStats damageLatency[ClientFrame::DAMAGE_LATENCY_COUNT]; //all clients combined
 
 	ClientFrame *pbackground;
 
+	//Instanced path: consecutive windows using the default frame pipeline are drawn with a single
+	//instanced draw, reading their data from a per-frame storage buffer. Windows with custom
+	//shaders are drawn individually with their own pipelines.
+	struct Instance{
+		glm::vec4 frameVec;
+		glm::vec2 borderWidth;
+		uint flags;
+		float time;
+		uint textureIndex;
+		uint maskOrigin;
+		uint variant; //Pipeline::VARIANT of the frame
+		uint pad; //StructuredBuffer stride
+	};
+	struct InstanceBuffer{
+		VkBuffer buffer;
+		VkDeviceMemory deviceMemory;
+		Instance *pinstances; //persistently mapped
+		VkDescriptorSet descSet; //instance buffer (vertex stage), the textures are read from the table
+	};
+	enum{
+		INSTANCE_COUNT = 1024,
+		TEXTURE_TABLE_SIZE = 4096 //TEXTURE_COUNT in frame_instanced.hlsl
+	};
+	InstanceBuffer *pinstanceBuffers; //per frame in flight
+	VkDescriptorPool instanceDescPool;
+	const Pipeline *pinstancedPipeline;
+	const Pipeline *pframePipeline; //default frame pipeline replaced by the instanced one, along with its variants
+	bool IsInstanced(const ClientFrame *) const;
+
 	VkSampler pointSampler;
 
+	uint debugMode;
+	uint debugFlags; //FLAGS_DEBUG_* in chamfer.hlsl, added to the flags of every draw
+
+	//GPU timestamps. Each frame slot has its own range of queries, reset by the copy command buffer
+	//and read back once the slot is reused. Every frame owns a query pair written around its draw,
+	//so that the cached secondary command buffers stay valid.
+	enum TIMESTAMP_PASS{
+		TIMESTAMP_PASS_COPY,
+		TIMESTAMP_PASS_RENDER, //whole render pass
+		TIMESTAMP_PASS_COUNT
+	};
+	enum{
+		TIMESTAMP_FRAME_COUNT = 256, //timed frames at most
+		TIMESTAMP_QUERY_COUNT = 2*(TIMESTAMP_PASS_COUNT+TIMESTAMP_FRAME_COUNT) //per frame slot
+	};
+	uint AssignTimestampIndex();
+	void FreeTimestampIndex(uint);
+	uint GetTimestampQuery(uint) const;
+	void CollectTimedDraws();
+	void ReadTimestamps();
+	bool gpuTiming;
+	VkQueryPool timestampPool;
+	float timestampPeriod; //nanoseconds per tick
+	uint64 timestampMask;
+	std::vector<uint> timestampIndexFreeList;
+	struct TimedDraw{
+		uint timestampIndex;
+		const Pipeline *p; //0 for the background
+	};
+	std::vector<TimedDraw> *ptimedDraws; //per frame slot
+	uint64 *ptimestampResults; //value and availability of each query of a frame slot
+	uint64 *ptimedFrameTags; //frame to be read back from each slot, ~0 if none
+	TimingStats passStats[TIMESTAMP_PASS_COUNT]; //milliseconds
+	TimingStats backgroundStats; //draw of the background, timed by its own query pair
+	std::unordered_map<const Pipeline *, TimingStats> pipelineStats;
+
 	struct timespec frameTime;
 	uint64 frameTag;
+	uint64 frameCompletionTag; //frames with tag < frameCompletionTag have been completed by the GPU
+
+	//Frame timestamps for latency analysis, stored in a ring indexed by frameTag.
+	struct FrameTiming{
+		uint64 frameTag;
+		struct timespec beginTime; //frame slot available, recording begins
+		struct timespec submitTime;
+		struct timespec presentTime;
+		struct timespec retireTime; //completion observed by the CPU
+		uint drawCount;
+		uint recordCount; //secondary command buffers re-recorded for the frame
+		float recordTime; //CPU time spent recording the render queue
+		uint releaseQueueDepth; //objects waiting for their frames to complete
+		uint pipelineWaitCount; //frames drawn with the fallback pipeline
+		uint maskUploadCount; //shadow and border mask tiles generated for the frame
+		uint64 uploadByteCount; //window contents copied to the textures
+	};
+	enum{
+		FRAME_TIMING_COUNT = 64
+	};
+	FrameTiming frameTimings[FRAME_TIMING_COUNT];
+	TimingStats recordStats; //FrameTiming::recordTime, milliseconds
+	uint64 uploadByteCount; //window contents copied since startup
+	uint64 pipelineWaitCount; //FrameTiming::pipelineWaitCount summed over all frames
 
 	struct RenderObject{
 		WManager::Client *pclient;
@@ -125,30 +384,109 @@ protected:
 		uint flags;
 	};
 	std::vector<RenderObject> renderQueue;
+	uint GetVariant(const RenderObject &) const;
+
+	//Render queue recording threads, woken up for each frame by incrementing renderGeneration.
+	std::vector<std::thread> renderThreads;
+	std::vector<RenderRange> renderRanges; //one per thread, first one recorded by the main thread
+	std::mutex renderMutex;
+	std::condition_variable renderCond;
+	std::condition_variable renderDoneCond;
+	uint64 renderGeneration;
+	uint renderPending; //threads not yet done with the current generation
+	bool renderThreadExit;
 	std::deque<std::pair<const WManager::Client *, WManager::Client *>> appendixQueue;
 
+	//Deferred destruction. Released objects are queued in frame order, and destroyed once the frames
+	//that might still use them have completed. Each frame pops only the entries that have expired.
+	struct ReleaseEntry{
+		enum TYPE{
+			TYPE_TEXTURE, //moved to the texture cache
+			TYPE_DESC_SETS,
+			TYPE_COMMAND_POOL,
+			TYPE_PIPELINE,
+			TYPE_PIPELINE_LAYOUT,
+			TYPE_SHADER_MODULE,
+			TYPE_DESC_SET_LAYOUT,
+			TYPE_BUFFER,
+			TYPE_MEMORY,
+			TYPE_COUNT
+		} type;
+		union{
+			Texture *ptexture;
+			struct{
+				VkDescriptorSet *pdescSets;
+				uint setCount;
+			} descSets;
+			VkCommandPool commandPool;
+			VkPipeline pipeline;
+			VkPipelineLayout pipelineLayout;
+			VkShaderModule shaderModule;
+			VkDescriptorSetLayout descSetLayout;
+			VkBuffer buffer;
+			VkDeviceMemory memory;
+		};
+		uint64 releaseTag; //frameTag at the time of release
+	};
+	void ReleaseObject(ReleaseEntry &);
+	void DestroyReleasedObjects(uint64);
+	std::deque<ReleaseEntry> releaseQueue;
+	uint releaseQueueMaxDepth; //FrameTiming::releaseQueueDepth peak
+
 	//Used textures get stored for potential reuse before they get destroyed.
 	//Many of the allocated window textures will initially have some common reoccuring size.
-	//The purpose of caching is also to avoid attempts to destroy resources that are currently used by the pipeline.
 	Texture * CreateTexture(uint, uint);
 	void ReleaseTexture(Texture *);
 
 	struct TextureCacheEntry{
 		Texture *ptexture;
-		uint64 releaseTag;
-		struct timespec releaseTime;
+		struct timespec releaseTime; //time the texture became available, oldest first
+	};
+	std::deque<TextureCacheEntry> textureCache;
+	enum{
+		TEXTURE_CACHE_EXPIRY = 5 //seconds
+	};
+
+	//Shadow and border masks of the frame shaders. The masks only depend on the window size and the
+	//border width, so the corner of each is computed once per key into a tile of the mask atlas.
+	//The fragment shader folds the window into the corner and stretches the innermost texels over
+	//the edges (nine-slice). Tiles not used by any frame in flight are replaced in LRU order.
+	struct FrameMaskKey{
+		uint borderWidth[2]; //pixels
+		uint sizeBucket[2]; //window extent/FRAME_MASK_SIZE_BUCKET
+		uint screenWidth;
+		bool operator==(const FrameMaskKey &) const;
+	};
+	struct FrameMaskKeyHash{
+		size_t operator()(const FrameMaskKey &) const;
+	};
+	struct FrameMask{
+		FrameMaskKey key;
+		uint cell;
+		uint64 useTag; //last frame drawn with the tile
+	};
+	uint LookupFrameMask(const VkExtent2D &, const glm::vec2 &);
+	void GenerateFrameMask(const FrameMaskKey &, uint);
+	Texture *pframeMaskAtlas;
+	unsigned char *pframeMaskData; //mapped staging memory while uploads are pending
+	std::vector<VkRect2D> frameMaskUploads;
+	std::list<FrameMask> frameMaskList; //most recently used first
+	std::unordered_map<FrameMaskKey, std::list<FrameMask>::iterator, FrameMaskKeyHash> frameMaskTable;
+	std::vector<uint> frameMaskFreeList;
+	enum{
+		FRAME_MASK_ATLAS_SIZE = 2048,
+		FRAME_MASK_CELL_SIZE = 256, //FRAME_MASK_CELL_SIZE in frame.hlsl
+		FRAME_MASK_CELL_COUNT = (FRAME_MASK_ATLAS_SIZE/FRAME_MASK_CELL_SIZE)*(FRAME_MASK_ATLAS_SIZE/FRAME_MASK_CELL_SIZE),
+		FRAME_MASK_INSET = 50, //extent of the corner inside the window, FRAME_MASK_INSET in frame.hlsl
+		FRAME_MASK_SIZE_BUCKET = 32, //pixels
+		FRAME_MASK_NONE = ~0u
 	};
-	std::vector<TextureCacheEntry> textureCache;
 
 	VkDescriptorSet * CreateDescSets(const ShaderModule *);
 	void ReleaseDescSets(const ShaderModule *, VkDescriptorSet *);
 
-	struct DescSetCacheEntry{
-		VkDescriptorSet *pdescSets;
-		uint setCount;
-		uint64 releaseTag;
-	};
-	std::vector<DescSetCacheEntry> descSetCache;
+	//Command pools of destroyed client frames
+	void ReleaseCommandPool(VkCommandPool);
 
 	static VKAPI_ATTR VkBool32 VKAPI_CALL ValidationLayerDebugCallback(VkDebugReportFlagsEXT, VkDebugReportObjectTypeEXT, uint64_t, size_t, int32_t, const char *, const char *, void *);
 };
@@ -179,7 +517,7 @@ public:
 class X11Compositor : public CompositorInterface{
 public:
 	//Derivatives of compositor classes should not point to their default corresponding backend classes (Backend::Default in this case). This is to allow the compositor to be independent of the backend implementation, as long as it's based on X11 here.
-	X11Compositor(uint, const Backend::X11Backend *);
+	X11Compositor(const Configuration *, const Backend::X11Backend *);
 	~X11Compositor();
 	virtual void Start();
 	virtual void Stop();
@@ -207,14 +545,49 @@ public:
 	~X11DebugClientFrame();
 	void UpdateContents(const VkCommandBuffer *);
 	void AdjustSurface1();
+	enum DAMAGE_PATTERN{
+		DAMAGE_PATTERN_NONE, //random solid color, redrawn on resize only
+		DAMAGE_PATTERN_VIDEO, //whole frame on every damage
+		DAMAGE_PATTERN_SCROLL, //strip of text lines at the bottom, as in a scrolling terminal
+		DAMAGE_PATTERN_BLINK, //cursor sized rectangle toggled on and off
+		DAMAGE_PATTERN_COUNT
+	};
+	uint damagePattern;
+	uint damageIndex; //number of damages so far
 };
 
 class X11DebugCompositor : public X11Compositor{
 public:
-	X11DebugCompositor(uint, const Backend::X11Backend *);
+	X11DebugCompositor(const Configuration *, const Backend::X11Backend *);
 	~X11DebugCompositor();
 	void Start();
 	void Stop();
+	void Damage(X11DebugClientFrame *);
+};
+
+class HeadlessClientFrame : public WManager::Client, public ClientFrame{
+public:
+	HeadlessClientFrame(WManager::Container *, const char *[Pipeline::SHADER_MODULE_COUNT], class HeadlessCompositor *);
+	~HeadlessClientFrame();
+	void UpdateTranslation();
+	void UpdateContents(const VkCommandBuffer *);
+	class HeadlessCompositor *pcompHeadless;
+	uint contentIndex; //advanced on each damage, selects the generated contents
+};
+
+//Renders offscreen without a display or window system, for benchmarking and image comparison.
+class HeadlessCompositor : public CompositorInterface{
+public:
+	HeadlessCompositor(const Configuration *, uint, uint);
+	~HeadlessCompositor();
+	void Start();
+	void Stop();
+	void Damage(HeadlessClientFrame *);
+	void ReadFrame(unsigned char *);
+	bool CheckPresentQueueCompatibility(VkPhysicalDevice, uint) const;
+	void CreateSurfaceKHR(VkSurfaceKHR *) const;
+	VkExtent2D GetExtent() const;
+	uint w, h;
 };
 
 class NullCompositor : public CompositorInterface{
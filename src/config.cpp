@@ -184,6 +184,7 @@ ContainerProxy::~ContainerProxy(){
 void ContainerProxy::OnSetupContainer(){
 	boost::python::override ovr = this->get_override("OnSetupContainer");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnSetupContainer");
 		try{
 			ovr();
 		}catch(boost::python::error_already_set &){
@@ -198,6 +199,7 @@ void ContainerProxy::OnSetupContainer(){
 void ContainerProxy::OnSetupClient(){
 	boost::python::override ovr = this->get_override("OnSetupClient");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnSetupClient");
 		try{
 			ovr();
 		}catch(boost::python::error_already_set &){
@@ -212,6 +214,7 @@ void ContainerProxy::OnSetupClient(){
 boost::python::object ContainerProxy::OnParent(){
 	boost::python::override ovr = this->get_override("OnParent");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnParent");
 		try{
 			return ovr();
 		}catch(boost::python::error_already_set &){
@@ -227,6 +230,7 @@ boost::python::object ContainerProxy::OnParent(){
 void ContainerProxy::OnCreate(){
 	boost::python::override ovr = this->get_override("OnCreate");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnCreate");
 		try{
 			ovr();
 		}catch(boost::python::error_already_set &){
@@ -241,6 +245,7 @@ void ContainerProxy::OnCreate(){
 bool ContainerProxy::OnFullscreen(bool toggle){
 	boost::python::override ovr = this->get_override("OnFullscreen");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnFullscreen");
 		try{
 			return ovr(toggle);
 		}catch(boost::python::error_already_set &){
@@ -256,6 +261,7 @@ bool ContainerProxy::OnFullscreen(bool toggle){
 void ContainerProxy::OnPropertyChange(PROPERTY_ID id){
 	boost::python::override ovr = this->get_override("OnPropertyChange");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnPropertyChange");
 		try{
 			ovr(id);
 		}catch(boost::python::error_already_set &){
@@ -423,6 +429,7 @@ BackendProxy::~BackendProxy(){
 void BackendProxy::OnSetupKeys(Backend::X11KeyBinder *pkeyBinder, bool debug){
 	boost::python::override ovr = this->get_override("OnSetupKeys");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnSetupKeys");
 		try{
 			ovr(pkeyBinder,debug);
 		}catch(boost::python::error_already_set &){
@@ -437,6 +444,7 @@ void BackendProxy::OnSetupKeys(Backend::X11KeyBinder *pkeyBinder, bool debug){
 boost::python::object BackendProxy::OnCreateContainer(){
 	boost::python::override ovr = this->get_override("OnCreateContainer");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnCreateContainer");
 		try{
 			return ovr();
 		}catch(boost::python::error_already_set &){
@@ -450,8 +458,10 @@ boost::python::object BackendProxy::OnCreateContainer(){
 }
 
 void BackendProxy::OnKeyPress(uint keyId){
+	KeyLatency::Mark(KeyLatency::STAGE_DISPATCH);
 	boost::python::override ovr = this->get_override("OnKeyPress");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnKeyPress");
 		try{
 			ovr(keyId);
 		}catch(boost::python::error_already_set &){
@@ -466,6 +476,7 @@ void BackendProxy::OnKeyPress(uint keyId){
 void BackendProxy::OnKeyRelease(uint keyId){
 	boost::python::override ovr = this->get_override("OnKeyRelease");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnKeyRelease");
 		try{
 			ovr(keyId);
 		}catch(boost::python::error_already_set &){
@@ -480,6 +491,7 @@ void BackendProxy::OnKeyRelease(uint keyId){
 void BackendProxy::OnTimer(){
 	boost::python::override ovr = this->get_override("OnTimer");
 	if(ovr){
+		Profiler::Scope profilerScope(Profiler::PHASE_CALLBACK,"OnTimer");
 		try{
 			ovr();
 		}catch(boost::python::error_already_set &){
@@ -504,8 +516,19 @@ void CompositorInterface::Bind(boost::python::object obj){
 	pcompositorInt = &compositorInt;
 }
 
+void CompositorInterface::SetDebugMode(uint mode){
+	//validated here once, the compositor applies the mode every frame
+	if(mode >= Compositor::CompositorInterface::DEBUG_MODE_COUNT){
+		PyErr_SetString(PyExc_ValueError,"Invalid debug mode.");
+		boost::python::throw_error_already_set();
+	}
+	debugMode = mode;
+}
+
 CompositorInterface CompositorInterface::defaultInt;
 CompositorInterface *CompositorInterface::pcompositorInt = &CompositorInterface::defaultInt;
+uint CompositorInterface::debugMode = Compositor::CompositorInterface::DEBUG_MODE_NONE;
+const Compositor::CompositorInterface *CompositorInterface::pcomp = 0;
 
 CompositorProxy::CompositorProxy(){
 	//
@@ -515,6 +538,70 @@ CompositorProxy::~CompositorProxy(){
 	//
 }
 
+//Sample count, mean, percentile bounds and max in microseconds, and the bucket counts (bucket i
+//below 2^i us).
+static boost::python::dict GetHistogramDict(const Profiler::Histogram &histogram){
+	boost::python::dict dict;
+	dict["count"] = histogram.count;
+	dict["mean"] = histogram.count > 0?(float)histogram.totalTime/(float)histogram.count*1e-3f:0.0f;
+	dict["p50"] = histogram.GetPercentile(0.5f);
+	dict["p99"] = histogram.GetPercentile(0.99f);
+	dict["max"] = (float)histogram.maxTime*1e-3f;
+	boost::python::list buckets;
+	for(uint j = 0; j < Profiler::BUCKET_COUNT; ++j)
+		buckets.append(histogram.buckets[j]);
+	dict["buckets"] = buckets;
+	return dict;
+}
+
+//Rolling mean and percentiles in milliseconds
+static boost::python::dict GetTimingStatsDict(const TimingStats &stats){
+	boost::python::dict dict;
+	dict["count"] = stats.GetCount();
+	dict["mean"] = stats.GetMean();
+	dict["p50"] = stats.GetPercentile(0.5f);
+	dict["p99"] = stats.GetPercentile(0.99f);
+	return dict;
+}
+
+//Profiler histograms by phase, and the compositor statistics
+static boost::python::dict GetStats(){
+	boost::python::dict stats;
+	for(uint i = 0; i < Profiler::PHASE_COUNT; ++i)
+		stats[Profiler::pphaseNames[i]] = GetHistogramDict(Profiler::histograms[i]);
+	const Compositor::CompositorInterface *pcomp = CompositorInterface::pcomp;
+	if(pcomp){
+		boost::python::dict compStats;
+		compStats["releaseQueueDepth"] = pcomp->GetReleaseQueueDepth();
+		compStats["releaseQueueMaxDepth"] = pcomp->GetReleaseQueueMaxDepth();
+		//window draws that used the previous pipeline while the requested one was compiled
+		compStats["pipelineWaitCount"] = pcomp->GetPipelineWaitCount();
+		std::vector<std::pair<std::string, float>> compileTimes;
+		pcomp->GetCompileTimes(compileTimes);
+		boost::python::dict compileStats;
+		for(auto &m : compileTimes)
+			compileStats[m.first] = m.second;
+		compStats["compileTime"] = compileStats;
+		//GPU time by pass and pipeline, with --gpu-timing
+		std::vector<std::pair<std::string, const TimingStats *>> timingStats;
+		pcomp->GetTimingStats(timingStats);
+		boost::python::dict gpuStats;
+		for(auto &m : timingStats)
+			gpuStats[m.first] = GetTimingStatsDict(*m.second);
+		compStats["gpuTime"] = gpuStats;
+		stats["compositor"] = compStats;
+	}
+	return stats;
+}
+
+//Key binding latency histograms by stage
+static boost::python::dict GetKeyLatencyStats(){
+	boost::python::dict stats;
+	for(uint i = 0; i < KeyLatency::STAGE_COUNT; ++i)
+		stats[KeyLatency::pstageNames[i]] = GetHistogramDict(KeyLatency::histograms[i]);
+	return stats;
+}
+
 BOOST_PYTHON_MODULE(chamfer){
 	boost::python::scope().attr("MOD_MASK_1") = uint(XCB_MOD_MASK_1);
 	boost::python::scope().attr("MOD_MASK_2") = uint(XCB_MOD_MASK_2);
@@ -528,6 +615,11 @@ BOOST_PYTHON_MODULE(chamfer){
 	boost::python::scope().attr("KEY_SPACE") = uint(XK_space);
 	boost::python::scope().attr("KEY_TAB") = uint(XK_Tab);
 
+	boost::python::scope().attr("SHADER_VARIANT_NO_SHADOW") = uint(Compositor::Pipeline::VARIANT_NO_SHADOW);
+	boost::python::scope().attr("SHADER_VARIANT_NO_BORDER") = uint(Compositor::Pipeline::VARIANT_NO_BORDER);
+	boost::python::scope().attr("SHADER_VARIANT_NO_ROUNDED_CORNERS") = uint(Compositor::Pipeline::VARIANT_NO_ROUNDED_CORNERS);
+	boost::python::scope().attr("SHADER_VARIANT_NO_FOCUS_INDICATOR") = uint(Compositor::Pipeline::VARIANT_NO_FOCUS_INDICATOR);
+
 	boost::python::class_<Backend::X11KeyBinder>("KeyBinder",boost::python::no_init)
 		.def("BindKey",&Backend::X11KeyBinder::BindKey)
 		;
@@ -614,6 +706,29 @@ BOOST_PYTHON_MODULE(chamfer){
 				}
 				return (container.pcontainer->flags & WManager::Container::FLAG_FLOATING) != 0;
 			},boost::python::default_call_policies(),boost::mpl::vector<bool, ContainerInterface &>()))
+		.def("GetDamageLatency",boost::python::make_function(
+			[](ContainerInterface &container){
+				//milliseconds from damage to submit and to present, None if not composited
+				boost::python::dict stats;
+				if(!container.pcontainer){
+					PyErr_SetString(PyExc_ValueError,"Invalid or expired container.");
+					return boost::python::object();
+				}
+				Compositor::ClientFrame *pclientFrame = dynamic_cast<Compositor::ClientFrame *>(container.pcontainer->pclient);
+				if(!pclientFrame)
+					return boost::python::object();
+				static const char *plabels[Compositor::ClientFrame::DAMAGE_LATENCY_COUNT] = {"submit","present"};
+				for(uint i = 0; i < Compositor::ClientFrame::DAMAGE_LATENCY_COUNT; ++i){
+					const TimingStats &timingStats = pclientFrame->damageLatency[i];
+					boost::python::dict latency;
+					latency["count"] = timingStats.GetCount();
+					latency["mean"] = timingStats.GetMean();
+					latency["p50"] = timingStats.GetPercentile(0.5f);
+					latency["p99"] = timingStats.GetPercentile(0.99f);
+					stats[plabels[i]] = latency;
+				}
+				return boost::python::object(stats);
+			},boost::python::default_call_policies(),boost::mpl::vector<boost::python::object, ContainerInterface &>()))
 		.def_readwrite("canvasOffset",&ContainerInterface::canvasOffset)
 		.def_readwrite("canvasExtent",&ContainerInterface::canvasExtent)
 		.def_readwrite("borderWidth",&ContainerInterface::borderWidth)
@@ -650,6 +765,29 @@ BOOST_PYTHON_MODULE(chamfer){
 					return;
 				pclientFrame->shaderUserFlags = flags;
 			},boost::python::default_call_policies(),boost::mpl::vector<void, ContainerInterface &, uint>()))
+		.add_property("shaderVariant",
+			boost::python::make_function(
+			[](ContainerInterface &container){
+				if(!container.pcontainer){
+					PyErr_SetString(PyExc_ValueError,"Invalid or expired container.");
+					return 0u;
+				}
+				Compositor::ClientFrame *pclientFrame = dynamic_cast<Compositor::ClientFrame *>(container.pcontainer->pclient);
+				if(!pclientFrame)
+					return 0u;
+				return pclientFrame->shaderUserVariant;
+			},boost::python::default_call_policies(),boost::mpl::vector<uint, ContainerInterface &>()),
+				boost::python::make_function(
+			[](ContainerInterface &container, uint variant){
+				if(!container.pcontainer){
+					PyErr_SetString(PyExc_ValueError,"Invalid or expired container.");
+					return;
+				}
+				Compositor::ClientFrame *pclientFrame = dynamic_cast<Compositor::ClientFrame *>(container.pcontainer->pclient);
+				if(!pclientFrame)
+					return;
+				pclientFrame->shaderUserVariant = variant;
+			},boost::python::default_call_policies(),boost::mpl::vector<void, ContainerInterface &, uint>()))
 		.def_readonly("wm_name",&ContainerInterface::wm_name)
 		.def_readonly("wm_class",&ContainerInterface::wm_class)
 		.def_readwrite("vertexShader",&ContainerInterface::vertexShader)
@@ -688,9 +826,17 @@ BOOST_PYTHON_MODULE(chamfer){
 		.add_property("shaderPath",&CompositorInterface::shaderPath)
 		;
 	boost::python::def("bind_Compositor",CompositorInterface::Bind);
+	boost::python::def("SetDebugMode",CompositorInterface::SetDebugMode);
+
+	boost::python::enum_<Compositor::CompositorInterface::DEBUG_MODE>("debugMode")
+		.value("NONE",Compositor::CompositorInterface::DEBUG_MODE_NONE)
+		.value("OVERDRAW",Compositor::CompositorInterface::DEBUG_MODE_OVERDRAW)
+		.value("SHADING_COST",Compositor::CompositorInterface::DEBUG_MODE_SHADING_COST);
 
 	boost::python::def("GetFocus",&BackendInterface::GetFocus);
 	boost::python::def("GetRoot",&BackendInterface::GetRoot);
+	boost::python::def("GetStats",GetStats);
+	boost::python::def("GetKeyLatencyStats",GetKeyLatencyStats);
 }
 
 Loader::Loader(const char *pargv0){
@@ -13,6 +13,10 @@ class Client;
 class Container;
 }
 
+namespace Compositor{
+class CompositorInterface;
+}
+
 namespace Config{
 
 class ContainerInterface{
@@ -147,8 +151,11 @@ public:
 	//virtual void SetupShaders();
 
 	static void Bind(boost::python::object);
+	static void SetDebugMode(uint);
 	static CompositorInterface defaultInt;
 	static CompositorInterface *pcompositorInt;
+	static uint debugMode; //Compositor::CompositorInterface::DEBUG_MODE, applied on the next frame
+	static const Compositor::CompositorInterface *pcomp; //running compositor for the statistics, 0 if none
 };
 
 class CompositorProxy : public CompositorInterface, public boost::python::wrapper<CompositorInterface>{
@@ -510,6 +510,7 @@ void Container::TranslateRecursive(glm::vec2 posFullCanvas, glm::vec2 extFullCan
 }
 
 void Container::Translate(){
+	Profiler::Scope profilerScope(Profiler::PHASE_LAYOUT);
 	glm::vec2 size = GetMinSize();
 
 	//Check the parent hierarchy, up to which point they won't have to be updated (condition overlappedSize <= e).
@@ -523,6 +524,7 @@ void Container::Translate(){
 	//pcontainer->TranslateRecursive(pcontainer->p,pcontainer->e);
 	pcontainer->TranslateRecursive(pcontainer->posFullCanvas,pcontainer->extFullCanvas,
 		pcontainer->posFullCanvas+pcontainer->canvasOffset,pcontainer->extFullCanvas-pcontainer->canvasExtent);
+	KeyLatency::Mark(KeyLatency::STAGE_LAYOUT);
 }
 
 void Container::StackRecursive(){
@@ -544,6 +546,7 @@ void Container::StackRecursive(){
 }
 
 void Container::Stack(){
+	Profiler::Scope profilerScope(Profiler::PHASE_LAYOUT);
 	/*stackQueue.clear();
 	Container *pfocus = focusQueue.size() > 0?focusQueue.back():pch;
 	if(!pfocus)
@@ -601,6 +604,7 @@ void Container::Stack(){
 	});*/
 	StackRecursive();
 	Stack1();
+	KeyLatency::Mark(KeyLatency::STAGE_LAYOUT);
 }
 
 void Container::SetLayout(LAYOUT layout){
@@ -608,5 +612,54 @@ void Container::SetLayout(LAYOUT layout){
 	Translate();
 }
 
+bool Container::Validate() const{
+	bool valid = true;
+	if(pclient && pch){
+		DebugPrintf(stderr,"Tree: container %p has both a client and children.\n",this);
+		valid = false;
+	}
+	if(pclient && pclient->pcontainer != this){
+		DebugPrintf(stderr,"Tree: client of container %p refers to %p.\n",this,pclient->pcontainer);
+		valid = false;
+	}
+
+	uint count = 0;
+	for(const Container *pcontainer = pch; pcontainer; pcontainer = pcontainer->pnext){
+		if(++count > 65536){
+			DebugPrintf(stderr,"Tree: sibling cycle under container %p.\n",this);
+			return false;
+		}
+		if(pcontainer->pParent != this){
+			DebugPrintf(stderr,"Tree: container %p is a child of %p, but refers to %p as its parent.\n",pcontainer,this,pcontainer->pParent);
+			valid = false;
+		}
+		if(pcontainer->flags & FLAG_FLOATING){
+			DebugPrintf(stderr,"Tree: floating container %p is linked under %p.\n",pcontainer,this);
+			valid = false;
+		}
+		if(!pcontainer->Validate())
+			valid = false;
+	}
+
+	auto IsChild = [&](const Container *pcontainer)->bool{
+		for(const Container *pch1 = pch; pch1; pch1 = pch1->pnext)
+			if(pch1 == pcontainer)
+				return true;
+		return false;
+	};
+	for(const Container *pcontainer : focusQueue)
+		if(!IsChild(pcontainer)){
+			DebugPrintf(stderr,"Tree: focus queue of %p holds %p, which is not a child.\n",this,pcontainer);
+			valid = false;
+		}
+	for(const Container *pcontainer : stackQueue)
+		if(!IsChild(pcontainer)){
+			DebugPrintf(stderr,"Tree: stack queue of %p holds %p, which is not a child.\n",this,pcontainer);
+			valid = false;
+		}
+
+	return valid;
+}
+
 }
 
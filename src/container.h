@@ -73,6 +73,9 @@ public:
 	void Translate();
 	void StackRecursive();
 	void Stack();
+	//Checks the parent, sibling and client links and the focus and stack queues of the subtree,
+	//printing each inconsistency found.
+	bool Validate() const;
 	enum LAYOUT{
 		LAYOUT_VSPLIT,
 		LAYOUT_HSPLIT,
@@ -6,8 +6,28 @@
 #include "compositor.h"
 
 #include <cstdlib>
+#include <algorithm>
 #include <stdarg.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+#ifdef CHAMFER_ALLOC_PROFILE
+#include <new>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#endif
+
+#ifdef CHAMFER_XTEST
+#include <xcb/xtest.h>
+#endif
 
 #include <args.hxx>
 #include <iostream>
@@ -32,6 +52,412 @@ const char * Exception::what(){
 
 char Exception::buffer[4096];
 
+TimingStats::TimingStats() : sampleCount(0), next(0){
+	//
+}
+
+TimingStats::~TimingStats(){
+	//
+}
+
+void TimingStats::Add(float t){
+	samples[next] = t;
+	next = (next+1)%WINDOW_SIZE;
+	sampleCount = std::min(sampleCount+1,(uint)WINDOW_SIZE);
+}
+
+uint TimingStats::GetCount() const{
+	return sampleCount;
+}
+
+float TimingStats::GetMean() const{
+	if(sampleCount == 0)
+		return 0.0f;
+	float sum = 0.0f;
+	for(uint i = 0; i < sampleCount; ++i)
+		sum += samples[i];
+	return sum/(float)sampleCount;
+}
+
+float TimingStats::GetPercentile(float p) const{
+	//p in [0,1]
+	if(sampleCount == 0)
+		return 0.0f;
+	float sorted[WINDOW_SIZE];
+	std::copy(samples,samples+sampleCount,sorted);
+	uint n = std::min((uint)(p*(float)sampleCount),sampleCount-1);
+	std::nth_element(sorted,sorted+n,sorted+sampleCount);
+	return sorted[n];
+}
+
+void TimingStats::WriteJSON(FILE *pf) const{
+	fprintf(pf,"{\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"count\": %u}",GetMean(),GetPercentile(0.5f),GetPercentile(0.99f),GetCount());
+}
+
+Profiler::Histogram Profiler::histograms[PHASE_COUNT] = {};
+const char *Profiler::pphaseNames[PHASE_COUNT] = {
+	"event","callback","layout","stack","render_queue","image_fetch","pixel_copy","record","submit","present"
+};
+
+void Profiler::Add(PHASE phase, uint64 beginTime){
+	Add(phase,beginTime,pphaseNames[phase]);
+}
+
+void Profiler::Add(PHASE phase, uint64 beginTime, const char *pname){
+	uint64 endTime = GetTime();
+	if(Tracer::enabled)
+		Tracer::AddSpan(pname,beginTime,endTime);
+	histograms[phase].Add(endTime-beginTime);
+}
+
+uint Profiler::GetPercentile(PHASE phase, float p){
+	return histograms[phase].GetPercentile(p);
+}
+
+void Profiler::Print(FILE *pf){
+	fprintf(pf,"CPU time (us)        count      mean     p50<=     p99<=       max\n");
+	for(uint i = 0; i < PHASE_COUNT; ++i)
+		histograms[i].Print(pf,pphaseNames[i]);
+	fflush(pf);
+}
+
+void Profiler::WriteJSON(FILE *pf){
+	fprintf(pf,"{");
+	for(uint i = 0; i < PHASE_COUNT; ++i){
+		fprintf(pf,"%s\"%s\": ",i > 0?", ":"",pphaseNames[i]);
+		histograms[i].WriteJSON(pf);
+	}
+	fprintf(pf,"}");
+}
+
+void Profiler::Histogram::Add(uint64 t){
+	count++;
+	totalTime += t;
+	maxTime = std::max(maxTime,t);
+	uint64 us = t/1000;
+	uint bucket = us > 0?64-__builtin_clzll(us):0;
+	buckets[std::min(bucket,(uint)BUCKET_COUNT-1)]++;
+}
+
+uint Profiler::Histogram::GetPercentile(float p) const{
+	if(count == 0)
+		return 0;
+	uint64 n = (uint64)(p*(float)count), sum = 0;
+	for(uint i = 0; i < BUCKET_COUNT; ++i){
+		sum += buckets[i];
+		if(sum > n)
+			return 1u<<i;
+	}
+	return 1u<<(BUCKET_COUNT-1);
+}
+
+void Profiler::Histogram::Print(FILE *pf, const char *pname) const{
+	fprintf(pf,"%-14s %11llu %9.1f %9u %9u %9.1f\n",pname,count,
+		count > 0?(float)totalTime/(float)count*1e-3f:0.0f,
+		GetPercentile(0.5f),GetPercentile(0.99f),(float)maxTime*1e-3f);
+}
+
+void Profiler::Histogram::WriteJSON(FILE *pf) const{
+	fprintf(pf,"{\"count\": %llu, \"totalUs\": %.1f, \"meanUs\": %.1f, \"p50Us\": %u, \"p99Us\": %u, \"maxUs\": %.1f}",
+		count,(float)totalTime*1e-3f,
+		count > 0?(float)totalTime/(float)count*1e-3f:0.0f,
+		GetPercentile(0.5f),GetPercentile(0.99f),(float)maxTime*1e-3f);
+}
+
+Profiler::Histogram KeyLatency::histograms[STAGE_COUNT] = {};
+const char *KeyLatency::pstageNames[STAGE_COUNT] = {
+	"inject","dispatch","layout","requests","present"
+};
+std::atomic<uint64> KeyLatency::injectTime(0);
+uint64 KeyLatency::beginTime = 0;
+uint64 KeyLatency::stageTimes[STAGE_COUNT] = {};
+
+void KeyLatency::Begin(){
+	if(beginTime != 0)
+		return; //the stages of the earlier key press cover this one as well
+	beginTime = Profiler::GetTime();
+	uint64 t = injectTime.exchange(0);
+	if(t != 0 && t < beginTime)
+		histograms[STAGE_INJECT].Add(beginTime-t);
+}
+
+void KeyLatency::Mark(STAGE stage){
+	if(beginTime == 0)
+		return;
+	stageTimes[stage] = Profiler::GetTime();
+}
+
+void KeyLatency::End(){
+	if(beginTime == 0)
+		return;
+	Mark(STAGE_PRESENT);
+	for(uint i = STAGE_DISPATCH; i < STAGE_COUNT; ++i)
+		if(stageTimes[i] != 0){
+			histograms[i].Add(stageTimes[i]-beginTime);
+			stageTimes[i] = 0;
+		}
+	beginTime = 0;
+}
+
+void KeyLatency::Print(FILE *pf){
+	fprintf(pf,"Key latency (us)     count      mean     p50<=     p99<=       max\n");
+	for(uint i = 0; i < STAGE_COUNT; ++i)
+		histograms[i].Print(pf,pstageNames[i]);
+	fflush(pf);
+}
+
+void KeyLatency::WriteJSON(FILE *pf){
+	fprintf(pf,"{");
+	for(uint i = 0; i < STAGE_COUNT; ++i){
+		fprintf(pf,"%s\"%s\": ",i > 0?", ":"",pstageNames[i]);
+		histograms[i].WriteJSON(pf);
+	}
+	fprintf(pf,"}");
+}
+
+#ifdef CHAMFER_ALLOC_PROFILE
+thread_local const char *AllocProfiler::pscopeName = 0;
+AllocProfiler::Entry AllocProfiler::scopes[SCOPE_TABLE_SIZE] = {};
+AllocProfiler::Entry AllocProfiler::sites[SITE_TABLE_SIZE] = {};
+uint64 AllocProfiler::frameCount = 0;
+uint64 AllocProfiler::frameBytes = 0;
+TimingStats AllocProfiler::frameCountStats;
+TimingStats AllocProfiler::frameByteStats;
+thread_local bool AllocProfiler::profiled = false;
+thread_local bool AllocProfiler::busy = false;
+
+void AllocProfiler::Initialize(){
+	profiled = true;
+}
+
+//Called from the allocator: must not allocate.
+void AllocProfiler::Add(size_t size, const void *psite){
+	if(!profiled || busy)
+		return;
+	busy = true;
+	static const char *potherName = "(other)";
+	Entry *pentry = Find(scopes,SCOPE_TABLE_SIZE,pscopeName?pscopeName:potherName);
+	if(pentry){
+		pentry->count++;
+		pentry->bytes += size;
+	}
+	pentry = Find(sites,SITE_TABLE_SIZE,psite);
+	if(pentry){
+		pentry->count++;
+		pentry->bytes += size;
+	}
+	frameCount++;
+	frameBytes += size;
+	busy = false;
+}
+
+void AllocProfiler::EndFrame(){
+	frameCountStats.Add((float)frameCount);
+	frameByteStats.Add((float)frameBytes);
+	frameCount = 0;
+	frameBytes = 0;
+}
+
+AllocProfiler::Entry * AllocProfiler::Find(Entry *ptable, uint size, const void *pkey){
+	uint i = (uint)(((uintptr_t)pkey*0x9e3779b97f4a7c15ull)>>40)%size;
+	for(uint j = 0; j < size; ++j, i = (i+1)%size){
+		if(ptable[i].pkey == pkey)
+			return &ptable[i];
+		if(!ptable[i].pkey){
+			ptable[i].pkey = pkey;
+			return &ptable[i];
+		}
+	}
+	return 0;
+}
+
+void AllocProfiler::SortEntries(const Entry *ptable, uint size, std::vector<const Entry *> &entries){
+	for(uint i = 0; i < size; ++i)
+		if(ptable[i].pkey)
+			entries.push_back(&ptable[i]);
+	std::sort(entries.begin(),entries.end(),[](const Entry *pa, const Entry *pb)->bool{
+		return pa->count > pb->count;
+	});
+}
+
+//Symbol of the function containing the call site, demangled if possible.
+static void GetSiteName(const void *psite, char *pbuffer, size_t bufferSize){
+	Dl_info info;
+	if(!dladdr(psite,&info) || !info.dli_sname){
+		snprintf(pbuffer,bufferSize,"%p (%s)",psite,info.dli_fname?info.dli_fname:"?");
+		return;
+	}
+	sint status;
+	char *pdemangled = abi::__cxa_demangle(info.dli_sname,0,0,&status);
+	snprintf(pbuffer,bufferSize,"%s+0x%lx",pdemangled?pdemangled:info.dli_sname,(unsigned long)((const char *)psite-(const char *)info.dli_saddr));
+	free(pdemangled);
+}
+
+void AllocProfiler::Print(FILE *pf){
+	busy = true;
+	fprintf(pf,"Allocations per frame: %.1f mean, %.0f p99, %.0f bytes mean\n",
+		frameCountStats.GetMean(),frameCountStats.GetPercentile(0.99f),frameByteStats.GetMean());
+	std::vector<const Entry *> entries;
+	SortEntries(scopes,SCOPE_TABLE_SIZE,entries);
+	fprintf(pf,"%-28s %12s %14s\n","allocations by scope","count","bytes");
+	for(const Entry *pentry : entries)
+		fprintf(pf,"%-28s %12llu %14llu\n",(const char *)pentry->pkey,pentry->count,pentry->bytes);
+
+	entries.clear();
+	SortEntries(sites,SITE_TABLE_SIZE,entries);
+	fprintf(pf,"%12s %14s  call site\n","count","bytes");
+	char name[256];
+	for(uint i = 0; i < std::min((uint)entries.size(),32u); ++i){
+		GetSiteName(entries[i]->pkey,name,sizeof(name));
+		fprintf(pf,"%12llu %14llu  %s\n",entries[i]->count,entries[i]->bytes,name);
+	}
+	fflush(pf);
+	busy = false;
+}
+
+void AllocProfiler::WriteJSON(FILE *pf){
+	busy = true;
+	fprintf(pf,"{\"perFrame\": {\"countMean\": %.1f, \"countP99\": %.0f, \"bytesMean\": %.0f},\n\"scopes\": {",
+		frameCountStats.GetMean(),frameCountStats.GetPercentile(0.99f),frameByteStats.GetMean());
+	std::vector<const Entry *> entries;
+	SortEntries(scopes,SCOPE_TABLE_SIZE,entries);
+	for(uint i = 0; i < entries.size(); ++i)
+		fprintf(pf,"%s\"%s\": {\"count\": %llu, \"bytes\": %llu}",i > 0?", ":"",(const char *)entries[i]->pkey,entries[i]->count,entries[i]->bytes);
+
+	entries.clear();
+	SortEntries(sites,SITE_TABLE_SIZE,entries);
+	fprintf(pf,"},\n\"sites\": [");
+	char name[256];
+	for(uint i = 0; i < std::min((uint)entries.size(),32u); ++i){
+		GetSiteName(entries[i]->pkey,name,sizeof(name));
+		for(char *pc = name; *pc; ++pc)
+			if(*pc == '"' || *pc == '\\')
+				*pc = '\'';
+		fprintf(pf,"%s{\"site\": \"%s\", \"count\": %llu, \"bytes\": %llu}",i > 0?", ":"",name,entries[i]->count,entries[i]->bytes);
+	}
+	fprintf(pf,"]}");
+	busy = false;
+}
+
+//Allocations are counted at the entry points called by the code itself, so that the call site is
+//the caller's. operator new allocates directly from the libc allocator, to not be counted twice.
+extern "C"{
+void * __libc_malloc(size_t);
+void * __libc_calloc(size_t, size_t);
+void * __libc_realloc(void *, size_t);
+
+void * malloc(size_t size){
+	AllocProfiler::Add(size,__builtin_return_address(0));
+	return __libc_malloc(size);
+}
+
+void * calloc(size_t n, size_t size){
+	AllocProfiler::Add(n*size,__builtin_return_address(0));
+	return __libc_calloc(n,size);
+}
+
+void * realloc(void *p, size_t size){
+	AllocProfiler::Add(size,__builtin_return_address(0));
+	return __libc_realloc(p,size);
+}
+}
+
+static inline void * AllocateProfiled(size_t size, const void *psite){
+	AllocProfiler::Add(size,psite);
+	void *p = __libc_malloc(size?size:1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void * operator new(size_t size){
+	return AllocateProfiled(size,__builtin_return_address(0));
+}
+
+void * operator new[](size_t size){
+	return AllocateProfiled(size,__builtin_return_address(0));
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept{
+	AllocProfiler::Add(size,__builtin_return_address(0));
+	return __libc_malloc(size?size:1);
+}
+
+void * operator new[](size_t size, const std::nothrow_t &) noexcept{
+	AllocProfiler::Add(size,__builtin_return_address(0));
+	return __libc_malloc(size?size:1);
+}
+#endif
+
+bool Tracer::enabled = false;
+char *Tracer::pfileName = 0;
+
+struct TraceRing{
+	struct Span{
+		const char *pname;
+		uint64 beginTime;
+		uint64 endTime;
+	} spans[Tracer::RING_SIZE];
+	std::atomic<uint64> head; //spans written in total
+	uint tid;
+};
+static std::vector<TraceRing *> traceRings;
+static std::mutex traceRingMutex; //only for the registration of new threads
+static thread_local TraceRing *ptraceRing = 0;
+
+void Tracer::Initialize(const char *_pfileName){
+	pfileName = new char[strlen(_pfileName)+1];
+	strcpy(pfileName,_pfileName);
+	enabled = true;
+}
+
+void Tracer::AddSpan(const char *pname, uint64 beginTime, uint64 endTime){
+	if(!ptraceRing){
+		ptraceRing = new TraceRing;
+		ptraceRing->head = 0;
+		std::lock_guard<std::mutex> lock(traceRingMutex);
+		ptraceRing->tid = traceRings.size()+1;
+		traceRings.push_back(ptraceRing);
+	}
+	//single writer per ring
+	uint64 head = ptraceRing->head.load(std::memory_order_relaxed);
+	TraceRing::Span &span = ptraceRing->spans[head%RING_SIZE];
+	span.pname = pname;
+	span.beginTime = beginTime;
+	span.endTime = endTime;
+	ptraceRing->head.store(head+1,std::memory_order_release);
+}
+
+void Tracer::Write(){
+	if(!enabled)
+		return;
+	enabled = false;
+
+	FILE *pf = fopen(pfileName,"w");
+	if(!pf){
+		DebugPrintf(stderr,"Unable to open trace file %s\n",pfileName);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(traceRingMutex);
+	fprintf(pf,"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	const char *psep = "";
+	for(TraceRing *pring : traceRings){
+		uint64 head = pring->head.load(std::memory_order_acquire);
+		for(uint64 i = head > RING_SIZE?head-RING_SIZE:0; i < head; ++i){
+			const TraceRing::Span &span = pring->spans[i%RING_SIZE];
+			fprintf(pf,"%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",psep,span.pname,pring->tid,
+				(double)span.beginTime*1e-3,(double)(span.endTime-span.beginTime)*1e-3);
+			psep = ",\n";
+		}
+	}
+	fprintf(pf,"\n]}\n");
+	fclose(pf);
+
+	DebugPrintf(stdout,"Trace written to %s\n",pfileName);
+	delete []pfileName;
+	pfileName = 0;
+}
+
 Blob::Blob(const char *pfileName){
 	FILE *pf;
 	do{
@@ -80,25 +506,141 @@ size_t Blob::GetBufferLength() const{
 	return buflen;
 }
 
-void DebugPrintf(FILE *pf, const char *pfmt, ...){
-	time_t rt;
-	time(&rt);
-	const struct tm *pti = localtime(&rt);
+struct LogRing{
+	enum{
+		RECORD_COUNT = 1024
+	};
+	struct Record{
+		struct timespec time;
+		uint level;
+		char msg[500]; //longer messages are truncated
+	} records[RECORD_COUNT];
+	std::atomic<uint> head; //written by the owning thread
+	std::atomic<uint> tail; //read by the log thread
+	std::atomic<uint> dropCount;
+};
+
+static bool logStopped = false; //messages after the logger has been destroyed are written directly
+
+//Log thread, started with the first message. Drains the rings on exit.
+static class Logger{
+public:
+	Logger() : started(false), exit(false){}
+	~Logger(){
+		logStopped = true;
+		if(!started)
+			return;
+		std::unique_lock<std::mutex> lock(mutex);
+		exit = true;
+		lock.unlock();
+		cond.notify_one();
+		thread.join();
+		Drain();
+	}
+	LogRing * Register(){
+		LogRing *pring = new LogRing;
+		pring->head = 0;
+		pring->tail = 0;
+		pring->dropCount = 0;
+		std::lock_guard<std::mutex> lock(mutex);
+		rings.push_back(pring);
+		if(!started){
+			started = true;
+			thread = std::thread(&Logger::Run,this);
+		}
+		return pring;
+	}
+	void Notify(){
+		cond.notify_one();
+	}
+	void Drain(){
+		std::lock_guard<std::mutex> drainLock(drainMutex); //the log thread and LogFlush() may drain concurrently
+		std::vector<LogRing *> rings1;
+		std::unique_lock<std::mutex> lock(mutex);
+		rings1 = rings;
+		lock.unlock();
+		for(LogRing *pring : rings1){
+			uint tail = pring->tail.load(std::memory_order_relaxed);
+			for(uint head = pring->head.load(std::memory_order_acquire); tail != head; ++tail){
+				const LogRing::Record &record = pring->records[tail%LogRing::RECORD_COUNT];
+				time_t rt = record.time.tv_sec;
+				struct tm ti;
+				localtime_r(&rt,&ti);
+				char tbuf[256];
+				strftime(tbuf,sizeof(tbuf),"[chamferwm %F %T]",&ti);
+				FILE *pf = record.level == LOG_LEVEL_ERROR?stderr:stdout;
+				fprintf(pf,"%s %s%s",tbuf,record.level == LOG_LEVEL_ERROR?"Error: ":record.level == LOG_LEVEL_DEBUG?"Debug: ":"",record.msg);
+			}
+			pring->tail.store(tail,std::memory_order_release);
+			uint dropCount = pring->dropCount.exchange(0);
+			if(dropCount > 0)
+				fprintf(stderr,"[chamferwm] %u log messages dropped\n",dropCount);
+		}
+		fflush(stdout);
+	}
+private:
+	void Run(){
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!exit){
+			cond.wait_for(lock,std::chrono::milliseconds(50));
+			lock.unlock();
+			Drain();
+			lock.lock();
+		}
+	}
+	std::vector<LogRing *> rings;
+	std::mutex mutex;
+	std::mutex drainMutex;
+	std::condition_variable cond;
+	std::thread thread;
+	bool started;
+	bool exit;
+} logger;
+
+static thread_local LogRing *plogRing = 0;
+
+static void LogPrintfV(uint level, const char *pfmt, va_list args){
+	if(logStopped){
+		vfprintf(level == LOG_LEVEL_ERROR?stderr:stdout,pfmt,args);
+		return;
+	}
+	if(!plogRing)
+		plogRing = logger.Register();
+	//single producer, messages are dropped rather than blocking when the log thread falls behind
+	uint head = plogRing->head.load(std::memory_order_relaxed);
+	if(head-plogRing->tail.load(std::memory_order_acquire) >= LogRing::RECORD_COUNT){
+		plogRing->dropCount++;
+		return;
+	}
+	LogRing::Record &record = plogRing->records[head%LogRing::RECORD_COUNT];
+	clock_gettime(CLOCK_REALTIME,&record.time);
+	record.level = level;
+	if(vsnprintf(record.msg,sizeof(record.msg),pfmt,args) >= (sint)sizeof(record.msg))
+		record.msg[sizeof(record.msg)-2] = '\n';
+	plogRing->head.store(head+1,std::memory_order_release);
+	if(level == LOG_LEVEL_ERROR)
+		logger.Notify();
+}
 
-	//pf = fopen("/tmp/log1","a+");
-	char tbuf[256];
-	strftime(tbuf,sizeof(tbuf),"[chamferwm %F %T]",pti);
-	fprintf(pf,"%s ",tbuf);
+void LogPrintf(uint level, const char *pfmt, ...){
+	va_list args;
+	va_start(args,pfmt);
+	LogPrintfV(level,pfmt,args);
+	va_end(args);
+}
 
+void DebugPrintf(FILE *pf, const char *pfmt, ...){
 	va_list args;
 	va_start(args,pfmt);
-	if(pf == stderr)
-		fprintf(pf,"Error: ");
-	vfprintf(pf,pfmt,args);
-	//fclose(pf);
+	LogPrintfV(pf == stderr?LOG_LEVEL_ERROR:LOG_LEVEL_INFO,pfmt,args);
 	va_end(args);
 }
 
+void LogFlush(){
+	if(!logStopped)
+		logger.Drain();
+}
+
 class RunBackend{
 public:
 	RunBackend(WManager::Container *_proot) : proot(_proot), pcomp(0){}
@@ -169,7 +711,7 @@ public:
 	void MoveContainer(WManager::Container *pcontainer, WManager::Container *pdst){
 		//
 		PrintTree(proot,0);
-		printf("-----------\n");
+		DebugLog("-----------\n");
 
 		if(pcontainer == pdst)
 			return;
@@ -183,9 +725,9 @@ public:
 		}
 		pcontainer->Place(pdst);
 
-		printf("----------- removed %p\n",premoved);
+		DebugLog("----------- removed %p\n",premoved);
 		PrintTree(proot,0);
-		printf("-----------\n");
+		DebugLog("-----------\n");
 
 		WManager::Container *pNewParent = premoved->pParent;
 
@@ -217,7 +759,7 @@ public:
 		Config::BackendInterface::SetFocus(pcontainer);
 
 		PrintTree(proot,0);
-		printf("-----------\n");
+		DebugLog("-----------\n");
 
 		//if(premoved->pch)
 			//ReleaseContainersRecursive(premoved->pch); //should this be here??? once container trees can be moved
@@ -259,22 +801,17 @@ public:
 	}
 
 	void PrintTree(WManager::Container *pcontainer, uint level) const{
-		for(uint i = 0; i < level; ++i)
-			printf(" ");
-		printf("%p: ",pcontainer);
-		if(pcontainer->pclient)
-			printf("(client), ");
-		if(pcontainer->pParent)
-			printf("(parent: %p), ",pcontainer->pParent);
-		if(Config::BackendInterface::pfocus == pcontainer)
-			printf("(focus), ");
+#ifdef CHAMFER_DEBUG_LOG
 		Config::ContainerConfig *pcontainerConfig = dynamic_cast<Config::ContainerConfig *>(pcontainer);
-		printf("[ContainerConfig: %p, (->container: %p)], ",pcontainerConfig,pcontainerConfig->pcontainerInt->pcontainer);
-		printf("focusQueue: %lu (%p)\n",pcontainer->focusQueue.size(),pcontainer->focusQueue.size() > 0?pcontainer->focusQueue.back():0);
+		DebugLog("%*s%p: %s(parent: %p), %s[ContainerConfig: %p, (->container: %p)], focusQueue: %lu (%p)\n",level,"",pcontainer,
+			pcontainer->pclient?"(client), ":"",pcontainer->pParent,Config::BackendInterface::pfocus == pcontainer?"(focus), ":"",
+			pcontainerConfig,pcontainerConfig->pcontainerInt->pcontainer,pcontainer->focusQueue.size(),pcontainer->focusQueue.size() > 0?pcontainer->focusQueue.back():0);
 		for(WManager::Container *pcontainer1 = pcontainer->pch; pcontainer1; pcontainer1 = pcontainer1->pnext)
 			PrintTree(pcontainer1,level+1);
+#endif
 	}
 
+
 //protected:
 	WManager::Container *proot;
 	std::vector<std::pair<const WManager::Client *, WManager::Client *>> stackAppendix;
@@ -286,7 +823,7 @@ class RunCompositor{
 public:
 	RunCompositor(WManager::Container *_proot, std::vector<std::pair<const WManager::Client *, WManager::Client *>> *_pstackAppendix) : proot(_proot), pstackAppendix(_pstackAppendix){}
 	virtual ~RunCompositor(){}
-	virtual void Present() = 0;
+	virtual bool Present() = 0; //false if the frame had to be deferred
 	virtual void WaitIdle() = 0;
 protected:
 	WManager::Container *proot;
@@ -435,7 +972,7 @@ public:
 		WManager::Container *premoved = pclient->pcontainer->Remove();
 		WManager::Container *pOrigParent = premoved->pParent;
 
-		printf("----------- removed %p\n",premoved);
+		DebugLog("----------- removed %p\n",premoved);
 		PrintTree(proot,0);
 
 		WManager::Container *pcollapsed = 0;
@@ -462,9 +999,9 @@ public:
 			delete pcollapsed;
 		}
 
-		printf("----------- collapsed %p\n",pcollapsed);
+		DebugLog("----------- collapsed %p\n",pcollapsed);
 		PrintTree(proot,0);
-		printf("stackAppendix: %lu\n",stackAppendix.size());
+		DebugLog("stackAppendix: %lu\n",stackAppendix.size());
 	}
 
 	void EventNotify(const Backend::BackendEvent *pevent){
@@ -521,7 +1058,11 @@ public:
 	}
 
 	Backend::DebugClient * SetupClient(const Backend::DebugClient::CreateInfo *pcreateInfo){
-		Config::ContainerInterface &containerInt = SetupContainer<Config::DebugContainerConfig,DebugBackend>(0,0);
+		return SetupClient(0,pcreateInfo);
+	}
+
+	Backend::DebugClient * SetupClient(WManager::Container *pParent, const Backend::DebugClient::CreateInfo *pcreateInfo){
+		Config::ContainerInterface &containerInt = SetupContainer<Config::DebugContainerConfig,DebugBackend>(pParent,0);
 
 		static const char *pshaderName[Compositor::Pipeline::SHADER_MODULE_COUNT] = {
 			"frame_vertex.spv","frame_geometry.spv","frame_fragment.spv"
@@ -544,7 +1085,31 @@ public:
 		RunBackend::MoveContainer<Config::DebugContainerConfig,DebugBackend>(pcontainer,pdst);
 	}
 
+	//Synthetic clients for --stress. The clients are placed in the given number of columns, or
+	//wherever the configuration parents them if zero.
+	void CreateStressClients(uint count, uint columnCount, uint damagePattern){
+		std::vector<WManager::Container *> columns;
+		for(uint i = 0; i < columnCount; ++i)
+			columns.push_back(SetupContainer<Config::DebugContainerConfig,DebugBackend>(proot,0).pcontainer);
+
+		Backend::DebugClient::CreateInfo createInfo = {};
+		createInfo.pbackend = this;
+		for(uint i = 0; i < count; ++i){
+			Backend::DebugClient *pclient = SetupClient(columnCount > 0?columns[i%columnCount]:0,&createInfo);
+			clients.push_back(pclient);
+
+			Compositor::X11DebugClientFrame *pclientFrame = dynamic_cast<Compositor::X11DebugClientFrame *>(pclient);
+			if(!pclientFrame)
+				continue;
+			//mixed load cycles through the patterns
+			pclientFrame->damagePattern = damagePattern != Compositor::X11DebugClientFrame::DAMAGE_PATTERN_NONE?damagePattern:1+i%(Compositor::X11DebugClientFrame::DAMAGE_PATTERN_COUNT-1);
+			stressClients.push_back(pclientFrame);
+		}
+		DebugPrintf(stdout,"Created %u stress clients.\n",count);
+	}
+
 	void DestroyClient(Backend::DebugClient *pclient){
+		stressClients.erase(std::remove(stressClients.begin(),stressClients.end(),dynamic_cast<Compositor::X11DebugClientFrame *>(pclient)),stressClients.end());
 		WManager::Client *pbase = pclient;
 		auto m = std::find_if(stackAppendix.begin(),stackAppendix.end(),[&](auto &p)->bool{
 			return pbase == p.second;
@@ -610,11 +1175,13 @@ public:
 	void TimerEvent(){
 		//
 	}
+
+	std::vector<Compositor::X11DebugClientFrame *> stressClients;
 };
 
 class DefaultCompositor : public Compositor::X11Compositor, public RunCompositor{
 public:
-	DefaultCompositor(uint gpuIndex, WManager::Container *_proot, std::vector<std::pair<const WManager::Client *, WManager::Client *>> *_pstackAppendix, Backend::X11Backend *pbackend, args::ValueFlagList<std::string> &shaderPaths) : X11Compositor(gpuIndex,pbackend), RunCompositor(_proot,_pstackAppendix){
+	DefaultCompositor(const Configuration *pconfig, WManager::Container *_proot, std::vector<std::pair<const WManager::Client *, WManager::Client *>> *_pstackAppendix, Backend::X11Backend *pbackend, args::ValueFlagList<std::string> &shaderPaths) : X11Compositor(pconfig,pbackend), RunCompositor(_proot,_pstackAppendix){
 		Start();
 
 		for(auto &m : args::get(shaderPaths)){
@@ -628,6 +1195,10 @@ public:
 			}
 		}
 
+		if(pconfig->prebuildPipelines)
+			PrebuildPipelines();
+		InitializeInstancedRenderer();
+
 		DebugPrintf(stdout,"Compositor enabled.\n");
 	}
 
@@ -635,11 +1206,13 @@ public:
 		Stop();
 	}
 
-	void Present(){
+	bool Present(){
 		if(!PollFrameFence())
-			return;
+			return false;
+		SetDebugMode(Config::CompositorInterface::debugMode);
 		GenerateCommandBuffers(proot,pstackAppendix,Config::BackendInterface::pfocus);
 		Compositor::X11Compositor::Present();
+		return true;
 	}
 
 	void WaitIdle(){
@@ -649,7 +1222,7 @@ public:
 
 class DebugCompositor : public Compositor::X11DebugCompositor, public RunCompositor{
 public:
-	DebugCompositor(uint gpuIndex, WManager::Container *_proot, std::vector<std::pair<const WManager::Client *, WManager::Client *>> *_pstackAppendix, Backend::X11Backend *pbackend, args::ValueFlagList<std::string> &shaderPaths) : X11DebugCompositor(gpuIndex,pbackend), RunCompositor(_proot,_pstackAppendix){
+	DebugCompositor(const Configuration *pconfig, WManager::Container *_proot, std::vector<std::pair<const WManager::Client *, WManager::Client *>> *_pstackAppendix, Backend::X11Backend *pbackend, args::ValueFlagList<std::string> &shaderPaths) : X11DebugCompositor(pconfig,pbackend), RunCompositor(_proot,_pstackAppendix), pstressClients(0){
 		Compositor::X11DebugCompositor::Start();
 
 		for(auto &m : args::get(shaderPaths)){
@@ -663,6 +1236,10 @@ public:
 			}
 		}
 
+		if(pconfig->prebuildPipelines)
+			PrebuildPipelines();
+		InitializeInstancedRenderer();
+
 		DebugPrintf(stdout,"Compositor enabled.\n");
 	}
 
@@ -670,16 +1247,134 @@ public:
 		Compositor::X11DebugCompositor::Stop();
 	}
 
-	void Present(){
+	bool Present(){
 		if(!PollFrameFence())
-			return;
+			return false;
+		SetDebugMode(Config::CompositorInterface::debugMode);
+		if(pstressClients)
+			DamageStressClients();
 		GenerateCommandBuffers(proot,pstackAppendix,Config::BackendInterface::pfocus);
 		Compositor::X11DebugCompositor::Present();
+		if(pstressClients)
+			UpdateStressStats();
+		return true;
 	}
 
 	void WaitIdle(){
 		Compositor::X11DebugCompositor::WaitIdle();
 	}
+
+	void SetStressClients(const std::vector<Compositor::X11DebugClientFrame *> *_pstressClients){
+		pstressClients = _pstressClients;
+		stressFrameTime = stressReportTime = stressBlinkTime = Profiler::GetTime();
+		stressReportFrameTag = frameTag;
+		stressReportByteCount = uploadByteCount;
+	}
+
+private:
+	void DamageStressClients(){
+		//the cursors blink twice a second regardless of the frame rate
+		uint64 t = Profiler::GetTime();
+		bool blink = t >= stressBlinkTime;
+		if(blink)
+			stressBlinkTime = t+500000000ull;
+		for(Compositor::X11DebugClientFrame *pclientFrame : *pstressClients)
+			if(pclientFrame->damagePattern != Compositor::X11DebugClientFrame::DAMAGE_PATTERN_BLINK || blink)
+				Damage(pclientFrame);
+	}
+
+	void UpdateStressStats(){
+		uint64 t = Profiler::GetTime();
+		stressFrameStats.Add((float)(t-stressFrameTime)*1e-6f);
+		stressFrameTime = t;
+		if(t-stressReportTime < 1000000000ull)
+			return;
+		float dt = (float)(t-stressReportTime)*1e-9f;
+		DebugPrintf(stdout,"stress: %zu clients, %.1f fps, frame %.3f ms (p99 %.3f ms), upload %.1f MB/s\n",
+			pstressClients->size(),(float)(frameTag-stressReportFrameTag)/dt,stressFrameStats.GetMean(),stressFrameStats.GetPercentile(0.99f),
+			(float)(uploadByteCount-stressReportByteCount)/(1e6f*dt));
+		stressReportTime = t;
+		stressReportFrameTag = frameTag;
+		stressReportByteCount = uploadByteCount;
+	}
+
+	const std::vector<Compositor::X11DebugClientFrame *> *pstressClients;
+	TimingStats stressFrameStats;
+	uint64 stressFrameTime;
+	uint64 stressReportTime;
+	uint64 stressBlinkTime; //next damage of the blink pattern
+	uint64 stressReportFrameTag;
+	uint64 stressReportByteCount;
+};
+
+class HeadlessCompositor : public Compositor::HeadlessCompositor, public RunCompositor{
+public:
+	HeadlessCompositor(const Configuration *pconfig, WManager::Container *_proot, std::vector<std::pair<const WManager::Client *, WManager::Client *>> *_pstackAppendix, uint w, uint h, args::ValueFlagList<std::string> &shaderPaths) : Compositor::HeadlessCompositor(pconfig,w,h), RunCompositor(_proot,_pstackAppendix){
+		Compositor::HeadlessCompositor::Start();
+
+		for(auto &m : args::get(shaderPaths)){
+			boost::filesystem::directory_iterator end;
+			for(boost::filesystem::directory_iterator di(m); di != end; ++di){
+				if(boost::filesystem::is_regular_file(di->status()) &&
+					boost::filesystem::extension(di->path()) == ".spv"){
+					Blob blob(di->path().string().c_str());
+					AddShader(di->path().filename().string().c_str(),&blob);
+				}
+			}
+		}
+
+		if(pconfig->prebuildPipelines)
+			PrebuildPipelines();
+		InitializeInstancedRenderer();
+
+		DebugPrintf(stdout,"Headless compositor enabled.\n");
+	}
+
+	~HeadlessCompositor(){
+		Compositor::HeadlessCompositor::Stop();
+	}
+
+	bool Present(){
+		if(!PollFrameFence())
+			return false;
+		SetDebugMode(Config::CompositorInterface::debugMode);
+		GenerateCommandBuffers(proot,pstackAppendix,Config::BackendInterface::pfocus);
+		Compositor::HeadlessCompositor::Present();
+		return true;
+	}
+
+	void WaitIdle(){
+		Compositor::HeadlessCompositor::WaitIdle();
+	}
+
+	bool PipelinesPending() const{
+		return pipelineWaitQueue.size() > 0;
+	}
+
+	const TimingStats & GetRecordStats() const{
+		return recordStats;
+	}
+
+	const TimingStats & GetRenderPassStats() const{
+		return passStats[TIMESTAMP_PASS_RENDER];
+	}
+
+	//GPU time of the window draws through the pipelines of the given variant
+	TimingStats GetDrawStats(uint variant) const{
+		for(auto &m : pipelineStats)
+			if(m.first->stateKey == variant)
+				return m.second;
+		return TimingStats();
+	}
+
+	//Discards the statistics of the warm-up frames.
+	void ResetStats(){
+		recordStats = TimingStats();
+		for(uint i = 0; i < TIMESTAMP_PASS_COUNT; ++i)
+			passStats[i] = TimingStats();
+		backgroundStats = TimingStats();
+		pipelineStats.clear();
+	}
 };
 
 class NullCompositor : public Compositor::NullCompositor, public RunCompositor{
@@ -692,8 +1387,8 @@ public:
 		Stop();
 	}
 
-	void Present(){
-		//
+	bool Present(){
+		return true;
 	}
 
 	void WaitIdle(){
@@ -701,19 +1396,744 @@ public:
 	}
 };
 
+//Synthetic window management load: a separate X client on its own thread that first maps a burst
+//of windows at once, as a session restore does, and then creates, reconfigures, renames and destroys
+//windows at the given rate, some of them transient dialogs or floating. The time from each map
+//request to the MapNotify is the delay the window manager adds.
+class WindowStorm{
+public:
+	WindowStorm(uint _rate, uint _burstCount, uint _duration) : rate(_rate), burstCount(_burstCount), duration(_duration), seed(1), createCount(0), configureCount(0), renameCount(0), destroyCount(0), burstRemaining(0), burstTime(-1.0f), stop(false), finished(false){
+		pcon = xcb_connect(0,0);
+		if(xcb_connection_has_error(pcon)){
+			xcb_disconnect(pcon);
+			throw Exception("Storm client failed to connect to the X server.");
+		}
+		pscr = xcb_setup_roots_iterator(xcb_get_setup(pcon)).data;
+
+		static const char *patomStrs[ATOM_COUNT] = {
+			"_NET_WM_NAME","UTF8_STRING","_NET_WM_WINDOW_TYPE","_NET_WM_WINDOW_TYPE_DIALOG"
+		};
+		xcb_intern_atom_cookie_t atomCookies[ATOM_COUNT];
+		for(uint i = 0; i < ATOM_COUNT; ++i)
+			atomCookies[i] = xcb_intern_atom(pcon,0,strlen(patomStrs[i]),patomStrs[i]);
+		for(uint i = 0; i < ATOM_COUNT; ++i){
+			xcb_intern_atom_reply_t *patomReply = xcb_intern_atom_reply(pcon,atomCookies[i],0);
+			atoms[i] = patomReply?patomReply->atom:XCB_ATOM_NONE;
+			free(patomReply);
+		}
+
+		thread = std::thread(&WindowStorm::Run,this);
+	}
+
+	~WindowStorm(){
+		Stop();
+		xcb_disconnect(pcon);
+	}
+
+	void Stop(){
+		stop = true;
+		if(thread.joinable())
+			thread.join();
+	}
+
+	bool IsFinished() const{
+		return finished;
+	}
+
+	//Only after Stop()
+	void Print(FILE *pf) const{
+		fprintf(pf,"Storm: %u created, %u configured, %u renamed, %u destroyed\n",createCount,configureCount,renameCount,destroyCount);
+		if(burstTime >= 0.0f)
+			fprintf(pf,"Burst of %u windows mapped in %.3f ms\n",burstCount,burstTime);
+		else
+		if(burstCount > 0)
+			fprintf(pf,"Burst of %u windows: %u were not mapped\n",burstCount,burstRemaining);
+		fprintf(pf,"%-28s %8s %8s %8s %8s\n","map latency (ms)","mean","p50","p99","count");
+		fprintf(pf,"%-28s %8.3f %8.3f %8.3f %8u\n","request to notify",mapLatency.GetMean(),mapLatency.GetPercentile(0.5f),mapLatency.GetPercentile(0.99f),mapLatency.GetCount());
+	}
+
+private:
+	uint Random(){
+		seed = seed*1103515245+12345;
+		return (seed>>16)&0x7fff;
+	}
+
+	xcb_window_t CreateWindow(bool transient, bool floating){
+		xcb_window_t window = xcb_generate_id(pcon);
+		uint w = 200+Random()%600, h = 150+Random()%450;
+		uint values[2] = {0xff000000|(Random()<<9)|Random(),XCB_EVENT_MASK_STRUCTURE_NOTIFY};
+		xcb_create_window(pcon,XCB_COPY_FROM_PARENT,window,pscr->root,0,0,w,h,0,XCB_WINDOW_CLASS_INPUT_OUTPUT,pscr->root_visual,XCB_CW_BACK_PIXEL|XCB_CW_EVENT_MASK,values);
+
+		static const char wmClass[] = "chamfer-storm\0ChamferStorm";
+		xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,window,XCB_ATOM_WM_CLASS,XCB_ATOM_STRING,8,sizeof(wmClass),wmClass);
+		Rename(window);
+		if(transient && windows.size() > 0){
+			xcb_window_t baseWindow = windows[Random()%windows.size()];
+			xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,window,XCB_ATOM_WM_TRANSIENT_FOR,XCB_ATOM_WINDOW,32,1,&baseWindow);
+		}
+		if(transient || floating)
+			xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,window,atoms[ATOM_NET_WM_WINDOW_TYPE],XCB_ATOM_ATOM,32,1,&atoms[ATOM_NET_WM_WINDOW_TYPE_DIALOG]);
+
+		mapTimes[window] = Profiler::GetTime();
+		xcb_map_window(pcon,window);
+		windows.push_back(window);
+		++createCount;
+		return window;
+	}
+
+	void Rename(xcb_window_t window){
+		char title[64];
+		uint l = snprintf(title,sizeof(title),"storm %x, title %u",window,Random());
+		xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,window,atoms[ATOM_NET_WM_NAME],atoms[ATOM_UTF8_STRING],8,l,title);
+		xcb_change_property(pcon,XCB_PROP_MODE_REPLACE,window,XCB_ATOM_WM_NAME,XCB_ATOM_STRING,8,l,title);
+	}
+
+	void DestroyWindow(uint index){
+		xcb_window_t window = windows[index];
+		xcb_destroy_window(pcon,window);
+		mapTimes.erase(window);
+		windows[index] = windows.back();
+		windows.pop_back();
+		++destroyCount;
+	}
+
+	void HandleEvents(){
+		for(xcb_generic_event_t *pevent = xcb_poll_for_event(pcon); pevent; pevent = xcb_poll_for_event(pcon)){
+			if((pevent->response_type & 0x7f) == XCB_MAP_NOTIFY){
+				xcb_map_notify_event_t *pev = (xcb_map_notify_event_t*)pevent;
+				auto m = mapTimes.find(pev->window);
+				if(m != mapTimes.end()){
+					uint64 t = Profiler::GetTime();
+					mapLatency.Add((float)(t-(*m).second)*1e-6f);
+					mapTimes.erase(m);
+					if(burstRemaining > 0 && --burstRemaining == 0)
+						burstTime = (float)(t-burstBeginTime)*1e-6f;
+				}
+			}
+			free(pevent);
+		}
+	}
+
+	void Run(){
+		uint64 beginTime = Profiler::GetTime();
+		burstBeginTime = beginTime;
+		burstRemaining = burstCount;
+		for(uint i = 0; i < burstCount; ++i)
+			CreateWindow(false,false);
+		xcb_flush(pcon);
+
+		//the continuous load starts once the burst has been mapped, or after a timeout if the window manager lags behind
+		uint64 stormBeginTime = 0, nextTime = 0, interval = rate > 0?1000000000ull/rate:0;
+		uint maxWindowCount = std::max(64u,burstCount);
+		while(!stop){
+			HandleEvents();
+			uint64 t = Profiler::GetTime();
+			if(duration > 0 && t-beginTime >= (uint64)duration*1000000000ull)
+				break;
+			if(stormBeginTime == 0){
+				if(burstRemaining > 0 && t-burstBeginTime < 10000000000ull){
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					continue;
+				}
+				stormBeginTime = nextTime = t;
+			}
+			if(interval == 0 || t < nextTime){
+				std::this_thread::sleep_for(std::chrono::microseconds(std::min<uint64>(nextTime-t,1000000)/1000+1));
+				continue;
+			}
+			nextTime += interval;
+
+			uint op = Random()%16;
+			if(windows.size() == 0 || (op < 4 && windows.size() < maxWindowCount)){
+				uint kind = Random()%4;
+				CreateWindow(kind == 0,kind == 1);
+			}else
+			if(op < 9){
+				uint values[2] = {200+Random()%600,150+Random()%450};
+				xcb_configure_window(pcon,windows[Random()%windows.size()],XCB_CONFIG_WINDOW_WIDTH|XCB_CONFIG_WINDOW_HEIGHT,values);
+				++configureCount;
+			}else
+			if(op < 13){
+				Rename(windows[Random()%windows.size()]);
+				++renameCount;
+			}else DestroyWindow(Random()%windows.size());
+			xcb_flush(pcon);
+		}
+
+		while(windows.size() > 0)
+			DestroyWindow(windows.size()-1);
+		xcb_flush(pcon);
+		finished = true;
+	}
+
+	xcb_connection_t *pcon;
+	xcb_screen_t *pscr;
+	enum ATOM{
+		ATOM_NET_WM_NAME,
+		ATOM_UTF8_STRING,
+		ATOM_NET_WM_WINDOW_TYPE,
+		ATOM_NET_WM_WINDOW_TYPE_DIALOG,
+		ATOM_COUNT
+	};
+	xcb_atom_t atoms[ATOM_COUNT];
+	uint rate;
+	uint burstCount;
+	uint duration; //seconds, 0 until the window manager exits
+	uint seed;
+	std::vector<xcb_window_t> windows;
+	std::unordered_map<xcb_window_t, uint64> mapTimes; //windows waiting for the MapNotify
+	TimingStats mapLatency;
+	uint createCount, configureCount, renameCount, destroyCount;
+	uint burstRemaining;
+	uint64 burstBeginTime;
+	float burstTime; //ms, negative if not completed
+	std::thread thread;
+	std::atomic<bool> stop;
+	std::atomic<bool> finished;
+};
+
+#ifdef CHAMFER_XTEST
+//Synthetic key presses for the key binding latency (KeyLatency): injects the given bindings in turn
+//with XTEST from a separate connection, holding the modifiers of each binding, at the given rate.
+class KeyInjector{
+public:
+	struct Key{
+		xcb_keycode_t keycode;
+		uint mask;
+	};
+	KeyInjector(const std::vector<Key> &_keys, uint _rate, uint _count) : keys(_keys), rate(_rate), count(_count), stop(false), finished(false){
+		pcon = xcb_connect(0,0);
+		if(xcb_connection_has_error(pcon)){
+			xcb_disconnect(pcon);
+			throw Exception("Key injector failed to connect to the X server.");
+		}
+		const xcb_query_extension_reply_t *pextReply = xcb_get_extension_data(pcon,&xcb_test_id);
+		if(!pextReply || !pextReply->present){
+			xcb_disconnect(pcon);
+			throw Exception("XTEST extension not available.");
+		}
+		pscr = xcb_setup_roots_iterator(xcb_get_setup(pcon)).data;
+
+		//the first key of each modifier
+		for(uint i = 0; i < 8; ++i)
+			modifierKeycodes[i] = 0;
+		xcb_get_modifier_mapping_reply_t *pmodmapReply = xcb_get_modifier_mapping_reply(pcon,xcb_get_modifier_mapping(pcon),0);
+		if(pmodmapReply){
+			xcb_keycode_t *pmodmap = xcb_get_modifier_mapping_keycodes(pmodmapReply);
+			for(uint i = 0; i < 8; ++i)
+				for(uint j = 0; j < pmodmapReply->keycodes_per_modifier; ++j)
+					if(pmodmap[i*pmodmapReply->keycodes_per_modifier+j]){
+						modifierKeycodes[i] = pmodmap[i*pmodmapReply->keycodes_per_modifier+j];
+						break;
+					}
+			free(pmodmapReply);
+		}
+
+		thread = std::thread(&KeyInjector::Run,this);
+	}
+
+	~KeyInjector(){
+		Stop();
+		xcb_disconnect(pcon);
+	}
+
+	void Stop(){
+		stop = true;
+		if(thread.joinable())
+			thread.join();
+	}
+
+	bool IsFinished() const{
+		return finished;
+	}
+
+private:
+	void Inject(const Key &key){
+		for(uint i = 0; i < 8; ++i)
+			if(key.mask & (1u<<i) && modifierKeycodes[i])
+				xcb_test_fake_input(pcon,XCB_KEY_PRESS,modifierKeycodes[i],XCB_CURRENT_TIME,pscr->root,0,0,XCB_NONE);
+		xcb_flush(pcon);
+		KeyLatency::injectTime = Profiler::GetTime();
+		xcb_test_fake_input(pcon,XCB_KEY_PRESS,key.keycode,XCB_CURRENT_TIME,pscr->root,0,0,XCB_NONE);
+		xcb_test_fake_input(pcon,XCB_KEY_RELEASE,key.keycode,XCB_CURRENT_TIME,pscr->root,0,0,XCB_NONE);
+		for(uint i = 0; i < 8; ++i)
+			if(key.mask & (1u<<i) && modifierKeycodes[i])
+				xcb_test_fake_input(pcon,XCB_KEY_RELEASE,modifierKeycodes[i],XCB_CURRENT_TIME,pscr->root,0,0,XCB_NONE);
+		xcb_flush(pcon);
+	}
+
+	void Run(){
+		std::chrono::nanoseconds interval(1000000000ull/std::max(rate,1u));
+		auto nextTime = std::chrono::steady_clock::now();
+		for(uint i = 0; !stop && (count == 0 || i < count); ++i){
+			Inject(keys[i%keys.size()]);
+			nextTime += interval;
+			std::this_thread::sleep_until(nextTime);
+		}
+		//let the last key press reach the screen
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		finished = true;
+	}
+
+	xcb_connection_t *pcon;
+	xcb_screen_t *pscr;
+	xcb_keycode_t modifierKeycodes[8]; //by modifier bit
+	std::vector<Key> keys;
+	uint rate;
+	uint count; //0 until exit
+	std::thread thread;
+	std::atomic<bool> stop;
+	std::atomic<bool> finished;
+};
+#endif
+
+//SIGUSR1 requests the statistics, printed by the main loop
+static volatile sig_atomic_t statsRequested = 0;
+
+static void SignalStats(sint sig){
+	statsRequested = 1;
+}
+
+//SIGTERM and SIGINT end the main loop, so that the statistics and the trace are written. The
+//self-pipe wakes the backend if it's waiting for events.
+static volatile sig_atomic_t exitRequested = 0;
+static sint exitPipe[2] = {-1,-1};
+
+static void SignalExit(sint sig){
+	exitRequested = 1;
+	char c = 0;
+	if(write(exitPipe[1],&c,1) < 0)
+		return; //the pipe is full, or was not created
+}
+
+//Summary of a run as JSON, to track the performance of a scenario across versions. The command
+//line identifies the scenario.
+static void WriteStatsJSON(const char *pfileName, sint argc, const char **pargv, const Compositor::CompositorInterface *pcompInt, uint64 beginTime){
+	FILE *pf = fopen(pfileName,"w");
+	if(!pf){
+		DebugPrintf(stderr,"Failed to open %s for writing.\n",pfileName);
+		return;
+	}
+	fprintf(pf,"{\"command\": \"");
+	for(sint i = 0; i < argc; ++i){
+		if(i > 0)
+			fputc(' ',pf);
+		for(const char *pc = pargv[i]; *pc; ++pc){
+			if(*pc == '"' || *pc == '\\')
+				fputc('\\',pf);
+			if((unsigned char)*pc >= 0x20)
+				fputc(*pc,pf);
+		}
+	}
+	struct timespec cpuTime;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&cpuTime);
+	fprintf(pf,"\",\n\"wallTime\": %.3f, \"cpuTime\": %.3f,\n\"cpuPhases\": ",
+		(float)(Profiler::GetTime()-beginTime)*1e-9f,(float)cpuTime.tv_sec+(float)cpuTime.tv_nsec*1e-9f);
+	Profiler::WriteJSON(pf);
+	fprintf(pf,",\n\"keyLatency\": ");
+	KeyLatency::WriteJSON(pf);
+#ifdef CHAMFER_ALLOC_PROFILE
+	fprintf(pf,",\n\"allocations\": ");
+	AllocProfiler::WriteJSON(pf);
+#endif
+	if(pcompInt){
+		fprintf(pf,",\n\"compositor\": ");
+		pcompInt->WriteStatsJSON(pf);
+	}
+	fprintf(pf,"}\n");
+	fclose(pf);
+}
+
+//Frames read back from the headless compositor are in B8G8R8A8, golden images are stored as binary PPM.
+static bool WriteImage(const char *pfileName, const unsigned char *pdata, uint w, uint h){
+	FILE *pf = fopen(pfileName,"wb");
+	if(!pf)
+		return false;
+	fprintf(pf,"P6\n%u %u\n255\n",w,h);
+	for(uint i = 0, n = w*h; i < n; ++i){
+		unsigned char rgb[3] = {pdata[4*i+2],pdata[4*i+1],pdata[4*i+0]};
+		fwrite(rgb,1,3,pf);
+	}
+	fclose(pf);
+	return true;
+}
+
+//Number of pixels differing from the PPM image by more than the tolerance in any channel, or -1 if the image cannot be read or its size differs.
+static sint CompareImage(const char *pfileName, const unsigned char *pdata, uint w, uint h, uint tolerance){
+	FILE *pf = fopen(pfileName,"rb");
+	if(!pf)
+		return -1;
+	uint w1, h1, maxValue;
+	if(fscanf(pf,"P6 %u %u %u",&w1,&h1,&maxValue) != 3 || fgetc(pf) == EOF || w1 != w || h1 != h || maxValue != 255){
+		fclose(pf);
+		return -1;
+	}
+	sint mismatchCount = 0;
+	for(uint i = 0, n = w*h; i < n; ++i){
+		unsigned char rgb[3];
+		if(fread(rgb,1,3,pf) != 3){
+			fclose(pf);
+			return -1;
+		}
+		if(abs((sint)rgb[0]-(sint)pdata[4*i+2]) > (sint)tolerance ||
+			abs((sint)rgb[1]-(sint)pdata[4*i+1]) > (sint)tolerance ||
+			abs((sint)rgb[2]-(sint)pdata[4*i+0]) > (sint)tolerance)
+			++mismatchCount;
+	}
+	fclose(pf);
+	return mismatchCount;
+}
+
+//Synthetic container tree rendered by the headless compositor. The clients are laid out in columns
+//of four, and a few of them are damaged each frame.
+class HeadlessScene{
+public:
+	HeadlessScene(const Compositor::CompositorInterface::Configuration *pcompConfig, uint clientCount, uint w, uint h, args::ValueFlagList<std::string> &shaderPaths) : damageIndex(0){
+		proot = new WManager::Container();
+		proot->SetLayout(WManager::Container::LAYOUT_HSPLIT);
+		Config::BackendInterface::pfocus = proot;
+		try{
+			pcomp = new HeadlessCompositor(pcompConfig,proot,&stackAppendix,w,h,shaderPaths);
+
+		}catch(Exception e){
+			delete proot;
+			throw;
+		}
+
+		static const char *pshaderName[Compositor::Pipeline::SHADER_MODULE_COUNT] = {
+			"frame_vertex.spv","frame_geometry.spv","frame_fragment.spv"
+		};
+		WManager::Container::Setup setup;
+		setup.borderWidth = glm::vec2(0.015f);
+		for(uint i = 0; i < clientCount; ++i){
+			if(i%4 == 0)
+				containers.push_back(new WManager::Container(proot,setup));
+			WManager::Container *pcontainer = new WManager::Container(containers.back(),setup);
+			containers.push_back(pcontainer);
+			Compositor::HeadlessClientFrame *pclientFrame = new Compositor::HeadlessClientFrame(pcontainer,pshaderName,pcomp);
+			pcontainer->pclient = pclientFrame;
+			clients.push_back(pclientFrame);
+		}
+		proot->Stack();
+		if(clients.size() > 0)
+			Config::BackendInterface::pfocus = clients.back()->pcontainer;
+	}
+
+	~HeadlessScene(){
+		for(Compositor::HeadlessClientFrame *pclientFrame : clients)
+			delete pclientFrame;
+		delete pcomp;
+		for(WManager::Container *pcontainer : containers)
+			delete pcontainer;
+		delete proot;
+	}
+
+	void Render(uint frameCount, uint damageCount, TimingStats *pframeStats){
+		for(uint i = 0; i < frameCount; ++i){
+			for(uint j = 0; j < std::min(damageCount,(uint)clients.size()); ++j, damageIndex = (damageIndex+1)%clients.size())
+				pcomp->Damage(clients[damageIndex]);
+
+			uint64 frameBeginTime = Profiler::GetTime();
+			{
+#ifdef CHAMFER_ALLOC_PROFILE
+				AllocProfiler::Scope allocScope("frame");
+#endif
+				pcomp->WaitFrameSlot();
+				if(!pcomp->Present())
+					throw Exception("Frame deferred after waiting for the frame slot.");
+			}
+			if(pframeStats)
+				pframeStats->Add((float)(Profiler::GetTime()-frameBeginTime)*1e-6f);
+#ifdef CHAMFER_ALLOC_PROFILE
+			AllocProfiler::EndFrame();
+#endif
+		}
+	}
+
+	//The first frames record every client and wait for the requested pipelines, and are left out of the
+	//measurements. The GPU timestamps are read back a few frames later, so the warm-up continues for a
+	//while once the pipelines are in place.
+	void WarmUp(uint damageCount){
+		for(uint readyCount = 0; readyCount < WARMUP_FRAME_COUNT;){
+			Render(1,damageCount,0);
+			readyCount = pcomp->PipelinesPending()?0:readyCount+1;
+		}
+		pcomp->ResetStats();
+	}
+
+	enum{
+		WARMUP_FRAME_COUNT = 8
+	};
+	HeadlessCompositor *pcomp;
+	WManager::Container *proot;
+	std::vector<std::pair<const WManager::Client *, WManager::Client *>> stackAppendix;
+	std::vector<WManager::Container *> containers;
+	std::vector<Compositor::HeadlessClientFrame *> clients;
+	uint damageIndex;
+};
+
+//Render the headless scene offscreen, without X11 or a display. Prints the frame times, and optionally
+//compares the final frame against a golden image, which is written instead if it doesn't exist yet.
+static sint RunHeadless(const Compositor::CompositorInterface::Configuration *pcompConfig, uint frameCount, uint clientCount, uint damageCount, uint w, uint h, const char *pgoldenPath, args::ValueFlagList<std::string> &shaderPaths, const char *pstatsPath, sint argc, const char **pargv){
+	HeadlessScene *pscene;
+	try{
+		pscene = new HeadlessScene(pcompConfig,clientCount,w,h,shaderPaths);
+
+	}catch(Exception e){
+		DebugPrintf(stderr,"%s\n",e.what());
+		return 1;
+	}
+	HeadlessCompositor *pcomp = pscene->pcomp;
+
+	sint result = 0;
+	TimingStats frameStats;
+	uint64 beginTime = Profiler::GetTime();
+#ifdef CHAMFER_ALLOC_PROFILE
+	AllocProfiler::Initialize();
+#endif
+	try{
+		pscene->Render(frameCount,damageCount,&frameStats);
+		pcomp->WaitIdle();
+		float totalTime = (float)(Profiler::GetTime()-beginTime)*1e-9f;
+
+		LogFlush();
+		printf("Headless: %u frames, %u clients, %ux%u\n",frameCount,clientCount,w,h);
+		printf("%-28s %8s %8s %8s %8s\n","frame (ms)","mean","p50","p99","count");
+		printf("%-28s %8.3f %8.3f %8.3f %8u\n","cpu",frameStats.GetMean(),frameStats.GetPercentile(0.5f),frameStats.GetPercentile(0.99f),frameStats.GetCount());
+		const TimingStats &recordStats = pcomp->GetRecordStats();
+		printf("%-28s %8.3f %8.3f %8.3f %8u\n","record",recordStats.GetMean(),recordStats.GetPercentile(0.5f),recordStats.GetPercentile(0.99f),recordStats.GetCount());
+		if(totalTime > 0.0f)
+			printf("%u frames in %.3f s, %.1f fps (including the GPU)\n",frameCount,totalTime,(float)frameCount/totalTime);
+		Profiler::Print(stdout);
+#ifdef CHAMFER_ALLOC_PROFILE
+		AllocProfiler::Print(stdout);
+#endif
+		pcomp->PrintLatencyStats(stdout);
+		if(pstatsPath)
+			WriteStatsJSON(pstatsPath,argc,pargv,pcomp,beginTime);
+
+		if(pgoldenPath && frameCount > 0){
+			unsigned char *pdata = new unsigned char[4*w*h];
+			pcomp->ReadFrame(pdata);
+			struct stat st;
+			if(stat(pgoldenPath,&st) != 0){
+				if(!WriteImage(pgoldenPath,pdata,w,h)){
+					DebugPrintf(stderr,"Failed to write the golden image %s.\n",pgoldenPath);
+					result = 1;
+				}else DebugPrintf(stdout,"Golden image written to %s.\n",pgoldenPath);
+			}else{
+				//small differences are allowed, as the rasterization may vary slightly between drivers
+				sint mismatchCount = CompareImage(pgoldenPath,pdata,w,h,8);
+				if(mismatchCount < 0){
+					DebugPrintf(stderr,"Failed to read the golden image %s, or the size differs.\n",pgoldenPath);
+					result = 1;
+				}else
+				if((float)mismatchCount > 0.001f*(float)(w*h)){
+					DebugPrintf(stderr,"Frame differs from the golden image %s in %d pixels.\n",pgoldenPath,mismatchCount);
+					result = 1;
+				}else DebugPrintf(stdout,"Frame matches the golden image (%d pixels differ).\n",mismatchCount);
+			}
+			delete []pdata;
+		}
+
+	}catch(Exception e){
+		DebugPrintf(stderr,"%s\n",e.what());
+		pcomp->WaitIdle();
+		result = 1;
+	}
+
+	Tracer::Write();
+
+	delete pscene;
+
+	return result;
+}
+
+//Benchmark scenarios, each rendering the headless scene in a number of configurations in turn. Every
+//pass creates a new compositor, renders the warm-up frames and then measures the given frames.
+struct HeadlessBenchPass{
+	std::string name;
+	Compositor::CompositorInterface::Configuration config;
+	uint variant; //Pipeline::VARIANT bits forced on every client
+};
+
+static sint RunHeadlessBench(const Compositor::CompositorInterface::Configuration *pcompConfig, const char *pscenario, uint frameCount, uint clientCount, uint damageCount, uint w, uint h, args::ValueFlagList<std::string> &shaderPaths, const char *pstatsPath){
+	std::vector<HeadlessBenchPass> passes;
+	if(strcmp(pscenario,"record") == 0){
+		//only the damaged and changed clients are re-recorded when cached
+		for(uint i = 0; i < 2; ++i){
+			HeadlessBenchPass &pass = passes.emplace_back();
+			pass.name = i == 0?"cached":"uncached";
+			pass.config = *pcompConfig;
+			pass.config.instancedRendering = false; //records into the primary buffer directly
+			pass.config.uncachedRecording = i == 1;
+			pass.variant = 0;
+		}
+	}else
+	if(strcmp(pscenario,"threads") == 0){
+		//scaling of the recording from one thread up to --render-threads, or the number of cores
+		uint threadCount = pcompConfig->renderThreadCount > 1?pcompConfig->renderThreadCount:std::max(std::thread::hardware_concurrency(),1u);
+		if(clientCount < 2*Compositor::CompositorInterface::RENDER_RANGE_MIN_SIZE)
+			DebugPrintf(stderr,"The recording is split only with at least %u clients per thread, and will not scale with %u clients.\n",(uint)Compositor::CompositorInterface::RENDER_RANGE_MIN_SIZE,clientCount);
+		for(uint i = 1; i <= threadCount; ++i){
+			HeadlessBenchPass &pass = passes.emplace_back();
+			pass.name = std::to_string(i)+(i > 1?" threads":" thread");
+			pass.config = *pcompConfig;
+			pass.config.renderThreadCount = i;
+			pass.config.instancedRendering = false;
+			pass.config.uncachedRecording = true; //with caching, there is little left to split
+			pass.variant = 0;
+		}
+	}else
+	if(strcmp(pscenario,"variants") == 0){
+		//GPU cost of the frame shader variants, each forced on every client
+		static const char *pvariantNames[] = {"all features","no shadow","no border","no rounded corners","no focus indicator","no features"};
+		static const uint variants[] = {
+			0,
+			Compositor::Pipeline::VARIANT_NO_SHADOW,
+			Compositor::Pipeline::VARIANT_NO_BORDER,
+			Compositor::Pipeline::VARIANT_NO_ROUNDED_CORNERS,
+			Compositor::Pipeline::VARIANT_NO_FOCUS_INDICATOR,
+			Compositor::Pipeline::VARIANT_NO_SHADOW|Compositor::Pipeline::VARIANT_NO_BORDER|Compositor::Pipeline::VARIANT_NO_ROUNDED_CORNERS|Compositor::Pipeline::VARIANT_NO_FOCUS_INDICATOR
+		};
+		for(uint i = 0; i < sizeof(variants)/sizeof(variants[0]); ++i){
+			HeadlessBenchPass &pass = passes.emplace_back();
+			pass.name = pvariantNames[i];
+			pass.config = *pcompConfig;
+			pass.config.instancedRendering = false; //the instanced shaders select the features at run time, without specialization
+			pass.config.gpuTiming = true;
+			pass.variant = variants[i];
+		}
+	}else{
+		DebugPrintf(stderr,"Unknown headless benchmark %s.\n",pscenario);
+		return 1;
+	}
+
+	FILE *pf = 0;
+	if(pstatsPath){
+		pf = fopen(pstatsPath,"w");
+		if(!pf){
+			DebugPrintf(stderr,"Failed to open %s for writing.\n",pstatsPath);
+			return 1;
+		}
+		fprintf(pf,"{\"scenario\": \"%s\", \"frames\": %u, \"clients\": %u, \"damage\": %u, \"width\": %u, \"height\": %u,\n\"passes\": [",
+			pscenario,frameCount,clientCount,damageCount,w,h);
+	}
+
+	LogFlush();
+	printf("Headless benchmark %s: %u frames, %u clients, %u damaged per frame, %ux%u\n",pscenario,frameCount,clientCount,damageCount,w,h);
+	printf("%-20s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n","(ms)","frame","p50","p99","record","p50","p99","gpu","p99","draw");
+
+	sint result = 0;
+	for(uint i = 0; i < passes.size(); ++i){
+		HeadlessScene *pscene;
+		try{
+			pscene = new HeadlessScene(&passes[i].config,clientCount,w,h,shaderPaths);
+
+		}catch(Exception e){
+			DebugPrintf(stderr,"%s\n",e.what());
+			result = 1;
+			break;
+		}
+
+		for(Compositor::HeadlessClientFrame *pclientFrame : pscene->clients)
+			pclientFrame->shaderUserVariant = passes[i].variant;
+
+		TimingStats frameStats;
+		try{
+			pscene->WarmUp(damageCount);
+			pscene->Render(frameCount,damageCount,&frameStats);
+			pscene->pcomp->WaitIdle();
+
+		}catch(Exception e){
+			DebugPrintf(stderr,"%s\n",e.what());
+			pscene->pcomp->WaitIdle();
+			delete pscene;
+			result = 1;
+			break;
+		}
+
+		//GPU columns only with --gpu-timing, or in the variants scenario
+		const TimingStats &recordStats = pscene->pcomp->GetRecordStats();
+		const TimingStats &renderPassStats = pscene->pcomp->GetRenderPassStats();
+		TimingStats drawStats = pscene->pcomp->GetDrawStats(passes[i].variant);
+		LogFlush(); //warnings from the pass
+		printf("%-20s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f",passes[i].name.c_str(),
+			frameStats.GetMean(),frameStats.GetPercentile(0.5f),frameStats.GetPercentile(0.99f),
+			recordStats.GetMean(),recordStats.GetPercentile(0.5f),recordStats.GetPercentile(0.99f));
+		if(passes[i].config.gpuTiming)
+			printf(" %8.3f %8.3f %8.3f\n",renderPassStats.GetMean(),renderPassStats.GetPercentile(0.99f),drawStats.GetMean());
+		else printf(" %8s %8s %8s\n","-","-","-");
+		fflush(stdout);
+
+		if(pf){
+			fprintf(pf,"%s\n{\"name\": \"%s\", \"variant\": %u, \"frameTimeMs\": ",i > 0?",":"",passes[i].name.c_str(),passes[i].variant);
+			frameStats.WriteJSON(pf);
+			fprintf(pf,", \"recordTimeMs\": ");
+			recordStats.WriteJSON(pf);
+			if(passes[i].config.gpuTiming){
+				fprintf(pf,", \"gpuRenderMs\": ");
+				renderPassStats.WriteJSON(pf);
+				fprintf(pf,", \"gpuDrawMs\": ");
+				drawStats.WriteJSON(pf);
+			}
+			fprintf(pf,"}");
+		}
+
+		delete pscene;
+	}
+
+	if(pf){
+		fprintf(pf,"]}\n");
+		fclose(pf);
+	}
+
+	return result;
+}
+
 int main(sint argc, const char **pargv){	
 	args::ArgumentParser parser("chamferwm - A compositing window manager","");
 	args::HelpFlag help(parser,"help","Display this help menu",{'h',"help"});
 
 	args::ValueFlag<std::string> configPath(parser,"path","Configuration Python script",{"config",'c'},"config.py");
+	args::ValueFlag<uint> statsInterval(parser,"seconds","Print the profiler and damage latency statistics periodically. The statistics are also printed on SIGUSR1.",{"stats-interval"},0);
+	args::ValueFlag<std::string> statsPath(parser,"path","Write a summary of the CPU phases, frames presented, bytes uploaded and damage latencies into a JSON file on exit.",{"stats-json"});
+	args::ValueFlag<std::string> tracePath(parser,"path","Record the event handling, callbacks and frame pipeline into a trace event JSON file, viewable in chrome://tracing or Perfetto. The file is written on exit.",{"trace"});
 
 	args::Group group_backend(parser,"Backend",args::Group::Validators::DontCare);
 	args::Flag debugBackend(group_backend,"debugBackend","Create a test environment for the compositor engine without redirection. The application will not act as a window manager.",{'d',"debug-backend"});
+	args::ValueFlag<uint> stress(group_backend,"count","Populate the debug backend with the given number of synthetic clients, damaged continuously. Reports the frame rate and upload bandwidth once a second.",{"stress"});
+	args::ValueFlag<std::string> stressPattern(group_backend,"pattern","Damage pattern of the stress clients: video (whole window every frame), scroll (a strip of text lines every frame), blink (a cursor twice a second) or mixed.",{"stress-pattern"},"mixed");
+	args::ValueFlag<uint> stressColumns(group_backend,"count","Number of columns the stress clients are laid out in. By default, the configuration places them.",{"stress-columns"},0);
+	args::ValueFlag<uint> wmStorm(group_backend,"rate","Run a synthetic X client which creates, reconfigures, renames and destroys windows, including transient and floating ones, at the given number of operations per second. Reports the map latencies on exit. Intended to be run under Xvfb.",{"wm-storm"});
+	args::ValueFlag<uint> wmStormBurst(group_backend,"count","Number of windows the storm client maps at once before the continuous load, as in a session restore.",{"wm-storm-burst"},0);
+	args::ValueFlag<uint> wmStormDuration(group_backend,"seconds","Exit after the storm has run for the given time. By default the storm runs until exit.",{"wm-storm-duration"},0);
+#ifdef CHAMFER_XTEST
+	args::ValueFlag<uint> keyBench(group_backend,"rate","Inject the key bindings given with --key-bench-key with XTEST, at the given number of key presses per second, to measure the latency of the bindings. Intended to be run under Xvfb.",{"key-bench"});
+	args::ValueFlagList<uint> keyBenchKeys(group_backend,"id","Key binding id, as given to BindKey(), to inject with --key-bench. The bindings are injected in turn.",{"key-bench-key"});
+	args::ValueFlag<uint> keyBenchCount(group_backend,"count","Exit after the given number of injected key presses. By default they are injected until exit.",{"key-bench-count"},0);
+#endif
+	args::ValueFlag<std::string> recordPath(group_backend,"path","Record the X events handled by the window manager, and the replies the handling depends on, into a binary log.",{"record"});
+	args::ValueFlag<std::string> replayPath(group_backend,"path","Replay a log written with --record in place of the live events, as fast as they are handled, and exit at its end. The windows of the recording don't exist, so their contents are replaced by a flat color.",{"replay"});
+	args::Flag validateTree(group_backend,"validateTree","Check the consistency of the container tree after each batch of events. Inconsistencies are printed, and the exit status is nonzero if any were found.",{"validate-tree"});
+
+	args::Group group_headless(parser,"Headless",args::Group::Validators::DontCare);
+	args::ValueFlag<uint> headless(group_headless,"frames","Render the given number of frames offscreen with a synthetic container tree, without X11 or a display, and report the frame times. A software rasterizer such as lavapipe can be selected with --device-index.",{"headless"});
+	args::ValueFlag<uint> headlessClients(group_headless,"count","Number of synthetic clients in headless mode.",{"headless-clients"},8);
+	args::ValueFlag<uint> headlessDamage(group_headless,"count","Number of clients damaged each frame in headless mode.",{"headless-damage"},1);
+	args::ValueFlag<uint> headlessWidth(group_headless,"pixels","Width of the headless render target.",{"headless-width"},1920);
+	args::ValueFlag<uint> headlessHeight(group_headless,"pixels","Height of the headless render target.",{"headless-height"},1080);
+	args::ValueFlag<std::string> headlessBench(group_headless,"scenario","Render the headless frames in several configurations in turn and compare them. The scenario is one of: record (cached and uncached command buffer recording), threads (uncached recording with one up to --render-threads threads, or as many as there are cores), variants (GPU time of each frame shader variant, forced on all the clients). The results are written into the --stats-json file.",{"headless-bench"});
+	args::ValueFlag<std::string> goldenPath(group_headless,"path","Compare the final headless frame against a PPM image, exiting with an error if they differ. The image is written if it doesn't exist.",{"golden"});
 
 	args::Group group_comp(parser,"Compositor",args::Group::Validators::DontCare);
 	args::Flag noComp(group_comp,"noComp","Disable compositor.",{"no-compositor",'n'});
 	args::ValueFlag<uint> gpuIndex(group_comp,"id","GPU to use by its index. By default the first device in the list of enumerated GPUs will be used.",{"device-index"},0);
 	args::ValueFlagList<std::string> shaderPaths(group_comp,"path","Shader lookup path. SPIR-V shader objects are identified by an '.spv' extension.",{"shader-path"});
+	args::Flag instancedRendering(group_comp,"instanced","Draw the windows using the default frame shaders with instanced draws, without the geometry shader. Requires descriptor indexing support.",{"instanced"});
+	args::Flag prebuildPipelines(group_comp,"prebuild","Compile the pipelines of all known shader combinations at startup, instead of when first used. Compiled pipelines are cached on disk in either case.",{"prebuild-pipelines"});
+	args::Flag gpuTiming(group_comp,"gpuTiming","Measure the GPU time of the copy and render passes and of each window draw with timestamp queries. The statistics are printed on exit, and available to the configuration through chamfer.GetStats().",{"gpu-timing"});
+	args::ValueFlag<uint> renderThreads(group_comp,"count","Number of threads recording the draw commands, including the main thread. Each thread is given at least 32 windows, so the work is split only with 64 windows or more.",{"render-threads"},1);
 	//args::ValueFlag<std::string> shaderPath(group_comp,"path","Path to SPIR-V shader binary blobs",{"shader-path"},".");
 
 	try{
@@ -728,9 +2148,32 @@ int main(sint argc, const char **pargv){
 		return 1;
 	}
 
+	if(tracePath)
+		Tracer::Initialize(tracePath.Get().c_str());
+
 	Config::Loader *pconfigLoader = new Config::Loader(pargv[0]);
 	pconfigLoader->Run(configPath.Get().c_str(),"config.py");
 
+	Compositor::CompositorInterface::Configuration compConfig;
+	compConfig.deviceIndex = gpuIndex.Get();
+	compConfig.renderThreadCount = renderThreads.Get();
+	compConfig.instancedRendering = instancedRendering.Get();
+	compConfig.prebuildPipelines = prebuildPipelines.Get();
+	compConfig.gpuTiming = gpuTiming.Get();
+	compConfig.uncachedRecording = false;
+
+	if(headless && headlessBench){
+		sint result = RunHeadlessBench(&compConfig,headlessBench.Get().c_str(),headless.Get(),headlessClients.Get(),headlessDamage.Get(),headlessWidth.Get(),headlessHeight.Get(),shaderPaths,statsPath?statsPath.Get().c_str():0);
+		delete pconfigLoader;
+		return result;
+	}
+
+	if(headless){
+		sint result = RunHeadless(&compConfig,headless.Get(),headlessClients.Get(),headlessDamage.Get(),headlessWidth.Get(),headlessHeight.Get(),goldenPath?goldenPath.Get().c_str():0,shaderPaths,statsPath?statsPath.Get().c_str():0,argc,pargv);
+		delete pconfigLoader;
+		return result;
+	}
+
 	RunBackend *pbackend;
 	try{
 		if(debugBackend.Get())
@@ -752,8 +2195,8 @@ int main(sint argc, const char **pargv){
 			pcomp = new NullCompositor();
 		else
 		if(debugBackend.Get())
-			pcomp = new DebugCompositor(gpuIndex.Get(),pbackend->proot,&pbackend->stackAppendix,pbackend11,shaderPaths);
-		else pcomp = new DefaultCompositor(gpuIndex.Get(),pbackend->proot,&pbackend->stackAppendix,pbackend11,shaderPaths);
+			pcomp = new DebugCompositor(&compConfig,pbackend->proot,&pbackend->stackAppendix,pbackend11,shaderPaths);
+		else pcomp = new DefaultCompositor(&compConfig,pbackend->proot,&pbackend->stackAppendix,pbackend11,shaderPaths);
 
 	}catch(Exception e){
 		DebugPrintf(stderr,"%s\n",e.what());
@@ -762,20 +2205,164 @@ int main(sint argc, const char **pargv){
 	}
 
 	pbackend->SetCompositor(pcomp);
+
+	bool stressLoad = false;
+	if(stress){
+		DebugBackend *pdebugBackend = dynamic_cast<DebugBackend *>(pbackend);
+		DebugCompositor *pdebugComp = dynamic_cast<DebugCompositor *>(pcomp);
+		static const char *ppatternNames[] = {"mixed","video","scroll","blink"}; //in DAMAGE_PATTERN order, mixed in place of none
+		uint damagePattern = ~0u;
+		for(uint i = 0; i < Compositor::X11DebugClientFrame::DAMAGE_PATTERN_COUNT; ++i)
+			if(stressPattern.Get() == ppatternNames[i])
+				damagePattern = i;
+		if(!pdebugBackend || !pdebugComp)
+			DebugPrintf(stderr,"--stress requires the debug backend and the compositor, ignored.\n");
+		else
+		if(damagePattern == ~0u)
+			DebugPrintf(stderr,"Unknown stress pattern %s, ignored.\n",stressPattern.Get().c_str());
+		else{
+			try{
+				pdebugBackend->CreateStressClients(stress.Get(),stressColumns.Get(),damagePattern);
+				pdebugComp->SetStressClients(&pdebugBackend->stressClients);
+				stressLoad = true;
+
+			}catch(Exception e){
+				DebugPrintf(stderr,"%s\n",e.what());
+			}
+		}
+	}
 	//if(pbackend11)
 		//pbackend11->SetupEnvironment();
 
+	if(recordPath || replayPath){
+		Backend::Default *pdefaultBackend = dynamic_cast<Backend::Default *>(pbackend11);
+		if(!pdefaultBackend)
+			DebugPrintf(stderr,"--record and --replay require the default backend, ignored.\n");
+		else{
+			try{
+				if(replayPath)
+					pdefaultBackend->Replay(replayPath.Get().c_str());
+				else pdefaultBackend->Record(recordPath.Get().c_str());
+
+			}catch(Exception e){
+				DebugPrintf(stderr,"%s\n",e.what());
+				delete pcomp;
+				delete pbackend;
+				return 1;
+			}
+		}
+	}
+
+	WindowStorm *pstorm = 0;
+	if(wmStorm || wmStormBurst.Get() > 0){
+		try{
+			pstorm = new WindowStorm(wmStorm?wmStorm.Get():0,wmStormBurst.Get(),wmStormDuration.Get());
+
+		}catch(Exception e){
+			DebugPrintf(stderr,"%s\n",e.what());
+		}
+	}
+#ifdef CHAMFER_XTEST
+	KeyInjector *pkeyInjector = 0;
+	if(keyBench){
+		std::vector<KeyInjector::Key> keys;
+		for(uint keyId : args::get(keyBenchKeys)){
+			KeyInjector::Key key;
+			if(pbackend11->FindKeyBinding(keyId,&key.keycode,&key.mask))
+				keys.push_back(key);
+			else DebugPrintf(stderr,"No key binding with id %u.\n",keyId);
+		}
+		if(keys.size() == 0)
+			DebugPrintf(stderr,"--key-bench requires bound keys given with --key-bench-key, ignored.\n");
+		else{
+			try{
+				pkeyInjector = new KeyInjector(keys,keyBench.Get(),keyBenchCount.Get());
+
+			}catch(Exception e){
+				DebugPrintf(stderr,"%s\n",e.what());
+			}
+		}
+	}
+#endif
+	uint validationCount = 0, invalidCount = 0;
+
+	struct sigaction action = {};
+	action.sa_handler = SignalStats;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1,&action,0);
+	if(pipe2(exitPipe,O_NONBLOCK|O_CLOEXEC) == 0)
+		pbackend11->SetWakeDescriptor(exitPipe[0]);
+	else DebugPrintf(stderr,"Failed to create the exit pipe, SIGTERM takes effect with the next event.\n");
+	action.sa_handler = SignalExit;
+	sigaction(SIGTERM,&action,0);
+	sigaction(SIGINT,&action,0);
+
+	Compositor::CompositorInterface *pcompInt = dynamic_cast<Compositor::CompositorInterface *>(pcomp);
+	Config::CompositorInterface::pcomp = pcompInt;
+	uint64 beginTime = Profiler::GetTime();
+	struct timespec statsTime;
+	clock_gettime(CLOCK_MONOTONIC,&statsTime);
+#ifdef CHAMFER_ALLOC_PROFILE
+	AllocProfiler::Initialize(); //steady state only, the startup is not counted
+#endif
+
+	bool framePending = false;
 	for(;;){
 		//TODO: can we wait for vsync before handling the event? Might help with the stuttering
-		sint result = pbackend11->HandleEvent();
+		//A deferred frame is retried after a short timeout, even if no further events arrive.
+		bool forcePoll = framePending || stressLoad || pstorm;
+#ifdef CHAMFER_XTEST
+		forcePoll = forcePoll || pkeyInjector;
+#endif
+		sint result = pbackend11->HandleEvent(forcePoll);
+		if(validateTree.Get() && result != 0){
+			++validationCount;
+			if(!pbackend->proot->Validate())
+				++invalidCount;
+		}
+		if((pstorm && pstorm->IsFinished()) || exitRequested)
+			result = -1;
+#ifdef CHAMFER_XTEST
+		if(pkeyInjector && pkeyInjector->IsFinished())
+			result = -1;
+#endif
+		if(statsInterval.Get() > 0){
+			struct timespec currentTime;
+			clock_gettime(CLOCK_MONOTONIC,&currentTime);
+			if(timespec_diff(currentTime,statsTime) >= (float)statsInterval.Get()){
+				statsTime = currentTime;
+				statsRequested = 1;
+			}
+		}
+		if(statsRequested){
+			statsRequested = 0;
+			LogFlush();
+			Profiler::Print(stdout);
+			KeyLatency::Print(stdout);
+#ifdef CHAMFER_ALLOC_PROFILE
+			AllocProfiler::Print(stdout);
+#endif
+			if(pcompInt)
+				pcompInt->PrintLatencyStats(stdout);
+		}
 		if(result == -1)
 			break;
 		else
-		if(result == 0)
+		if(result == 0 && !framePending)
 			continue;
 
 		try{
-			pcomp->Present();
+#ifdef CHAMFER_ALLOC_PROFILE
+			AllocProfiler::Scope allocScope("frame");
+#endif
+			framePending = !pcomp->Present();
+			if(!framePending){
+				KeyLatency::End();
+#ifdef CHAMFER_ALLOC_PROFILE
+				AllocProfiler::EndFrame();
+#endif
+			}
 
 		}catch(Exception e){
 			DebugPrintf(stderr,"%s\n",e.what());
@@ -784,14 +2371,38 @@ int main(sint argc, const char **pargv){
 	}
 
 	DebugPrintf(stdout,"Exit\n");
+	LogFlush();
+
+	if(pstorm){
+		pstorm->Stop();
+		pstorm->Print(stdout);
+		delete pstorm;
+	}
+#ifdef CHAMFER_XTEST
+	if(pkeyInjector){
+		pkeyInjector->Stop();
+		delete pkeyInjector;
+		KeyLatency::Print(stdout);
+	}
+#endif
+	if(validateTree.Get())
+		DebugPrintf(stdout,"Tree validated after %u event batches, %u inconsistent.\n",validationCount,invalidCount);
 
 	pcomp->WaitIdle();
+#ifdef CHAMFER_ALLOC_PROFILE
+	LogFlush();
+	AllocProfiler::Print(stdout);
+#endif
+	if(statsPath)
+		WriteStatsJSON(statsPath.Get().c_str(),argc,pargv,pcompInt,beginTime);
+	Tracer::Write();
 	pbackend->ReleaseContainers();
 
+	Config::CompositorInterface::pcomp = 0;
 	delete pcomp;
 	delete pbackend;
 	delete pconfigLoader;
 
-	return 0;
+	return invalidCount > 0?1:0;
 }
 
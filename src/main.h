@@ -8,6 +8,7 @@
 
 #include <vector>
 #include <deque>
+#include <atomic>
 
 typedef unsigned int uint;
 typedef int sint;
@@ -15,7 +16,22 @@ typedef int sint;
 typedef unsigned long long int uint64;
 typedef long long int sint64;
 
+//Messages are formatted into a per-thread ring buffer; timestamps and output are handled by a
+//background thread. DebugPrintf logs errors to stderr and info to stdout. Debug messages on the
+//hot paths are compiled in only with CHAMFER_DEBUG_LOG defined.
+enum LOG_LEVEL{
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG
+};
+void LogPrintf(uint, const char *, ...);
 void DebugPrintf(FILE *, const char *, ...);
+void LogFlush(); //write out the pending messages before printing to stdout directly
+#ifdef CHAMFER_DEBUG_LOG
+#define DebugLog(...) LogPrintf(LOG_LEVEL_DEBUG,__VA_ARGS__)
+#else
+#define DebugLog(...) do{}while(false)
+#endif
 
 #define mstrdup(s) strcpy(new char[strlen(s+1)],s)
 #define mstrfree(s) delete []s
@@ -51,6 +67,204 @@ private:
 	const char *pmsg;
 };
 
+//Rolling window of the most recent timing samples.
+class TimingStats{
+public:
+	TimingStats();
+	~TimingStats();
+	void Add(float);
+	uint GetCount() const;
+	float GetMean() const;
+	float GetPercentile(float) const;
+	void WriteJSON(FILE *) const; //milliseconds
+	enum{
+		WINDOW_SIZE = 512
+	};
+private:
+	float samples[WINDOW_SIZE];
+	uint sampleCount;
+	uint next; //oldest sample once the window is full
+};
+
+#ifdef CHAMFER_ALLOC_PROFILE
+//Heap allocations of the profiled threads, counted by the innermost Profiler scope (the phase, or
+//the event type and callback name) and by call site, and per presented frame. Built in with the
+//alloc_profile option, which replaces malloc and operator new.
+class AllocProfiler{
+public:
+	static void Initialize(); //profile the calling thread
+	static void Add(size_t, const void *);
+	static void EndFrame();
+	static void Print(FILE *);
+	static void WriteJSON(FILE *);
+	static thread_local const char *pscopeName;
+	//Attributes the allocations of the enclosing scope to the given name, for the paths without a Profiler scope.
+	class Scope{
+	public:
+		Scope(const char *pname) : pparentName(pscopeName){
+			pscopeName = pname;
+		}
+		~Scope(){
+			pscopeName = pparentName;
+		}
+	private:
+		const char *pparentName;
+	};
+	struct Entry{
+		const void *pkey; //scope name or call site
+		uint64 count;
+		uint64 bytes;
+	};
+	enum{
+		SCOPE_TABLE_SIZE = 256,
+		SITE_TABLE_SIZE = 4096 //open addressing, sites beyond this are counted only by scope
+	};
+private:
+	static Entry * Find(Entry *, uint, const void *);
+	static void SortEntries(const Entry *, uint, std::vector<const Entry *> &);
+	static Entry scopes[SCOPE_TABLE_SIZE];
+	static Entry sites[SITE_TABLE_SIZE];
+	static uint64 frameCount; //allocations since the last presented frame
+	static uint64 frameBytes;
+	static TimingStats frameCountStats;
+	static TimingStats frameByteStats;
+	static thread_local bool profiled;
+	static thread_local bool busy; //inside the profiler itself
+};
+#endif
+
+//CPU time spent in each phase of a frame, accumulated in fixed log2 buckets. Cheap enough to be
+//always on; only to be used from the main thread. Phases may nest (a callback within an event),
+//each one is inclusive.
+class Profiler{
+public:
+	enum PHASE{
+		PHASE_EVENT, //handling of a single X event
+		PHASE_CALLBACK, //Python callbacks
+		PHASE_LAYOUT, //container Translate and Stack
+		PHASE_STACK, //X window restacking
+		PHASE_RENDER_QUEUE,
+		PHASE_IMAGE_FETCH, //window contents from the X server
+		PHASE_PIXEL_COPY, //to the staging buffers
+		PHASE_RECORD, //command buffer recording
+		PHASE_SUBMIT,
+		PHASE_PRESENT,
+		PHASE_COUNT
+	};
+	enum{
+		BUCKET_COUNT = 24 //bucket i counts samples below 2^i us, the last one also everything above
+	};
+	struct Histogram{
+		uint64 count;
+		uint64 totalTime; //ns
+		uint64 maxTime;
+		uint64 buckets[BUCKET_COUNT];
+		void Add(uint64); //ns
+		uint GetPercentile(float) const; //upper bound of the bucket, in us
+		void Print(FILE *, const char *) const;
+		void WriteJSON(FILE *) const;
+	};
+	static inline uint64 GetTime(){
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC,&t);
+		return (uint64)t.tv_sec*1000000000ull+(uint64)t.tv_nsec;
+	}
+	static void Add(PHASE, uint64); //time elapsed since the given GetTime()
+	static void Add(PHASE, uint64, const char *); //traced under the given name
+	static uint GetPercentile(PHASE, float); //upper bound of the bucket, in us
+	static void Print(FILE *);
+	static void WriteJSON(FILE *);
+	static Histogram histograms[PHASE_COUNT];
+	static const char *pphaseNames[PHASE_COUNT];
+
+	//Times the enclosing scope.
+	class Scope{
+	public:
+		Scope(PHASE _phase) : phase(_phase), pname(pphaseNames[_phase]), beginTime(GetTime()){
+			BeginAllocScope();
+		}
+		Scope(PHASE _phase, const char *_pname) : phase(_phase), pname(_pname), beginTime(GetTime()){
+			BeginAllocScope();
+		}
+		~Scope(){
+			Add(phase,beginTime,pname);
+#ifdef CHAMFER_ALLOC_PROFILE
+			AllocProfiler::pscopeName = pparentName;
+#endif
+		}
+	private:
+		inline void BeginAllocScope(){
+#ifdef CHAMFER_ALLOC_PROFILE
+			pparentName = AllocProfiler::pscopeName;
+			AllocProfiler::pscopeName = pname;
+#endif
+		}
+		PHASE phase;
+		const char *pname;
+		uint64 beginTime;
+#ifdef CHAMFER_ALLOC_PROFILE
+		const char *pparentName;
+#endif
+	};
+};
+
+//Latency of the key bindings by stage, each measured from the arrival of the bound key press: to the
+//OnKeyPress dispatch, to the end of the last Translate or Stack it caused, to the flush of the
+//resulting X requests, and to the present of the next frame. Stages that a binding doesn't reach
+//are not recorded. Key presses injected by --key-bench additionally record the delay from the
+//injection to the arrival. Main thread only, except for injectTime.
+class KeyLatency{
+public:
+	enum STAGE{
+		STAGE_INJECT,
+		STAGE_DISPATCH,
+		STAGE_LAYOUT,
+		STAGE_REQUESTS,
+		STAGE_PRESENT,
+		STAGE_COUNT
+	};
+	static void Begin();
+	static void Mark(STAGE);
+	static void End();
+	static void Print(FILE *);
+	static void WriteJSON(FILE *);
+	static Profiler::Histogram histograms[STAGE_COUNT];
+	static const char *pstageNames[STAGE_COUNT];
+	static std::atomic<uint64> injectTime; //GetTime() of the last injected key press, 0 if consumed
+private:
+	static uint64 beginTime; //arrival of the pending key press, 0 if none
+	static uint64 stageTimes[STAGE_COUNT];
+};
+
+//Spans for the trace event format (chrome://tracing, Perfetto). Every thread records into its own
+//ring buffer, overwriting the oldest spans when full; the buffers are written to the trace file on
+//exit. Span names are static strings.
+class Tracer{
+public:
+	static void Initialize(const char *);
+	static void Write();
+	static void AddSpan(const char *, uint64, uint64);
+	static bool enabled;
+
+	//Traces the enclosing scope, if enabled.
+	class Scope{
+	public:
+		Scope(const char *_pname) : pname(_pname), beginTime(enabled?Profiler::GetTime():0){}
+		~Scope(){
+			if(enabled)
+				AddSpan(pname,beginTime,Profiler::GetTime());
+		}
+	private:
+		const char *pname;
+		uint64 beginTime;
+	};
+	enum{
+		RING_SIZE = 65536 //spans per thread
+	};
+private:
+	static char *pfileName;
+};
+
 class Blob{
 public:
 	Blob(const char *);